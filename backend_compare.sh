@@ -0,0 +1,14 @@
+#!/bin/bash
+# run loadgen once per reader backend on the same workload and print the reader lines side by side
+# usage: backend_compare.sh [seconds] [extra loadgen args...]
+# fanotify needs root; point --dir at a tmpfs or loop mount to keep other activity out
+secs=${1:-10}
+shift
+seed=$(date +%s)
+for backend in inotify inotify-uring; do
+	./loadgen --duration "$secs" --seed "$seed" --json /dev/null --backend "$backend" "$@" | grep "reader:"
+done
+for mark in inode filesystem mount; do
+	./loadgen --duration "$secs" --seed "$seed" --json /dev/null --backend fanotify --mark "$mark" "$@" |
+		grep "reader:"
+done
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+void bench_opts_init(struct bench_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->json = "-";
+}
+
+static int parse_double(double *out, const char *arg)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtod(arg, &end);
+	if (errno || end == arg || *end != '\0' || *out < 0) {
+		fprintf(stderr, "bad number: %s\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_ulong(unsigned long long *out, const char *arg)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtoull(arg, &end, 0);
+	if (errno || end == arg || *end != '\0') {
+		fprintf(stderr, "bad number: %s\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+int bench_parse_opt(struct bench_opts *opts, int c, const char *arg)
+{
+	unsigned long long val;
+
+	switch (c) {
+	case BENCH_OPT_DURATION:
+		opts->given |= BENCH_DURATION;
+		return parse_double(&opts->duration, arg);
+	case BENCH_OPT_WARMUP:
+		opts->given |= BENCH_WARMUP;
+		return parse_double(&opts->warmup, arg);
+	case BENCH_OPT_OPS:
+		opts->given |= BENCH_OPS;
+		if (parse_ulong(&val, arg))
+			return -1;
+		opts->ops = val;
+		return 0;
+	case BENCH_OPT_SEED:
+		opts->given |= BENCH_SEED;
+		if (parse_ulong(&val, arg))
+			return -1;
+		opts->seed = val;
+		opts->seeded = 1;
+		return 0;
+	case BENCH_OPT_JSON:
+		opts->json = arg;
+		return 0;
+	}
+	return -1;
+}
+
+/* in BENCH_* bit order */
+static const char *bench_opt_names[] = { "duration", "ops", "warmup", "seed" };
+
+int bench_opts_done(struct bench_opts *opts, unsigned int supported)
+{
+	unsigned int bit, unsupported = opts->given & ~supported;
+	struct timespec ts;
+
+	for (bit = 0; bit < sizeof(bench_opt_names) / sizeof(bench_opt_names[0]); bit++) {
+		if (unsupported & (1u << bit)) {
+			fprintf(stderr, "--%s isn't supported here\n", bench_opt_names[bit]);
+			return -1;
+		}
+	}
+	opts->supported = supported;
+	if (opts->seeded)
+		return 0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	opts->seed = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	return 0;
+}
+
+unsigned long inotify_limit(const char *name)
+{
+	char path[128];
+	unsigned long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/sys/fs/inotify/%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%lu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+int json_open_std(struct json *j, const char *path, FILE *std)
+{
+	memset(j, 0, sizeof(*j));
+	if (!path || !strcmp(path, "-")) {
+		fflush(std);
+		j->out = std;
+	} else {
+		j->out = fopen(path, "w");
+		if (!j->out) {
+			perror(path);
+			return -1;
+		}
+		j->owned = 1;
+	}
+	fputs("{", j->out);
+	j->first[0] = 1;
+	return 0;
+}
+
+int json_open(struct json *j, const char *path)
+{
+	return json_open_std(j, path, stdout);
+}
+
+void json_close(struct json *j)
+{
+	fputs("\n}\n", j->out);
+	if (j->owned)
+		fclose(j->out);
+	else
+		fflush(j->out);
+}
+
+static void json_newline(struct json *j, int level)
+{
+	fputc('\n', j->out);
+	while (level-- > 0)
+		fputs("  ", j->out);
+}
+
+/* separator, indentation and the key (if we are in an object) */
+static void json_key(struct json *j, const char *key)
+{
+	if (!j->first[j->depth])
+		fputc(',', j->out);
+	j->first[j->depth] = 0;
+	json_newline(j, j->depth + 1);
+	if (key)
+		fprintf(j->out, "\"%s\": ", key);
+}
+
+static void json_open_scope(struct json *j, const char *key, char c)
+{
+	json_key(j, key);
+	fputc(c, j->out);
+	if (j->depth < JSON_MAX_DEPTH - 1)
+		j->depth++;
+	j->first[j->depth] = 1;
+}
+
+static void json_close_scope(struct json *j, char c)
+{
+	int empty = j->first[j->depth];
+
+	if (j->depth)
+		j->depth--;
+	if (!empty)
+		json_newline(j, j->depth + 1);
+	fputc(c, j->out);
+}
+
+void json_object_begin(struct json *j, const char *key)
+{
+	json_open_scope(j, key, '{');
+}
+
+void json_object_end(struct json *j)
+{
+	json_close_scope(j, '}');
+}
+
+void json_array_begin(struct json *j, const char *key)
+{
+	json_open_scope(j, key, '[');
+}
+
+void json_array_end(struct json *j)
+{
+	json_close_scope(j, ']');
+}
+
+void json_string(struct json *j, const char *key, const char *val)
+{
+	const char *p;
+
+	json_key(j, key);
+	fputc('"', j->out);
+	for (p = val; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf(j->out, "\\%c", *p);
+		else if ((unsigned char)*p < 0x20)
+			fprintf(j->out, "\\u%04x", *p);
+		else
+			fputc(*p, j->out);
+	}
+	fputc('"', j->out);
+}
+
+void json_uint(struct json *j, const char *key, unsigned long long val)
+{
+	json_key(j, key);
+	fprintf(j->out, "%llu", val);
+}
+
+void json_int(struct json *j, const char *key, long long val)
+{
+	json_key(j, key);
+	fprintf(j->out, "%lld", val);
+}
+
+void json_double(struct json *j, const char *key, double val)
+{
+	json_key(j, key);
+	fprintf(j->out, "%.6g", val);
+}
+
+void json_hist(struct json *j, const char *key, const struct hist *h)
+{
+	json_object_begin(j, key);
+	json_uint(j, "count", h->count);
+	json_double(j, "mean_ns", h->count ? (double)h->total / h->count : 0.0);
+	json_uint(j, "p50_ns", hist_percentile(h, 50));
+	json_uint(j, "p90_ns", hist_percentile(h, 90));
+	json_uint(j, "p99_ns", hist_percentile(h, 99));
+	json_uint(j, "p99_9_ns", hist_percentile(h, 99.9));
+	json_uint(j, "max_ns", h->max);
+	json_object_end(j);
+}
+
+void json_bench_header(struct json *j, const char *tool, const struct bench_opts *opts)
+{
+	struct utsname uts;
+
+	json_string(j, "tool", tool);
+	json_object_begin(j, "system");
+	if (!uname(&uts)) {
+		json_string(j, "kernel", uts.release);
+		json_string(j, "machine", uts.machine);
+	}
+	json_int(j, "cores", sysconf(_SC_NPROCESSORS_ONLN));
+	json_object_end(j);
+	/* only what the tool honours, anything else would say nothing about the run */
+	json_object_begin(j, "run");
+	if (opts->supported & BENCH_DURATION)
+		json_double(j, "duration", opts->duration);
+	if (opts->supported & BENCH_OPS)
+		json_uint(j, "ops", opts->ops);
+	if (opts->supported & BENCH_WARMUP)
+		json_double(j, "warmup", opts->warmup);
+	if (opts->supported & BENCH_SEED)
+		json_uint(j, "seed", opts->seed);
+	json_object_end(j);
+}
@@ -0,0 +1,107 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hist.h"
+
+/*
+ * options and output shared by every tool so runs can be bounded, repeated
+ * and compared by scripts.  Tools add BENCH_LONG_OPTIONS to their own
+ * getopt_long() table and hand anything >= BENCH_OPT_BASE to bench_parse_opt().
+ */
+enum {
+	BENCH_OPT_BASE = 0x100,
+	BENCH_OPT_DURATION = BENCH_OPT_BASE,
+	BENCH_OPT_OPS,
+	BENCH_OPT_WARMUP,
+	BENCH_OPT_SEED,
+	BENCH_OPT_JSON,
+};
+
+#define BENCH_LONG_OPTIONS \
+	{"duration",	required_argument,	0, BENCH_OPT_DURATION}, \
+	{"ops",		required_argument,	0, BENCH_OPT_OPS}, \
+	{"warmup",	required_argument,	0, BENCH_OPT_WARMUP}, \
+	{"seed",	required_argument,	0, BENCH_OPT_SEED}, \
+	{"json",	required_argument,	0, BENCH_OPT_JSON}
+
+struct bench_opts {
+	/* seconds to measure for, 0 means until the tool's own end */
+	double duration;
+	/* operations to measure for, 0 means until the tool's own end */
+	unsigned long ops;
+	/* seconds to run before measuring */
+	double warmup;
+	/* seed for anything random, picked from the clock if not given */
+	uint64_t seed;
+	int seeded;
+	/* BENCH_* of the options given, and of the ones the tool honours */
+	unsigned int given;
+	unsigned int supported;
+	/* where to write the summary, "-" for stdout */
+	const char *json;
+};
+
+/* the options a tool honours, for bench_opts_done(); --json always is */
+#define BENCH_DURATION	(1 << 0)
+#define BENCH_OPS	(1 << 1)
+#define BENCH_WARMUP	(1 << 2)
+#define BENCH_SEED	(1 << 3)
+#define BENCH_ALL	(BENCH_DURATION | BENCH_OPS | BENCH_WARMUP | BENCH_SEED)
+
+void bench_opts_init(struct bench_opts *opts);
+int bench_parse_opt(struct bench_opts *opts, int c, const char *arg);
+/*
+ * call once the options are parsed with the BENCH_* the tool honours.
+ * Fails, saying why, if any other was given, so a run never records a
+ * setting which had no effect.  Picks a seed if there isn't one.
+ */
+int bench_opts_done(struct bench_opts *opts, unsigned int supported);
+
+/* splitmix64, cheap and good enough to pick files and operations */
+static inline uint64_t bench_rand(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+/* one of the fs.inotify.max_* sysctls, 0 if it can't be read */
+unsigned long inotify_limit(const char *name);
+
+/*
+ * minimal streaming JSON writer.  One member per line so the output is easy
+ * to grep as well as parse.
+ */
+#define JSON_MAX_DEPTH 16
+struct json {
+	FILE *out;
+	/* out was opened for a path, so closing the json closes it */
+	int owned;
+	int depth;
+	int first[JSON_MAX_DEPTH];
+};
+
+int json_open(struct json *j, const char *path);
+/* like json_open, but no path or "-" means std rather than stdout */
+int json_open_std(struct json *j, const char *path, FILE *std);
+void json_close(struct json *j);
+void json_object_begin(struct json *j, const char *key);
+void json_object_end(struct json *j);
+void json_array_begin(struct json *j, const char *key);
+void json_array_end(struct json *j);
+void json_string(struct json *j, const char *key, const char *val);
+void json_uint(struct json *j, const char *key, unsigned long long val);
+void json_int(struct json *j, const char *key, long long val);
+void json_double(struct json *j, const char *key, double val);
+/* latency percentiles of a histogram recorded in nanoseconds */
+void json_hist(struct json *j, const char *key, const struct hist *h);
+/* tool name, options, kernel version and core count */
+void json_bench_header(struct json *j, const char *tool, const struct bench_opts *opts);
+
+#endif /* __BENCH_H */
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include "coalesce.h"
+
+#define NIL	UINT32_MAX
+
+/*
+ * pending entries live in a fixed array, on a list in arrival order and
+ * chained off a hash of (wd, name).  Free entries are on the same next links.
+ */
+struct pending {
+	uint32_t prev, next;
+	uint32_t hnext;
+	uint32_t hash;
+	struct coalesce_event ev;
+	char name[NAME_MAX + 1];
+};
+
+struct coalesce {
+	uint64_t window_ns;
+	unsigned int max_count;
+	coalesce_emit_fn emit;
+	void *arg;
+
+	struct pending *pending;
+	uint32_t head, tail;
+	uint32_t free;
+	uint32_t *buckets;
+	uint32_t bucket_mask;
+
+	struct coalesce_stats stats;
+};
+
+static uint32_t key_hash(int32_t wd, const char *name)
+{
+	uint32_t h = 2166136261u ^ (uint32_t)wd;
+
+	h *= 16777619u;
+	for (; name && *name; name++) {
+		h ^= (unsigned char)*name;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+struct coalesce *coalesce_create(uint64_t window_ns, unsigned int max_count,
+				 unsigned int max_pending, coalesce_emit_fn emit, void *arg)
+{
+	struct coalesce *c;
+	unsigned int i;
+
+	if (!max_pending)
+		return NULL;
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->window_ns = window_ns;
+	c->max_count = max_count;
+	c->emit = emit;
+	c->arg = arg;
+
+	c->bucket_mask = 1;
+	while (c->bucket_mask < max_pending * 2)
+		c->bucket_mask <<= 1;
+	c->buckets = malloc(c->bucket_mask * sizeof(*c->buckets));
+	c->bucket_mask--;
+	c->pending = calloc(max_pending, sizeof(*c->pending));
+	if (!c->buckets || !c->pending) {
+		coalesce_destroy(c);
+		return NULL;
+	}
+	memset(c->buckets, 0xff, (c->bucket_mask + 1) * sizeof(*c->buckets));
+	for (i = 0; i < max_pending; i++)
+		c->pending[i].next = i + 1 < max_pending ? i + 1 : NIL;
+	c->free = 0;
+	c->head = c->tail = NIL;
+	return c;
+}
+
+void coalesce_destroy(struct coalesce *c)
+{
+	free(c->buckets);
+	free(c->pending);
+	free(c);
+}
+
+static void emit(struct coalesce *c, const struct coalesce_event *ev, uint64_t now)
+{
+	c->stats.out++;
+	hist_record(&c->stats.delay, now - ev->ts_ns);
+	c->emit(c->arg, ev);
+}
+
+/* emit pending entry i and put it back on the free list */
+static void emit_pending(struct coalesce *c, uint32_t i, uint64_t now)
+{
+	struct pending *p = &c->pending[i];
+	uint32_t *link = &c->buckets[p->hash & c->bucket_mask];
+
+	emit(c, &p->ev, now);
+
+	while (*link != i)
+		link = &c->pending[*link].hnext;
+	*link = p->hnext;
+
+	if (p->prev != NIL)
+		c->pending[p->prev].next = p->next;
+	else
+		c->head = p->next;
+	if (p->next != NIL)
+		c->pending[p->next].prev = p->prev;
+	else
+		c->tail = p->prev;
+
+	p->next = c->free;
+	c->free = i;
+}
+
+static uint32_t find(struct coalesce *c, uint32_t hash, int32_t wd, const char *name)
+{
+	uint32_t i;
+
+	for (i = c->buckets[hash & c->bucket_mask]; i != NIL; i = c->pending[i].hnext) {
+		struct pending *p = &c->pending[i];
+
+		if (p->hash == hash && p->ev.wd == wd &&
+		    !strcmp(p->name, name ? name : ""))
+			return i;
+	}
+	return NIL;
+}
+
+void coalesce_push(struct coalesce *c, uint64_t now, int32_t wd, uint32_t mask,
+		   uint32_t cookie, const char *name)
+{
+	struct coalesce_event ev;
+	struct pending *p;
+	uint32_t hash, i;
+
+	c->stats.in++;
+
+	/* structural events go out in order, after everything before them */
+	if (mask & ~(COALESCE_MERGE_MASK | IN_ISDIR)) {
+		c->stats.barriers++;
+		while (c->head != NIL) {
+			c->stats.barrier_flushes++;
+			emit_pending(c, c->head, now);
+		}
+		ev.ts_ns = now;
+		ev.wd = wd;
+		ev.mask = mask;
+		ev.cookie = cookie;
+		ev.count = 1;
+		ev.name = name;
+		emit(c, &ev, now);
+		return;
+	}
+
+	hash = key_hash(wd, name);
+	i = find(c, hash, wd, name);
+	if (i != NIL) {
+		p = &c->pending[i];
+		p->ev.mask |= mask;
+		if (++p->ev.count >= c->max_count && c->max_count) {
+			c->stats.count_flushes++;
+			emit_pending(c, i, now);
+		}
+		return;
+	}
+
+	if (c->free == NIL) {
+		c->stats.full_flushes++;
+		emit_pending(c, c->head, now);
+	}
+	i = c->free;
+	p = &c->pending[i];
+	c->free = p->next;
+
+	p->hash = hash;
+	p->hnext = c->buckets[hash & c->bucket_mask];
+	c->buckets[hash & c->bucket_mask] = i;
+	p->prev = c->tail;
+	p->next = NIL;
+	if (c->tail != NIL)
+		c->pending[c->tail].next = i;
+	else
+		c->head = i;
+	c->tail = i;
+
+	snprintf(p->name, sizeof(p->name), "%s", name ? name : "");
+	p->ev.ts_ns = now;
+	p->ev.wd = wd;
+	p->ev.mask = mask;
+	p->ev.cookie = cookie;
+	p->ev.count = 1;
+	p->ev.name = name ? p->name : NULL;
+
+	if (c->max_count == 1) {
+		c->stats.count_flushes++;
+		emit_pending(c, i, now);
+	}
+}
+
+void coalesce_tick(struct coalesce *c, uint64_t now)
+{
+	/* no window, only the count, a full table or a barrier flushes */
+	if (!c->window_ns)
+		return;
+	/* the list is in arrival order so only the head can be due */
+	while (c->head != NIL && now - c->pending[c->head].ev.ts_ns >= c->window_ns) {
+		c->stats.window_flushes++;
+		emit_pending(c, c->head, now);
+	}
+}
+
+void coalesce_flush(struct coalesce *c, uint64_t now)
+{
+	while (c->head != NIL)
+		emit_pending(c, c->head, now);
+}
+
+uint64_t coalesce_deadline(const struct coalesce *c)
+{
+	if (c->head == NIL || !c->window_ns)
+		return 0;
+	return c->pending[c->head].ev.ts_ns + c->window_ns;
+}
+
+const struct coalesce_stats *coalesce_stats(const struct coalesce *c)
+{
+	return &c->stats;
+}
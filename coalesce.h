@@ -0,0 +1,68 @@
+#ifndef __COALESCE_H
+#define __COALESCE_H
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+/*
+ * merge repeated events for the same (wd, name) that arrive within a window,
+ * so a file rewritten a thousand times turns in to a handful of events with
+ * the masks or'd together.  Only content events (modify, attrib, open,
+ * access, close) are merged.  Everything else - create, delete, moves,
+ * IN_IGNORED, IN_Q_OVERFLOW - is a barrier: all pending events are emitted,
+ * then the barrier itself, so nothing read after a structural event is ever
+ * emitted before it and nothing read before it is emitted after it.
+ *
+ * An entry is emitted once it has been pending for window_ns, once it has
+ * merged max_count events, or when the table is full and it is the oldest.
+ * A window_ns of 0 is no time limit and a max_count of 0 no count limit.
+ * Pending entries go out oldest first.
+ */
+#define COALESCE_MERGE_MASK	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+				 IN_CLOSE_NOWRITE | IN_OPEN | IN_ACCESS)
+
+struct coalesce_event {
+	/* when the first of the merged events was read */
+	uint64_t ts_ns;
+	int32_t wd;
+	uint32_t mask;
+	uint32_t cookie;
+	/* how many events were merged in to this one */
+	uint32_t count;
+	const char *name;
+};
+
+typedef void (*coalesce_emit_fn)(void *arg, const struct coalesce_event *ev);
+
+struct coalesce_stats {
+	unsigned long in;
+	unsigned long out;
+	unsigned long barriers;
+	/* why pending entries were emitted */
+	unsigned long window_flushes;
+	unsigned long count_flushes;
+	unsigned long full_flushes;
+	unsigned long barrier_flushes;
+	/* read to emit delay of every output event, in ns */
+	struct hist delay;
+};
+
+struct coalesce;
+
+struct coalesce *coalesce_create(uint64_t window_ns, unsigned int max_count,
+				 unsigned int max_pending, coalesce_emit_fn emit, void *arg);
+void coalesce_destroy(struct coalesce *c);
+
+void coalesce_push(struct coalesce *c, uint64_t now, int32_t wd, uint32_t mask,
+		   uint32_t cookie, const char *name);
+/* emit whatever has been waiting for the whole window */
+void coalesce_tick(struct coalesce *c, uint64_t now);
+/* emit everything */
+void coalesce_flush(struct coalesce *c, uint64_t now);
+/* when the oldest pending entry is due, 0 if nothing is pending or there's no window */
+uint64_t coalesce_deadline(const struct coalesce *c);
+const struct coalesce_stats *coalesce_stats(const struct coalesce *c);
+
+#endif /* __COALESCE_H */
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cputopo.h"
+
+/* one integer from a topology file, -1 if it isn't there (offline cpu, no sysfs) */
+static int read_topo(int cpu, const char *file)
+{
+	char path[128];
+	FILE *f;
+	int val;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static int compact_cmp(const void *a, const void *b)
+{
+	const struct cpu_info *x = a, *y = b;
+
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+/* sort keys for the scatter order, in parallel with cpus[] */
+static struct cpu_info *scatter_keys;
+
+static int scatter_cmp(const void *a, const void *b)
+{
+	const struct cpu_info *x = &scatter_keys[*(const unsigned int *)a];
+	const struct cpu_info *y = &scatter_keys[*(const unsigned int *)b];
+
+	if (x->thread != y->thread)
+		return x->thread - y->thread;
+	/* core here is the core's rank within its package */
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->package - y->package;
+}
+
+int cpu_topo_init(struct cpu_topo *t)
+{
+	struct cpu_info *keys;
+	cpu_set_t allowed;
+	unsigned int i, n = 0;
+	int cpu, rank = 0;
+
+	memset(t, 0, sizeof(*t));
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+
+	t->cpus = calloc(CPU_COUNT(&allowed), sizeof(*t->cpus));
+	t->scatter = calloc(CPU_COUNT(&allowed), sizeof(*t->scatter));
+	keys = calloc(CPU_COUNT(&allowed), sizeof(*keys));
+	if (!t->cpus || !t->scatter || !keys) {
+		free(keys);
+		cpu_topo_destroy(t);
+		return -1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		struct cpu_info *c;
+
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		c = &t->cpus[n++];
+		c->cpu = cpu;
+		c->package = read_topo(cpu, "physical_package_id");
+		c->core = read_topo(cpu, "core_id");
+		/* without sysfs every cpu is its own core */
+		if (c->core < 0)
+			c->core = cpu;
+	}
+	t->nr = n;
+	qsort(t->cpus, n, sizeof(*t->cpus), compact_cmp);
+
+	for (i = 0; i < n; i++) {
+		struct cpu_info *c = &t->cpus[i];
+		struct cpu_info *prev = i ? &t->cpus[i - 1] : NULL;
+
+		keys[i] = *c;
+		if (!prev || prev->package != c->package) {
+			t->packages++;
+			rank = 0;
+		} else if (prev->core != c->core) {
+			rank++;
+		}
+		if (prev && prev->package == c->package && prev->core == c->core) {
+			c->thread = prev->thread + 1;
+		} else {
+			c->thread = 0;
+			t->cores++;
+		}
+		keys[i].thread = c->thread;
+		keys[i].core = rank;
+		t->scatter[i] = i;
+	}
+
+	scatter_keys = keys;
+	qsort(t->scatter, n, sizeof(*t->scatter), scatter_cmp);
+	scatter_keys = NULL;
+	free(keys);
+
+	return 0;
+}
+
+void cpu_topo_destroy(struct cpu_topo *t)
+{
+	free(t->cpus);
+	free(t->scatter);
+	memset(t, 0, sizeof(*t));
+}
+
+unsigned int cpu_topo_scatter(const struct cpu_topo *t, unsigned int i)
+{
+	return t->scatter[i % t->nr];
+}
+
+unsigned int cpu_topo_sibling(const struct cpu_topo *t, unsigned int idx)
+{
+	const struct cpu_info *c = &t->cpus[idx];
+	unsigned int i;
+
+	/* compact order keeps a core's threads together, and a package's cores */
+	for (i = 0; i < t->nr; i++)
+		if (i != idx && t->cpus[i].package == c->package && t->cpus[i].core == c->core)
+			return i;
+	if (idx + 1 < t->nr && t->cpus[idx + 1].package == c->package)
+		return idx + 1;
+	if (idx > 0 && t->cpus[idx - 1].package == c->package)
+		return idx - 1;
+	return (idx + 1) % t->nr;
+}
+
+unsigned int cpu_topo_distant(const struct cpu_topo *t, unsigned int idx)
+{
+	/*
+	 * half way round compact order is the same spot in the other package
+	 * on a two socket box, and the core furthest away on one socket.
+	 */
+	return (idx + t->nr / 2) % t->nr;
+}
+
+void cpu_set_format(const cpu_set_t *set, char *buf, size_t len)
+{
+	size_t used = 0;
+	int cpu, first = -1;
+
+	buf[0] = '\0';
+	for (cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+		int in = cpu < CPU_SETSIZE && CPU_ISSET(cpu, set);
+
+		if (in && first < 0)
+			first = cpu;
+		if (in || first < 0)
+			continue;
+		if (used < len)
+			used += snprintf(buf + used, len - used, "%s%d", used ? "," : "", first);
+		if (cpu - 1 > first && used < len)
+			used += snprintf(buf + used, len - used, "-%d", cpu - 1);
+		first = -1;
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef __CPUTOPO_H
+#define __CPUTOPO_H
+
+#include <sched.h>
+#include <stddef.h>
+
+/*
+ * the cpus we're allowed to run on and where they sit, from
+ * /sys/devices/system/cpu/cpuN/topology.  cpus[] is in "compact" order:
+ * sorted by package, then core, then hyperthread, so neighbouring entries
+ * share as much cache as the box allows.  cpu_set_t needs _GNU_SOURCE.
+ */
+struct cpu_info {
+	int cpu;
+	int package;
+	int core;
+	/* which hyperthread of its core this is, 0 for the first */
+	int thread;
+};
+
+struct cpu_topo {
+	struct cpu_info *cpus;
+	unsigned int nr;
+	unsigned int packages;
+	/* physical cores, not counting hyperthreads */
+	unsigned int cores;
+	/* indexes in to cpus[] in scatter order */
+	unsigned int *scatter;
+};
+
+int cpu_topo_init(struct cpu_topo *t);
+void cpu_topo_destroy(struct cpu_topo *t);
+/*
+ * these return indexes in to cpus[].  scatter spreads out as far as possible
+ * (across packages, then cores, then hyperthreads) and wraps when asked for
+ * more cpus than there are.
+ */
+unsigned int cpu_topo_scatter(const struct cpu_topo *t, unsigned int i);
+/* the closest other cpu to cpus[idx]: a hyperthread sibling, else a core in the same package */
+unsigned int cpu_topo_sibling(const struct cpu_topo *t, unsigned int idx);
+/* the furthest cpu from cpus[idx]: another package if there is one */
+unsigned int cpu_topo_distant(const struct cpu_topo *t, unsigned int idx);
+/* "0-3,8" style list of a cpu set */
+void cpu_set_format(const cpu_set_t *set, char *buf, size_t len);
+
+#endif /* __CPUTOPO_H */
@@ -0,0 +1,8 @@
+#!/bin/bash
+# run syscall_thrash once per drain mode and print the drain cost side by side
+# usage: drain_compare.sh [seconds] [extra syscall_thrash args...]
+secs=${1:-10}
+shift
+for mode in spin epoll epoll-et uring dispatch; do
+	./syscall_thrash --interval 0 --duration "$secs" --drain "$mode" "$@" | grep "^drain"
+done
@@ -0,0 +1,299 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "evbatch.h"
+
+/*
+ * GCC vector extensions rather than intrinsics so this builds everywhere; on
+ * x86_64 it becomes SSE2, on arm64 NEON.  128 bit vectors are the widest every
+ * 64 bit target has without extra -m flags.
+ */
+#define VEC_LANES 4
+typedef uint32_t vu32 __attribute__ ((vector_size (VEC_LANES * sizeof(uint32_t))));
+typedef int32_t vs32 __attribute__ ((vector_size (VEC_LANES * sizeof(int32_t))));
+
+size_t ev_batch_decode(struct ev_batch *b, const char *buf, size_t len)
+{
+	struct inotify_event event;
+	int32_t *wd = b->wd;
+	uint32_t *mask = b->mask, *cookie = b->cookie, *elen = b->len, *off = b->off;
+	size_t pos = 0, rec;
+	unsigned int n = 0;
+
+	b->buf = buf;
+	/*
+	 * copy the header out rather than dereferencing buf, otherwise every
+	 * store to the arrays could alias buf (it's a char *) and force reloads
+	 */
+	while (n < EVBATCH_MAX && pos + sizeof(event) <= len) {
+		memcpy(&event, buf + pos, sizeof(event));
+		rec = sizeof(event) + event.len;
+		if (pos + rec > len)
+			break;
+		wd[n] = event.wd;
+		mask[n] = event.mask;
+		cookie[n] = event.cookie;
+		elen[n] = event.len;
+		off[n] = pos;
+		pos += rec;
+		n++;
+	}
+	b->count = n;
+
+	/* zeroed events never match anything */
+	b->padded = (n + EVBATCH_LANES - 1) & ~(EVBATCH_LANES - 1);
+	for (; n < b->padded; n++) {
+		wd[n] = 0;
+		mask[n] = 0;
+		cookie[n] = 0;
+		elen[n] = 0;
+		off[n] = 0;
+	}
+	return pos;
+}
+
+static inline vu32 load_lanes(const uint32_t *p)
+{
+	return *(const vu32 *)p;
+}
+
+static inline uint32_t sum_lanes(vu32 v)
+{
+	uint32_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < VEC_LANES; i++)
+		total += v[i];
+	return total;
+}
+
+unsigned int ev_batch_count(const struct ev_batch *b, uint32_t mask)
+{
+	vu32 acc = { 0 }, m = mask - (vu32){ 0 };
+	unsigned int i;
+
+	/* a true compare is all ones, so subtracting it counts */
+	for (i = 0; i < b->padded; i += VEC_LANES)
+		acc -= (vu32)((load_lanes(&b->mask[i]) & m) != 0);
+	return sum_lanes(acc);
+}
+
+unsigned int ev_batch_filter(const struct ev_batch *b, uint32_t mask, uint32_t *idx)
+{
+	vu32 m = mask - (vu32){ 0 };
+	vs32 hit;
+	unsigned int i, lane, n = 0;
+
+	for (i = 0; i < b->padded; i += VEC_LANES) {
+		hit = (load_lanes(&b->mask[i]) & m) != 0;
+		/* branch free compaction of the matching lanes */
+		for (lane = 0; lane < VEC_LANES; lane++) {
+			idx[n] = i + lane;
+			n -= hit[lane];
+		}
+	}
+	return n;
+}
+
+int ev_batch_find(const struct ev_batch *b, uint32_t mask)
+{
+	vu32 m = mask - (vu32){ 0 };
+	vs32 hit;
+	unsigned int i, lane;
+
+	for (i = 0; i < b->padded; i += VEC_LANES) {
+		hit = (load_lanes(&b->mask[i]) & m) != 0;
+		for (lane = 0; lane < VEC_LANES; lane++)
+			if (hit[lane])
+				return i + lane;
+	}
+	return -1;
+}
+
+uint32_t ev_batch_mask_union(const struct ev_batch *b)
+{
+	vu32 acc = { 0 };
+	uint32_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < b->padded; i += VEC_LANES)
+		acc |= load_lanes(&b->mask[i]);
+	for (i = 0; i < VEC_LANES; i++)
+		total |= acc[i];
+	return total;
+}
+
+/*
+ * positional popcount.  nib[j] has a 4 bit counter for every mask bit
+ * 4n + j, good for 15 vectors before it could overflow.  Those get folded in
+ * to 8 bit counters (even and odd nibbles separately), good for 16 folds,
+ * which finally get added to counts.  So it costs a few vector ops per
+ * VEC_LANES events no matter how many different bits are set.
+ */
+#define NIBBLE_ROUNDS	15
+#define BYTE_ROUNDS	16
+
+void ev_batch_classify(const struct ev_batch *b, unsigned long counts[32])
+{
+	const vu32 ones = 0x11111111u - (vu32){ 0 };
+	const vu32 low = 0x0f0f0f0fu - (vu32){ 0 };
+	vu32 nib[4], byte[8], v;
+	unsigned int i = 0, j, k, round, lane, q, half;
+
+	while (i < b->padded) {
+		memset(byte, 0, sizeof(byte));
+		for (round = 0; round < BYTE_ROUNDS && i < b->padded; round++) {
+			memset(nib, 0, sizeof(nib));
+			for (k = 0; k < NIBBLE_ROUNDS && i < b->padded; k++, i += VEC_LANES) {
+				v = load_lanes(&b->mask[i]);
+				nib[0] += v & ones;
+				nib[1] += (v >> 1) & ones;
+				nib[2] += (v >> 2) & ones;
+				nib[3] += (v >> 3) & ones;
+			}
+			for (j = 0; j < 4; j++) {
+				byte[2 * j] += nib[j] & low;
+				byte[2 * j + 1] += (nib[j] >> 4) & low;
+			}
+		}
+		/* byte q of byte[2j + half] counts mask bit 8q + 4half + j */
+		for (j = 0; j < 4; j++)
+			for (half = 0; half < 2; half++)
+				for (lane = 0; lane < VEC_LANES; lane++)
+					for (q = 0; q < 4; q++)
+						counts[8 * q + 4 * half + j] +=
+							(byte[2 * j + half][lane] >> (8 * q)) & 0xff;
+	}
+}
+
+unsigned long ev_walk_classify(const char *buf, size_t len, unsigned long counts[32],
+			       long *overflow)
+{
+	const struct inotify_event *event;
+	unsigned long n = 0;
+	size_t pos;
+
+	*overflow = -1;
+	for (pos = 0; pos + sizeof(*event) <= len; pos += sizeof(*event) + event->len, n++) {
+		event = (const struct inotify_event *)(buf + pos);
+		ev_classify_mask(event->mask, counts);
+		if ((event->mask & IN_Q_OVERFLOW) && *overflow < 0)
+			*overflow = n;
+	}
+	return n;
+}
+
+static const char *mask_bit_names[32] = {
+	[0]	= "IN_ACCESS",
+	[1]	= "IN_MODIFY",
+	[2]	= "IN_ATTRIB",
+	[3]	= "IN_CLOSE_WRITE",
+	[4]	= "IN_CLOSE_NOWRITE",
+	[5]	= "IN_OPEN",
+	[6]	= "IN_MOVED_FROM",
+	[7]	= "IN_MOVED_TO",
+	[8]	= "IN_CREATE",
+	[9]	= "IN_DELETE",
+	[10]	= "IN_DELETE_SELF",
+	[11]	= "IN_MOVE_SELF",
+	[13]	= "IN_UNMOUNT",
+	[14]	= "IN_Q_OVERFLOW",
+	[15]	= "IN_IGNORED",
+	[30]	= "IN_ISDIR",
+};
+
+const char *ev_mask_bit_name(unsigned int bit)
+{
+	if (bit >= 32)
+		return NULL;
+	return mask_bit_names[bit];
+}
+
+int ev_queued_bytes(int fd)
+{
+	int n;
+
+	if (ioctl(fd, FIONREAD, &n) < 0)
+		return -1;
+	return n;
+}
+
+int ev_reader_init(struct ev_reader *r, size_t min, size_t max)
+{
+	memset(r, 0, sizeof(*r));
+	r->min = min ? min : EV_READER_MIN;
+	r->max = max ? max : EV_READER_MAX;
+	/* anything smaller could fail to fit even one event */
+	if (r->min < EV_RECORD_MAX)
+		r->min = EV_RECORD_MAX;
+	if (r->max < r->min)
+		r->max = r->min;
+	r->want = r->min;
+	r->alloc = r->min;
+	r->buf = malloc(r->alloc);
+	return r->buf ? 0 : -1;
+}
+
+void ev_reader_free(struct ev_reader *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+static size_t reader_clamp(const struct ev_reader *r, size_t len)
+{
+	size_t size = r->min;
+
+	while (size < len && size < r->max)
+		size *= 2;
+	return size < r->max ? size : r->max;
+}
+
+ssize_t ev_reader_read(struct ev_reader *r, int fd)
+{
+	size_t want = r->want;
+	ssize_t ret;
+
+	if (r->more && r->min != r->max) {
+		int queued = ev_queued_bytes(fd);
+
+		r->queries++;
+		if (queued == 0) {
+			r->more = 0;
+			errno = EAGAIN;
+			return -1;
+		}
+		/* with room to spare, so reading all of it shows the queue is empty */
+		if (queued > 0)
+			want = reader_clamp(r, queued + EV_RECORD_MAX);
+	}
+	if (want > r->alloc) {
+		char *buf = realloc(r->buf, want);
+
+		if (!buf)
+			want = r->alloc;
+		else {
+			r->buf = buf;
+			r->alloc = want;
+		}
+	}
+
+	ret = read(fd, r->buf, want);
+	r->reads++;
+	if (ret <= 0) {
+		r->more = 0;
+		return ret;
+	}
+	if (r->min == r->max) {
+		r->more = 1;
+		return ret;
+	}
+	/* no room left for another event means there may well be one */
+	r->more = (size_t)ret + EV_RECORD_MAX > want;
+	/* size the next wakeup's read for about this much */
+	r->want = reader_clamp(r, ret + EV_RECORD_MAX);
+	return ret;
+}
@@ -0,0 +1,134 @@
+#ifndef __EVBATCH_H
+#define __EVBATCH_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+/*
+ * structure of arrays view of the struct inotify_event records in a read()
+ * buffer.  Walking the variable length records has to be done one at a time,
+ * but once the fixed size fields are in their own arrays the filtering and
+ * classifying can be done EVBATCH_LANES events at a time.  The arrays are
+ * padded with zeroed events up to a multiple of EVBATCH_LANES so the vector
+ * loops never need a scalar tail.
+ */
+#define EVBATCH_MAX	1024
+#define EVBATCH_LANES	8
+#define EVBATCH_ALIGN	32
+/*
+ * keep the arrays from being exactly 4k apart, otherwise the stores to all
+ * of them during decode alias each other (and the loads) in the store buffer
+ */
+#define EVBATCH_SLOTS	(EVBATCH_MAX + 16)
+
+struct ev_batch {
+	unsigned int count;
+	/* count rounded up to EVBATCH_LANES */
+	unsigned int padded;
+	/* the buffer the batch was decoded from, names point in to it */
+	const char *buf;
+	int32_t wd[EVBATCH_SLOTS] __attribute__ ((aligned (EVBATCH_ALIGN)));
+	uint32_t mask[EVBATCH_SLOTS] __attribute__ ((aligned (EVBATCH_ALIGN)));
+	uint32_t cookie[EVBATCH_SLOTS] __attribute__ ((aligned (EVBATCH_ALIGN)));
+	uint32_t len[EVBATCH_SLOTS] __attribute__ ((aligned (EVBATCH_ALIGN)));
+	/* offset of the record in buf */
+	uint32_t off[EVBATCH_SLOTS] __attribute__ ((aligned (EVBATCH_ALIGN)));
+};
+
+/*
+ * decode as many whole events from buf as fit in the batch.  Returns the
+ * number of bytes consumed, so a caller with a large buffer loops until it
+ * has consumed len bytes.
+ */
+size_t ev_batch_decode(struct ev_batch *b, const char *buf, size_t len);
+
+static inline const char *ev_batch_name(const struct ev_batch *b, unsigned int i)
+{
+	if (!b->len[i])
+		return NULL;
+	return b->buf + b->off[i] + sizeof(struct inotify_event);
+}
+
+static inline const struct inotify_event *ev_batch_event(const struct ev_batch *b, unsigned int i)
+{
+	return (const struct inotify_event *)(b->buf + b->off[i]);
+}
+
+/* how many events have any of the bits in mask set */
+unsigned int ev_batch_count(const struct ev_batch *b, uint32_t mask);
+/*
+ * fill idx with the index of every event with any of mask set, returns how
+ * many.  The compaction stores a lane whether it matches or not, so idx must
+ * have room for b->padded entries (EVBATCH_SLOTS always does), not just the
+ * matches or b->count.
+ */
+unsigned int ev_batch_filter(const struct ev_batch *b, uint32_t mask, uint32_t *idx);
+/* index of the first event with any of mask set, or -1 */
+int ev_batch_find(const struct ev_batch *b, uint32_t mask);
+/* OR of every mask in the batch */
+uint32_t ev_batch_mask_union(const struct ev_batch *b);
+/* counts[bit] += number of events with that mask bit set */
+void ev_batch_classify(const struct ev_batch *b, unsigned long counts[32]);
+
+/* counts[bit] += 1 for every bit set in mask, for the event at a time loops */
+static inline void ev_classify_mask(uint32_t mask, unsigned long counts[32])
+{
+	for (; mask; mask &= mask - 1)
+		counts[__builtin_ctz(mask)]++;
+}
+
+/*
+ * classify every event in a read() buffer in the same pass that walks it.
+ * Decoding costs about as much as the walk, so a consumer which only looks
+ * at a buffer once is better off with this than a batch.  Returns the
+ * number of events, *overflow is the index of the first IN_Q_OVERFLOW or -1.
+ */
+unsigned long ev_walk_classify(const char *buf, size_t len, unsigned long counts[32],
+			       long *overflow);
+
+/* bytes queued on an inotify fd but not read yet (FIONREAD), -1 on error */
+int ev_queued_bytes(int fd);
+
+/*
+ * read() buffer sized to the queue.  A read is sized from the one before
+ * it (the queue tends to be about as deep from one wakeup to the next), and
+ * a read which came back full asks FIONREAD how much is really left so the
+ * rest comes in one more read rather than several.  A read with room to
+ * spare for the largest event emptied the queue, so callers which loop
+ * until the queue is empty can stop without a read that gets EAGAIN.
+ * Reads never go over max, which keeps the buffer and the events decoded
+ * from it in cache.
+ *
+ * With min == max it is a plain fixed size buffer: no FIONREAD and more is
+ * set after every successful read, which is what the fixed readers did.
+ */
+#define EV_RECORD_MAX		(sizeof(struct inotify_event) + NAME_MAX + 1)
+#define EV_READER_MIN		4096
+#define EV_READER_MAX		(64 * 1024)
+
+struct ev_reader {
+	char *buf;
+	size_t alloc;
+	size_t min, max;
+	/* what the next read asks for */
+	size_t want;
+	/* the queue may not be empty after the last read */
+	int more;
+	unsigned long reads;
+	/* FIONREAD ioctls, syscalls just like the reads */
+	unsigned long queries;
+};
+
+/* 0 for min and max picks the defaults, min is at least EV_RECORD_MAX */
+int ev_reader_init(struct ev_reader *r, size_t min, size_t max);
+void ev_reader_free(struct ev_reader *r);
+/* like read(), the events are in r->buf.  -1 with EAGAIN if FIONREAD says there's nothing */
+ssize_t ev_reader_read(struct ev_reader *r, int fd);
+
+/* the names of the mask bits, NULL for bits inotify doesn't use */
+const char *ev_mask_bit_name(unsigned int bit);
+
+#endif /* __EVBATCH_H */
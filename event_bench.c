@@ -0,0 +1,338 @@
+/*
+ * compare walking struct inotify_event records one at a time with decoding
+ * them in to an ev_batch and classifying with the vector kernels.  Both sides
+ * count the events matching a filter mask and count every mask bit, over the
+ * same synthetic read() buffer.  The kernels are also timed on their own, on
+ * batches decoded up front, since a consumer which makes several passes over
+ * a batch only pays for the decode once, and so is ev_batch_filter().  Every
+ * kernel's answer is checked against the walk before anything is timed.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include "bench.h"
+#include "evbatch.h"
+
+#define BUF_SIZE	65536
+#define FILTER_MASK	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+static struct bench_opts bench;
+static char buf[BUF_SIZE] __attribute__ ((aligned (8)));
+static size_t buf_len;
+static unsigned long buf_events;
+
+/* roughly what a busy directory produces */
+static const struct {
+	uint32_t mask;
+	unsigned int weight;
+} mix[] = {
+	{ IN_MODIFY,			40 },
+	{ IN_CLOSE_WRITE,		15 },
+	{ IN_OPEN,			15 },
+	{ IN_ACCESS,			10 },
+	{ IN_ATTRIB,			5 },
+	{ IN_CREATE,			5 },
+	{ IN_DELETE,			4 },
+	{ IN_MOVED_FROM,		2 },
+	{ IN_MOVED_TO,			2 },
+	{ IN_CREATE | IN_ISDIR,		1 },
+	{ IN_IGNORED,			1 },
+};
+
+static uint32_t pick_mask(uint64_t *rng)
+{
+	unsigned int i, total = 0, r;
+
+	for (i = 0; i < sizeof(mix) / sizeof(mix[0]); i++)
+		total += mix[i].weight;
+	r = bench_rand(rng) % total;
+	for (i = 0; r >= mix[i].weight; i++)
+		r -= mix[i].weight;
+	return mix[i].mask;
+}
+
+/* fill buf with events like the kernel would, names padded to 16 bytes */
+static void build_buffer(void)
+{
+	uint64_t rng = bench.seed;
+	struct inotify_event *event;
+	unsigned int name_len;
+
+	while (1) {
+		name_len = (bench_rand(&rng) % 3) * 16;
+		if (buf_len + sizeof(*event) + name_len > BUF_SIZE)
+			break;
+		event = (struct inotify_event *)(buf + buf_len);
+		event->wd = 1 + bench_rand(&rng) % 64;
+		event->mask = pick_mask(&rng);
+		event->cookie = 0;
+		event->len = name_len;
+		if (name_len)
+			snprintf(event->name, name_len, "file-%lu", buf_events);
+		buf_len += sizeof(*event) + name_len;
+		buf_events++;
+	}
+}
+
+static unsigned long walk_records(unsigned long counts[32])
+{
+	struct inotify_event *event;
+	unsigned long matches = 0;
+	uint32_t m;
+	char *p;
+
+	for (p = buf; p < buf + buf_len; p += sizeof(*event) + event->len) {
+		event = (struct inotify_event *)p;
+		if (event->mask & FILTER_MASK)
+			matches++;
+		for (m = event->mask; m; m &= m - 1)
+			counts[__builtin_ctz(m)]++;
+	}
+	return matches;
+}
+
+/* every buffer's worth of batches, decoded once for the kernel only run */
+static struct ev_batch *batches;
+static unsigned int num_batches;
+
+static unsigned long decode_batches(struct ev_batch *b, unsigned long counts[32])
+{
+	unsigned long matches = 0;
+	size_t pos = 0;
+
+	while (pos < buf_len) {
+		pos += ev_batch_decode(b, buf + pos, buf_len - pos);
+		matches += ev_batch_count(b, FILTER_MASK);
+		ev_batch_classify(b, counts);
+	}
+	return matches;
+}
+
+static unsigned long run_kernels(unsigned long counts[32])
+{
+	unsigned long matches = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_batches; i++) {
+		matches += ev_batch_count(&batches[i], FILTER_MASK);
+		ev_batch_classify(&batches[i], counts);
+	}
+	return matches;
+}
+
+/* filter out the matching indices of every pre-decoded batch */
+static unsigned long run_filter(void)
+{
+	static uint32_t idx[EVBATCH_SLOTS];
+	unsigned long matches = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_batches; i++)
+		matches += ev_batch_filter(&batches[i], FILTER_MASK, idx);
+	return matches;
+}
+
+/* filter, find and mask union against a plain walk of each batch's records */
+static int check_kernels(void)
+{
+	static uint32_t idx[EVBATCH_SLOTS];
+	const struct inotify_event *event;
+	unsigned int i, n, nr_idx, want_n;
+	uint32_t want_union;
+	int want_find;
+
+	for (i = 0; i < num_batches; i++) {
+		const struct ev_batch *b = &batches[i];
+
+		nr_idx = ev_batch_filter(b, FILTER_MASK, idx);
+		want_n = 0;
+		want_find = -1;
+		want_union = 0;
+		for (n = 0; n < b->count; n++) {
+			event = ev_batch_event(b, n);
+			want_union |= event->mask;
+			if (!(event->mask & FILTER_MASK))
+				continue;
+			if (want_find < 0)
+				want_find = n;
+			if (want_n >= nr_idx || idx[want_n] != n) {
+				fprintf(stderr, "batch %u: filter missed event %u\n", i, n);
+				return -1;
+			}
+			want_n++;
+		}
+		if (nr_idx != want_n) {
+			fprintf(stderr, "batch %u: filter found %u events, not %u\n", i, nr_idx, want_n);
+			return -1;
+		}
+		if (ev_batch_find(b, FILTER_MASK) != want_find) {
+			fprintf(stderr, "batch %u: find got %d, not %d\n", i,
+				ev_batch_find(b, FILTER_MASK), want_find);
+			return -1;
+		}
+		if (ev_batch_mask_union(b) != want_union) {
+			fprintf(stderr, "batch %u: mask union %x, not %x\n", i,
+				ev_batch_mask_union(b), want_union);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void predecode(void)
+{
+	size_t pos = 0;
+
+	batches = aligned_alloc(EVBATCH_ALIGN, (buf_events / EVBATCH_MAX + 1) * sizeof(*batches));
+	if (!batches)
+		exit(1);
+	while (pos < buf_len)
+		pos += ev_batch_decode(&batches[num_batches++], buf + pos, buf_len - pos);
+}
+
+enum side {
+	SIDE_WALK,
+	SIDE_SOA,
+	SIDE_KERNELS,
+	SIDE_FILTER,
+};
+
+static unsigned long run_side(enum side side, struct ev_batch *b, unsigned long counts[32])
+{
+	switch (side) {
+	case SIDE_WALK:
+		return walk_records(counts);
+	case SIDE_SOA:
+		return decode_batches(b, counts);
+	case SIDE_KERNELS:
+		return run_kernels(counts);
+	case SIDE_FILTER:
+		return run_filter();
+	}
+	return 0;
+}
+
+struct result {
+	unsigned long passes;
+	unsigned long matches;
+	unsigned long counts[32];
+	double secs;
+};
+
+/* run one side for --duration (or --ops buffers), after --warmup */
+static void run(const char *name, enum side side, struct ev_batch *b, struct result *r)
+{
+	uint64_t start, now;
+	double warmup_ns = bench.warmup * 1e9;
+
+	memset(r, 0, sizeof(*r));
+	start = now_ns();
+	while (now_ns() - start < warmup_ns) {
+		unsigned long scratch[32] = { 0 };
+
+		run_side(side, b, scratch);
+	}
+
+	start = now_ns();
+	do {
+		r->matches += run_side(side, b, r->counts);
+		r->passes++;
+		now = now_ns();
+	} while (bench.ops ? r->passes * buf_events < bench.ops :
+			     now - start < bench.duration * 1e9);
+	r->secs = (now - start) / 1e9;
+
+	printf("%-8s %lu events in %.3fs: %.1f Mevents/s (%lu matched)\n", name,
+	       r->passes * buf_events, r->secs,
+	       r->passes * buf_events / r->secs / 1e6, r->matches);
+}
+
+static void json_result(struct json *j, const char *key, const struct result *r)
+{
+	json_object_begin(j, key);
+	json_uint(j, "events", r->passes * buf_events);
+	json_double(j, "elapsed", r->secs);
+	json_double(j, "events_per_sec", r->passes * buf_events / r->secs);
+	json_uint(j, "matched", r->matches);
+	json_object_end(j);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct result walk, soa, kernels, filter;
+	struct ev_batch *b;
+	struct json j;
+	unsigned int i;
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+			fprintf(stderr, "usage: %s [--duration SECS] [--ops EVENTS] [--warmup SECS] "
+				"[--seed N] [--json PATH]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_ALL))
+		return 1;
+	if (!bench.duration && !bench.ops)
+		bench.duration = 2;
+
+	b = aligned_alloc(EVBATCH_ALIGN, sizeof(*b));
+	if (!b)
+		return 1;
+
+	build_buffer();
+	printf("%lu events in a %zu byte buffer\n", buf_events, buf_len);
+
+	predecode();
+	if (check_kernels())
+		return 1;
+
+	run("walk", SIDE_WALK, NULL, &walk);
+	run("soa", SIDE_SOA, b, &soa);
+	run("kernels", SIDE_KERNELS, NULL, &kernels);
+	run("filter", SIDE_FILTER, NULL, &filter);
+	if (filter.matches / filter.passes != walk.matches / walk.passes) {
+		fprintf(stderr, "filter matched %lu events a pass, the walk %lu!\n",
+			filter.matches / filter.passes, walk.matches / walk.passes);
+		return 1;
+	}
+
+	for (i = 0; i < 32; i++) {
+		if (walk.counts[i] / walk.passes != soa.counts[i] / soa.passes ||
+		    walk.counts[i] / walk.passes != kernels.counts[i] / kernels.passes) {
+			fprintf(stderr, "mask bit %u counts differ!\n", i);
+			return 1;
+		}
+	}
+	printf("speedup %.2fx\n", (soa.passes / soa.secs) / (walk.passes / walk.secs));
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "event_bench", &bench);
+	json_uint(&j, "buffer_bytes", buf_len);
+	json_uint(&j, "buffer_events", buf_events);
+	json_result(&j, "walk", &walk);
+	json_result(&j, "soa", &soa);
+	json_result(&j, "kernels_only", &kernels);
+	json_result(&j, "filter_only", &filter);
+	json_double(&j, "speedup", (soa.passes / soa.secs) / (walk.passes / walk.secs));
+	json_object_begin(&j, "events_by_type");
+	for (i = 0; i < 32; i++)
+		if (soa.counts[i] && ev_mask_bit_name(i))
+			json_uint(&j, ev_mask_bit_name(i), soa.counts[i] / soa.passes);
+	json_object_end(&j);
+	json_close(&j);
+
+	free(batches);
+	free(b);
+	return 0;
+}
@@ -1,5 +1,37 @@
 #!/bin/bash
-for i in {1..500}; do
-	echo "hello" > testfile1
-	echo "hello" > testfile2
+# rewrite two files over and over to generate a stream of inotify events.
+# this is now a wrapper around loadgen, which also times each write to its
+# event; use loadgen directly for rates, threads and other op mixes.
+# usage: events.sh [-n ops] [-d seconds] [-w warmup_ops] [-s seed] [-j json]
+ops=
+duration=
+warmup=0
+seed=
+json=-
+while getopts "n:d:w:s:j:" opt; do
+	case $opt in
+	n) ops=$OPTARG ;;
+	d) duration=$OPTARG ;;
+	w) warmup=$OPTARG ;;
+	s) seed=$OPTARG ;;
+	j) json=$OPTARG ;;
+	*) echo "usage: $0 [-n ops] [-d seconds] [-w warmup_ops] [-s seed] [-j json]" >&2; exit 1 ;;
+	esac
 done
+# the original 500 rounds
+if [ -z "$ops" ] && [ -z "$duration" ]; then
+	ops=500
+fi
+
+loadgen=$(dirname "$0")/loadgen
+# two files, written back to back, in the current directory
+args=(--dir . --threads 1 --files 2 --mix write)
+[ -n "$seed" ] && args+=(--seed "$seed")
+
+if [ "$warmup" -gt 0 ]; then
+	"$loadgen" "${args[@]}" --ops $((warmup * 2)) --json /dev/null > /dev/null
+fi
+
+[ -n "$ops" ] && args+=(--ops $((ops * 2)))
+[ -n "$duration" ] && args+=(--duration "$duration")
+"$loadgen" "${args[@]}" --json "$json" >&2
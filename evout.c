@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "evout.h"
+#include "spsc.h"
+
+#define EVOUT_BUF_SIZE	(256 * 1024)
+
+struct evout_slot {
+	uint64_t ts_ns;
+	int32_t wd;
+	uint32_t mask;
+	uint32_t cookie;
+	uint32_t len;
+	char name[NAME_MAX + 1];
+};
+
+struct evout {
+	struct spsc_ring ring;
+	struct evout_slot *slots;
+	enum evout_format format;
+	int fd;
+	int stopping;
+	pthread_t writer;
+	/* producer side */
+	unsigned long queued;
+	unsigned long dropped;
+	unsigned long max_depth;
+	/* writer side */
+	char *buf;
+	size_t buf_len;
+	struct evout_stats stats;
+};
+
+static void evout_flush(struct evout *out)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < out->buf_len) {
+		ret = write(out->fd, out->buf + done, out->buf_len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("writing events");
+			break;
+		}
+		done += ret;
+	}
+	if (out->buf_len)
+		out->stats.writes++;
+	out->stats.bytes += out->buf_len;
+	out->buf_len = 0;
+}
+
+/* the longest a single formatted event can be, a csv name of nothing but quotes doubles */
+#define EVOUT_MAX_RECORD (sizeof(struct evout_bin_record) + 2 * NAME_MAX + 64)
+
+/* a csv field as RFC 4180 has it: quoted, with quotes doubled, if it needs to be */
+static size_t csv_field(char *p, const char *s)
+{
+	char *start = p;
+
+	if (!s[strcspn(s, ",\"\r\n")])
+		return stpcpy(p, s) - p;
+	*p++ = '"';
+	for (; *s; s++) {
+		if (*s == '"')
+			*p++ = '"';
+		*p++ = *s;
+	}
+	*p++ = '"';
+	return p - start;
+}
+
+static void evout_format_slot(struct evout *out, struct evout_slot *slot)
+{
+	struct evout_bin_record rec;
+	char *p;
+
+	if (out->buf_len + EVOUT_MAX_RECORD > EVOUT_BUF_SIZE)
+		evout_flush(out);
+
+	p = out->buf + out->buf_len;
+	if (out->format == EVOUT_CSV) {
+		p += sprintf(p, "%llu,%d,%x,%u,", (unsigned long long)slot->ts_ns, slot->wd,
+			     slot->mask, slot->cookie);
+		p += csv_field(p, slot->name);
+		*p++ = '\n';
+		out->buf_len = p - out->buf;
+	} else {
+		rec.ts_ns = slot->ts_ns;
+		rec.wd = slot->wd;
+		rec.mask = slot->mask;
+		rec.cookie = slot->cookie;
+		rec.len = slot->len;
+		memcpy(p, &rec, sizeof(rec));
+		memcpy(p + sizeof(rec), slot->name, slot->len);
+		out->buf_len += sizeof(rec) + slot->len;
+	}
+}
+
+static void *evout_writer(void *ptr)
+{
+	struct evout *out = ptr;
+	uint64_t pos, n, i, now;
+
+	while (1) {
+		n = spsc_peek(&out->ring, &pos);
+		if (!n) {
+			/* nothing queued, get what we have out the door */
+			evout_flush(out);
+			if (__atomic_load_n(&out->stopping, __ATOMIC_ACQUIRE) &&
+			    !spsc_peek(&out->ring, &pos))
+				break;
+			usleep(100);
+			continue;
+		}
+		now = now_ns();
+		for (i = 0; i < n; i++) {
+			struct evout_slot *slot = &out->slots[(pos + i) & out->ring.mask];
+
+			hist_record(&out->stats.lag, now - slot->ts_ns);
+			evout_format_slot(out, slot);
+		}
+		spsc_release(&out->ring, n);
+		out->stats.written += n;
+	}
+	return NULL;
+}
+
+struct evout *evout_start(int fd, enum evout_format format, unsigned int slots)
+{
+	struct evout *out;
+
+	if (posix_memalign((void **)&out, SPSC_CACHELINE, sizeof(*out)))
+		return NULL;
+	memset(out, 0, sizeof(*out));
+	out->fd = fd;
+	out->format = format;
+	if (spsc_init(&out->ring, slots))
+		goto err;
+	out->slots = calloc(slots, sizeof(*out->slots));
+	out->buf = malloc(EVOUT_BUF_SIZE);
+	if (!out->slots || !out->buf)
+		goto err;
+	if (pthread_create(&out->writer, NULL, evout_writer, out))
+		goto err;
+	return out;
+err:
+	free(out->slots);
+	free(out->buf);
+	free(out);
+	return NULL;
+}
+
+int evout_push(struct evout *out, uint64_t ts_ns, int32_t wd, uint32_t mask,
+	       uint32_t cookie, const char *name)
+{
+	struct evout_slot *slot;
+	uint64_t depth;
+	int64_t pos;
+
+	pos = spsc_reserve(&out->ring);
+	if (pos < 0) {
+		out->dropped++;
+		return -1;
+	}
+	slot = &out->slots[pos & out->ring.mask];
+	slot->ts_ns = ts_ns;
+	slot->wd = wd;
+	slot->mask = mask;
+	slot->cookie = cookie;
+	if (name) {
+		slot->len = strnlen(name, NAME_MAX);
+		memcpy(slot->name, name, slot->len);
+	} else {
+		slot->len = 0;
+	}
+	slot->name[slot->len] = '\0';
+	spsc_commit(&out->ring);
+
+	out->queued++;
+	depth = spsc_depth(&out->ring);
+	if (depth > out->max_depth)
+		out->max_depth = depth;
+	return 0;
+}
+
+unsigned long evout_dropped(struct evout *out)
+{
+	return out->dropped;
+}
+
+unsigned long evout_depth(struct evout *out)
+{
+	return spsc_depth(&out->ring);
+}
+
+void evout_stop(struct evout *out, struct evout_stats *stats)
+{
+	__atomic_store_n(&out->stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(out->writer, NULL);
+
+	*stats = out->stats;
+	stats->queued = out->queued;
+	stats->dropped = out->dropped;
+	stats->max_depth = out->max_depth;
+
+	free(out->slots);
+	free(out->buf);
+	free(out);
+}
@@ -0,0 +1,53 @@
+#ifndef __EVOUT_H
+#define __EVOUT_H
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+/*
+ * hand decoded events to a writer thread through a ring and let it write
+ * them out in large batches, so the reader never waits on the output.  If
+ * the writer falls behind and the ring fills, events are dropped (and
+ * counted) rather than stalling the reader in to a queue overflow.
+ */
+enum evout_format {
+	/* ts_ns,wd,mask,cookie,name one per line, the name quoted as RFC 4180 says */
+	EVOUT_CSV,
+	/* struct evout_bin_record followed by len bytes of name */
+	EVOUT_BINARY,
+};
+
+struct evout_bin_record {
+	uint64_t ts_ns;
+	int32_t wd;
+	uint32_t mask;
+	uint32_t cookie;
+	uint32_t len;
+};
+
+struct evout_stats {
+	unsigned long queued;
+	unsigned long dropped;
+	unsigned long written;
+	unsigned long writes;
+	unsigned long bytes;
+	unsigned long max_depth;
+	/* read() to write() delay, in ns */
+	struct hist lag;
+};
+
+struct evout;
+
+struct evout *evout_start(int fd, enum evout_format format, unsigned int slots);
+/* called by the one reader thread; ts_ns is when the event was read */
+int evout_push(struct evout *out, uint64_t ts_ns, int32_t wd, uint32_t mask,
+	       uint32_t cookie, const char *name);
+/* reader side view of how far behind the writer is */
+unsigned long evout_dropped(struct evout *out);
+unsigned long evout_depth(struct evout *out);
+/* write everything still queued, stop the writer and collect its stats */
+void evout_stop(struct evout *out, struct evout_stats *stats);
+
+#endif /* __EVOUT_H */
@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "hist.h"
+
+void hist_reset(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->total += src->total;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/* remove the samples of an earlier snapshot, max can't be undone so it stays */
+void hist_subtract(struct hist *dst, const struct hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] -= src->buckets[i];
+	dst->count -= src->count;
+	dst->total -= src->total;
+}
+
+/* the highest value a bucket can hold */
+static uint64_t hist_bucket_top(unsigned int idx)
+{
+	unsigned int shift, sub;
+
+	if (idx < HIST_SUB_BUCKETS)
+		return idx;
+	shift = (idx >> HIST_SUB_BITS) - 1;
+	sub = idx & (HIST_SUB_BUCKETS - 1);
+	return ((uint64_t)(HIST_SUB_BUCKETS + sub) << shift) + (1ull << shift) - 1;
+}
+
+uint64_t hist_percentile(const struct hist *h, double pct)
+{
+	uint64_t want, seen = 0, top;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	want = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want) {
+			top = hist_bucket_top(i);
+			return top < h->max ? top : h->max;
+		}
+	}
+	return h->max;
+}
+
+/* values are recorded in nanoseconds, print them in usecs */
+void hist_print(FILE *out, const char *label, const struct hist *h)
+{
+	fprintf(out, "%s: n=%llu mean=%.2fus p50=%.2fus p90=%.2fus p99=%.2fus p99.9=%.2fus max=%.2fus\n",
+		label, (unsigned long long)h->count,
+		h->count ? (double)h->total / h->count / 1000 : 0.0,
+		hist_percentile(h, 50) / 1000.0,
+		hist_percentile(h, 90) / 1000.0,
+		hist_percentile(h, 99) / 1000.0,
+		hist_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+}
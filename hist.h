@@ -0,0 +1,71 @@
+#ifndef __HIST_H
+#define __HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * log-linear (HDR style) latency histogram.  Every power of two is split in
+ * to HIST_SUB_BUCKETS linear buckets so the relative error is bounded by
+ * 1/HIST_SUB_BUCKETS no matter the magnitude.  Everything is a fixed size
+ * array so recording never allocates and never locks; each thread records
+ * in to its own histogram and they are merged once the threads are done.
+ */
+#define HIST_SUB_BITS		5
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS		((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct hist {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline unsigned int hist_index(uint64_t val)
+{
+	unsigned int shift;
+
+	if (val < HIST_SUB_BUCKETS)
+		return val;
+	shift = 63 - __builtin_clzll(val) - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + ((val >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+static inline void hist_record(struct hist *h, uint64_t val)
+{
+	h->buckets[hist_index(val)]++;
+	h->count++;
+	h->total += val;
+	if (val > h->max)
+		h->max = val;
+}
+
+/* n samples of the same value, e.g. every event of one read */
+static inline void hist_record_n(struct hist *h, uint64_t val, uint64_t n)
+{
+	if (!n)
+		return;
+	h->buckets[hist_index(val)] += n;
+	h->count += n;
+	h->total += val * n;
+	if (val > h->max)
+		h->max = val;
+}
+
+void hist_reset(struct hist *h);
+void hist_merge(struct hist *dst, const struct hist *src);
+void hist_subtract(struct hist *dst, const struct hist *src);
+uint64_t hist_percentile(const struct hist *h, double pct);
+void hist_print(FILE *out, const char *label, const struct hist *h);
+
+#endif /* __HIST_H */
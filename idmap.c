@@ -0,0 +1,191 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "idmap.h"
+
+#define IDMAP_MIN_BUCKETS	16
+
+static int buckets_alloc(struct idmap *m, unsigned int nr)
+{
+	m->buckets = calloc(nr, sizeof(*m->buckets));
+	if (!m->buckets)
+		return -1;
+	m->mask = nr - 1;
+	m->shift = 32 - __builtin_ctz(nr);
+	return 0;
+}
+
+int idmap_init(struct idmap *m)
+{
+	memset(m, 0, sizeof(*m));
+	return buckets_alloc(m, IDMAP_MIN_BUCKETS);
+}
+
+void idmap_destroy(struct idmap *m)
+{
+	unsigned int b;
+
+	for (b = 0; b <= m->mask; b++)
+		free(m->buckets[b].page);
+	free(m->buckets);
+	memset(m, 0, sizeof(*m));
+}
+
+/* bucket holding page_no, or -1 */
+static int page_lookup(const struct idmap *m, uint32_t page_no)
+{
+	unsigned int b;
+
+	for (b = idmap_hash(m, page_no); m->buckets[b].page; b = (b + 1) & m->mask)
+		if (m->buckets[b].page_no == page_no)
+			return b;
+	return -1;
+}
+
+static void bucket_place(struct idmap *m, uint32_t page_no, struct idmap_page *page)
+{
+	unsigned int b;
+
+	for (b = idmap_hash(m, page_no); m->buckets[b].page; b = (b + 1) & m->mask)
+		;
+	m->buckets[b].page_no = page_no;
+	m->buckets[b].page = page;
+}
+
+/* keep the table at most half full so probes stay short */
+static int buckets_grow(struct idmap *m)
+{
+	struct idmap_bucket *old = m->buckets;
+	unsigned int b, old_mask = m->mask;
+
+	if (buckets_alloc(m, (old_mask + 1) * 2)) {
+		m->buckets = old;
+		return -1;
+	}
+	for (b = 0; b <= old_mask; b++)
+		if (old[b].page)
+			bucket_place(m, old[b].page_no, old[b].page);
+	free(old);
+	return 0;
+}
+
+static struct idmap_page *page_create(struct idmap *m, uint32_t page_no)
+{
+	struct idmap_page *page;
+
+	if ((m->pages + 1) * 2 > m->mask + 1 && buckets_grow(m))
+		return NULL;
+	page = calloc(1, sizeof(*page));
+	if (!page)
+		return NULL;
+	bucket_place(m, page_no, page);
+	m->pages++;
+	return page;
+}
+
+/* free the page in bucket b and close the gap so later probes don't stop short */
+static void page_delete(struct idmap *m, unsigned int b)
+{
+	unsigned int i = b, j = b, home;
+
+	free(m->buckets[b].page);
+	m->buckets[b].page = NULL;
+	m->pages--;
+
+	for (;;) {
+		j = (j + 1) & m->mask;
+		if (!m->buckets[j].page)
+			break;
+		home = idmap_hash(m, m->buckets[j].page_no);
+		/* j can stay put if its home is cyclically in (i, j] */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		m->buckets[i] = m->buckets[j];
+		m->buckets[j].page = NULL;
+		i = j;
+	}
+}
+
+static void slot_set(struct idmap *m, struct idmap_page *page, int id, void *ptr)
+{
+	page->slots[id & IDMAP_PAGE_MASK] = ptr;
+	page->used |= 1ull << (id & IDMAP_PAGE_MASK);
+	m->count++;
+}
+
+int idmap_insert(struct idmap *m, int id, void *ptr)
+{
+	uint32_t page_no = (uint32_t)id >> IDMAP_PAGE_SHIFT;
+	struct idmap_page *page;
+	int b;
+
+	if (id < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	b = page_lookup(m, page_no);
+	if (b >= 0) {
+		page = m->buckets[b].page;
+		if (page->used & (1ull << (id & IDMAP_PAGE_MASK))) {
+			errno = EEXIST;
+			return -1;
+		}
+	} else if (!(page = page_create(m, page_no))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	slot_set(m, page, id, ptr);
+	return 0;
+}
+
+int idmap_alloc_above(struct idmap *m, void *ptr, int start)
+{
+	uint64_t id = start < 0 ? 0 : start;
+
+	/* a missing page means every id in it is free, full pages are skipped whole */
+	while (id <= INT_MAX) {
+		uint32_t page_no = id >> IDMAP_PAGE_SHIFT;
+		uint64_t free_bits;
+		int b = page_lookup(m, page_no);
+
+		if (b < 0)
+			return idmap_insert(m, id, ptr) ? -1 : (int)id;
+		free_bits = ~m->buckets[b].page->used & (~0ull << (id & IDMAP_PAGE_MASK));
+		if (free_bits) {
+			id = ((uint64_t)page_no << IDMAP_PAGE_SHIFT) + __builtin_ctzll(free_bits);
+			slot_set(m, m->buckets[b].page, id, ptr);
+			return id;
+		}
+		id = (uint64_t)(page_no + 1) << IDMAP_PAGE_SHIFT;
+	}
+	errno = ENOSPC;
+	return -1;
+}
+
+void *idmap_remove(struct idmap *m, int id)
+{
+	uint64_t bit = 1ull << (id & IDMAP_PAGE_MASK);
+	struct idmap_page *page;
+	void *ptr;
+	int b;
+
+	if (id < 0 || (b = page_lookup(m, (uint32_t)id >> IDMAP_PAGE_SHIFT)) < 0)
+		return NULL;
+	page = m->buckets[b].page;
+	if (!(page->used & bit))
+		return NULL;
+	ptr = page->slots[id & IDMAP_PAGE_MASK];
+	page->slots[id & IDMAP_PAGE_MASK] = NULL;
+	page->used &= ~bit;
+	m->count--;
+	if (!page->used)
+		page_delete(m, b);
+	return ptr;
+}
+
+size_t idmap_bytes(const struct idmap *m)
+{
+	return (m->mask + 1) * sizeof(*m->buckets) + m->pages * sizeof(struct idmap_page);
+}
@@ -0,0 +1,77 @@
+#ifndef __IDMAP_H
+#define __IDMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * sparse map from a non-negative int id (a wd) to a pointer, with the same
+ * semantics as the kernel's idr: allocate the lowest free id at or above a
+ * given one, find and remove.
+ *
+ * Ids are grouped in to pages of 64 slots with a bitmap of the used ones,
+ * and the pages live in an open addressed hash table keyed by page number.
+ * A lookup is one probe (almost always one cache line) in to the table and
+ * one load from the page whether the ids are dense or scattered over the
+ * whole int range, unlike a radix tree whose depth follows the biggest id.
+ * Dense ids cost 8 bytes each plus a little for the table; an id with no
+ * neighbours costs a whole page.  Pages are freed once empty.
+ *
+ * Not thread safe, callers sharing a map need their own lock.
+ */
+#define IDMAP_PAGE_SHIFT	6
+#define IDMAP_PAGE_SIZE		(1 << IDMAP_PAGE_SHIFT)
+#define IDMAP_PAGE_MASK		(IDMAP_PAGE_SIZE - 1)
+
+struct idmap_page {
+	/* bit n set if slots[n] is in use */
+	uint64_t used;
+	void *slots[IDMAP_PAGE_SIZE];
+};
+
+struct idmap_bucket {
+	uint32_t page_no;
+	/* NULL for an empty bucket */
+	struct idmap_page *page;
+};
+
+struct idmap {
+	struct idmap_bucket *buckets;
+	unsigned int mask;
+	/* 32 - log2(number of buckets), for the multiplicative hash */
+	unsigned int shift;
+	unsigned int pages;
+	unsigned int count;
+};
+
+int idmap_init(struct idmap *m);
+void idmap_destroy(struct idmap *m);
+
+/* lowest free id >= start for ptr, or -1 with errno ENOMEM or ENOSPC */
+int idmap_alloc_above(struct idmap *m, void *ptr, int start);
+/* ptr at exactly id (the kernel picked it), -1 with errno EEXIST or ENOMEM */
+int idmap_insert(struct idmap *m, int id, void *ptr);
+/* returns what was stored at id, NULL if nothing was */
+void *idmap_remove(struct idmap *m, int id);
+/* heap bytes held by the map */
+size_t idmap_bytes(const struct idmap *m);
+
+static inline unsigned int idmap_hash(const struct idmap *m, uint32_t page_no)
+{
+	return (page_no * 0x9e3779b1u) >> m->shift;
+}
+
+static inline void *idmap_find(const struct idmap *m, int id)
+{
+	uint32_t page_no = (uint32_t)id >> IDMAP_PAGE_SHIFT;
+	unsigned int b;
+
+	if (id < 0)
+		return NULL;
+	for (b = idmap_hash(m, page_no); m->buckets[b].page; b = (b + 1) & m->mask)
+		if (m->buckets[b].page_no == page_no)
+			return m->buckets[b].page->slots[id & IDMAP_PAGE_MASK];
+	return NULL;
+}
+
+#endif /* __IDMAP_H */
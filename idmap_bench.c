@@ -0,0 +1,525 @@
+/*
+ * the idmap against the two usual ways of keeping wd -> pointer: a radix
+ * tree (64 way, as the kernel's idr/xarray, growing in height with the
+ * biggest id) and an open addressed hash map.  Each is filled with the same
+ * ids, looked up at random and emptied again, for three shapes of id:
+ *
+ *	dense	1..N, a fresh inotify instance
+ *	window	ids from a long running instance: the kernel hands wds out
+ *		cyclically so the live ones are a band well above 1 with a
+ *		quarter of them already removed
+ *	sparse	N ids spread over the whole int range
+ *
+ * Reports ns per insert, lookup and remove, and heap bytes per id.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "idmap.h"
+#include "memacct.h"
+
+#define LOOKUPS		65536
+
+static struct bench_opts bench;
+static unsigned long num_ids = 100000;
+static int *ids;
+static int lookups[LOOKUPS];
+
+/* 64 way radix tree, height grows with the biggest id like the kernel's */
+#define RADIX_SHIFT	6
+#define RADIX_SIZE	(1 << RADIX_SHIFT)
+#define RADIX_MASK	(RADIX_SIZE - 1)
+
+struct radix_node {
+	void *slots[RADIX_SIZE];
+	unsigned int count;
+};
+
+struct radix {
+	struct radix_node *root;
+	unsigned int height;
+};
+
+static struct radix radix;
+
+/* ids below this fit in a tree of height h */
+static uint64_t radix_span(unsigned int h)
+{
+	return 1ull << (RADIX_SHIFT * h);
+}
+
+static int radix_insert(struct radix *r, int id, void *ptr)
+{
+	struct radix_node *node, **slot;
+	unsigned int h;
+
+	while (!r->root || (uint64_t)id >= radix_span(r->height)) {
+		node = calloc(1, sizeof(*node));
+		if (!node)
+			return -1;
+		if (r->root) {
+			node->slots[0] = r->root;
+			node->count = 1;
+		}
+		r->root = node;
+		r->height++;
+	}
+	node = r->root;
+	for (h = r->height - 1; h > 0; h--) {
+		slot = (struct radix_node **)&node->slots[(id >> (RADIX_SHIFT * h)) & RADIX_MASK];
+		if (!*slot) {
+			*slot = calloc(1, sizeof(**slot));
+			if (!*slot)
+				return -1;
+			node->count++;
+		}
+		node = *slot;
+	}
+	if (!node->slots[id & RADIX_MASK])
+		node->count++;
+	node->slots[id & RADIX_MASK] = ptr;
+	return 0;
+}
+
+static inline void *radix_find(const struct radix *r, int id)
+{
+	const struct radix_node *node = r->root;
+	unsigned int h;
+
+	if (!node || (uint64_t)id >= radix_span(r->height))
+		return NULL;
+	for (h = r->height - 1; h > 0; h--) {
+		node = node->slots[(id >> (RADIX_SHIFT * h)) & RADIX_MASK];
+		if (!node)
+			return NULL;
+	}
+	return node->slots[id & RADIX_MASK];
+}
+
+/* frees nodes on the way back up once they're empty, never shrinks the height */
+static void radix_remove(struct radix *r, int id)
+{
+	struct radix_node *path[8];
+	unsigned int h, depth = 0;
+	struct radix_node *node = r->root;
+
+	if (!node || (uint64_t)id >= radix_span(r->height))
+		return;
+	for (h = r->height - 1; h > 0; h--) {
+		path[depth++] = node;
+		node = node->slots[(id >> (RADIX_SHIFT * h)) & RADIX_MASK];
+		if (!node)
+			return;
+	}
+	if (!node->slots[id & RADIX_MASK])
+		return;
+	node->slots[id & RADIX_MASK] = NULL;
+	for (h = 1; !--node->count && depth; h++) {
+		struct radix_node *parent = path[--depth];
+
+		free(node);
+		parent->slots[(id >> (RADIX_SHIFT * h)) & RADIX_MASK] = NULL;
+		node = parent;
+	}
+}
+
+static void radix_free(struct radix_node *node, unsigned int h)
+{
+	unsigned int i;
+
+	if (!node)
+		return;
+	for (i = 0; h > 1 && i < RADIX_SIZE; i++)
+		radix_free(node->slots[i], h - 1);
+	free(node);
+}
+
+/* open addressed hash map, linear probing, at most half full */
+struct map_entry {
+	int id;
+	void *ptr;
+};
+
+struct map {
+	struct map_entry *entries;
+	unsigned int mask;
+	unsigned int shift;
+	unsigned int count;
+};
+
+static struct map map;
+
+static inline unsigned int map_hash(const struct map *m, int id)
+{
+	return ((uint32_t)id * 0x9e3779b1u) >> m->shift;
+}
+
+static int map_alloc(struct map *m, unsigned int nr)
+{
+	unsigned int i;
+
+	m->entries = malloc(nr * sizeof(*m->entries));
+	if (!m->entries)
+		return -1;
+	for (i = 0; i < nr; i++)
+		m->entries[i].id = -1;
+	m->mask = nr - 1;
+	m->shift = 32 - __builtin_ctz(nr);
+	return 0;
+}
+
+static void map_place(struct map *m, int id, void *ptr)
+{
+	unsigned int b;
+
+	for (b = map_hash(m, id); m->entries[b].id >= 0 && m->entries[b].id != id; b = (b + 1) & m->mask)
+		;
+	if (m->entries[b].id < 0)
+		m->count++;
+	m->entries[b].id = id;
+	m->entries[b].ptr = ptr;
+}
+
+static int map_insert(struct map *m, int id, void *ptr)
+{
+	if ((m->count + 1) * 2 > m->mask + 1) {
+		struct map_entry *old = m->entries;
+		unsigned int b, old_size = m->mask + 1;
+
+		if (map_alloc(m, old_size * 2))
+			return -1;
+		m->count = 0;
+		for (b = 0; b < old_size; b++)
+			if (old[b].id >= 0)
+				map_place(m, old[b].id, old[b].ptr);
+		free(old);
+	}
+	map_place(m, id, ptr);
+	return 0;
+}
+
+static inline void *map_find(const struct map *m, int id)
+{
+	unsigned int b;
+
+	for (b = map_hash(m, id); m->entries[b].id >= 0; b = (b + 1) & m->mask)
+		if (m->entries[b].id == id)
+			return m->entries[b].ptr;
+	return NULL;
+}
+
+/* backward shift deletion, no tombstones */
+static void map_remove(struct map *m, int id)
+{
+	unsigned int i, j, home;
+
+	for (i = map_hash(m, id); m->entries[i].id != id; i = (i + 1) & m->mask)
+		if (m->entries[i].id < 0)
+			return;
+	m->entries[i].id = -1;
+	m->count--;
+	for (j = i;;) {
+		j = (j + 1) & m->mask;
+		if (m->entries[j].id < 0)
+			break;
+		home = map_hash(m, m->entries[j].id);
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		m->entries[i] = m->entries[j];
+		m->entries[j].id = -1;
+		i = j;
+	}
+}
+
+static struct idmap idmap;
+
+enum side {
+	SIDE_IDMAP,
+	SIDE_RADIX,
+	SIDE_MAP,
+	NR_SIDES,
+};
+static const char *side_names[] = {
+	[SIDE_IDMAP]	= "idmap",
+	[SIDE_RADIX]	= "radix",
+	[SIDE_MAP]	= "hashmap",
+};
+
+enum shape {
+	SHAPE_DENSE,
+	SHAPE_WINDOW,
+	SHAPE_SPARSE,
+	NR_SHAPES,
+};
+static const char *shape_names[] = {
+	[SHAPE_DENSE]	= "dense",
+	[SHAPE_WINDOW]	= "window",
+	[SHAPE_SPARSE]	= "sparse",
+};
+
+struct result {
+	double insert_ns;
+	double lookup_ns;
+	double remove_ns;
+	double bytes_per_id;
+};
+
+static void make_ids(enum shape shape, uint64_t *rng)
+{
+	unsigned long i, n = 0;
+	int base;
+
+	switch (shape) {
+	case SHAPE_DENSE:
+		for (i = 0; i < num_ids; i++)
+			ids[i] = i + 1;
+		break;
+	case SHAPE_WINDOW:
+		/* somewhere well in to the wd space, one in four already gone */
+		base = 1000000 + bench_rand(rng) % 1000000;
+		for (i = 0; n < num_ids; i++)
+			if (bench_rand(rng) % 4)
+				ids[n++] = base + i;
+		break;
+	case SHAPE_SPARSE:
+		/* duplicates are possible but rare, all three sides see the same ones */
+		for (i = 0; i < num_ids; i++)
+			ids[i] = bench_rand(rng) % INT_MAX;
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < LOOKUPS; i++)
+		lookups[i] = ids[bench_rand(rng) % num_ids];
+}
+
+static void side_init(enum side side)
+{
+	int ret = 0;
+
+	switch (side) {
+	case SIDE_IDMAP:
+		ret = idmap_init(&idmap);
+		break;
+	case SIDE_RADIX:
+		memset(&radix, 0, sizeof(radix));
+		break;
+	case SIDE_MAP:
+		memset(&map, 0, sizeof(map));
+		ret = map_alloc(&map, 16);
+		break;
+	default:
+		break;
+	}
+	if (ret) {
+		perror("allocating");
+		exit(1);
+	}
+}
+
+static void side_destroy(enum side side)
+{
+	switch (side) {
+	case SIDE_IDMAP:
+		idmap_destroy(&idmap);
+		break;
+	case SIDE_RADIX:
+		radix_free(radix.root, radix.height);
+		break;
+	case SIDE_MAP:
+		free(map.entries);
+		break;
+	default:
+		break;
+	}
+}
+
+static void insert_all(enum side side)
+{
+	unsigned long i;
+	int ret = 0;
+
+	for (i = 0; i < num_ids && !ret; i++) {
+		void *ptr = &ids[i];
+
+		switch (side) {
+		case SIDE_IDMAP:
+			/* a duplicate sparse id is fine, it's already there */
+			if (idmap_insert(&idmap, ids[i], ptr) && errno != EEXIST)
+				ret = -1;
+			break;
+		case SIDE_RADIX:
+			ret = radix_insert(&radix, ids[i], ptr);
+			break;
+		case SIDE_MAP:
+			ret = map_insert(&map, ids[i], ptr);
+			break;
+		default:
+			break;
+		}
+	}
+	if (ret) {
+		perror("inserting");
+		exit(1);
+	}
+}
+
+/* one pass over lookups, returns something depending on every one */
+static unsigned long lookup_pass(enum side side)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < LOOKUPS; i++) {
+		switch (side) {
+		case SIDE_IDMAP:
+			sum += (uintptr_t)idmap_find(&idmap, lookups[i]);
+			break;
+		case SIDE_RADIX:
+			sum += (uintptr_t)radix_find(&radix, lookups[i]);
+			break;
+		case SIDE_MAP:
+			sum += (uintptr_t)map_find(&map, lookups[i]);
+			break;
+		default:
+			break;
+		}
+	}
+	return sum;
+}
+
+static void remove_all(enum side side)
+{
+	unsigned long i;
+
+	for (i = 0; i < num_ids; i++) {
+		switch (side) {
+		case SIDE_IDMAP:
+			idmap_remove(&idmap, ids[i]);
+			break;
+		case SIDE_RADIX:
+			radix_remove(&radix, ids[i]);
+			break;
+		case SIDE_MAP:
+			map_remove(&map, ids[i]);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static unsigned long sink;
+
+static void run(enum shape shape, enum side side, struct result *r)
+{
+	unsigned long passes = 0;
+	uint64_t start, now;
+	size_t before;
+
+	side_init(side);
+	before = memacct_heap_bytes();
+	start = now_ns();
+	insert_all(side);
+	r->insert_ns = (double)(now_ns() - start) / num_ids;
+	r->bytes_per_id = (double)(memacct_heap_bytes() - before) / num_ids;
+
+	start = now_ns();
+	while (now_ns() - start < bench.warmup * 1e9)
+		sink += lookup_pass(side);
+	start = now_ns();
+	do {
+		sink += lookup_pass(side);
+		passes++;
+		now = now_ns();
+	} while (bench.ops ? passes * LOOKUPS < bench.ops : now - start < bench.duration * 1e9);
+	r->lookup_ns = (double)(now - start) / (passes * LOOKUPS);
+
+	start = now_ns();
+	remove_all(side);
+	r->remove_ns = (double)(now_ns() - start) / num_ids;
+	side_destroy(side);
+
+	printf("%-7s %-8s insert %6.1fns  lookup %6.1fns  remove %6.1fns  %8.1f bytes/id\n",
+	       shape_names[shape], side_names[side], r->insert_ns, r->lookup_ns, r->remove_ns,
+	       r->bytes_per_id);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"ids",		required_argument,	0, 'n'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct result results[NR_SHAPES][NR_SIDES];
+	unsigned int shape, side;
+	uint64_t rng;
+	struct json j;
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "n:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			num_ids = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+				fprintf(stderr, "usage: %s [--ids N] [--duration SECS] [--ops LOOKUPS] "
+					"[--warmup SECS] [--seed N] [--json PATH]\n", argv[0]);
+				return 1;
+			}
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_ALL))
+		return 1;
+	/* --duration is per lookup run, there are nine of them */
+	if (!bench.duration && !bench.ops)
+		bench.duration = 0.5;
+	if (!num_ids || num_ids > INT_MAX / 2) {
+		fprintf(stderr, "--ids must be between 1 and %d\n", INT_MAX / 2);
+		return 1;
+	}
+
+	ids = calloc(num_ids, sizeof(*ids));
+	if (!ids) {
+		perror("allocating ids");
+		return 1;
+	}
+
+	rng = bench.seed;
+	for (shape = 0; shape < NR_SHAPES; shape++) {
+		make_ids(shape, &rng);
+		for (side = 0; side < NR_SIDES; side++)
+			run(shape, side, &results[shape][side]);
+	}
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "idmap_bench", &bench);
+	json_uint(&j, "ids", num_ids);
+	for (shape = 0; shape < NR_SHAPES; shape++) {
+		json_object_begin(&j, shape_names[shape]);
+		for (side = 0; side < NR_SIDES; side++) {
+			const struct result *r = &results[shape][side];
+
+			json_object_begin(&j, side_names[side]);
+			json_double(&j, "insert_ns", r->insert_ns);
+			json_double(&j, "lookup_ns", r->lookup_ns);
+			json_double(&j, "remove_ns", r->remove_ns);
+			json_double(&j, "bytes_per_id", r->bytes_per_id);
+			json_object_end(&j);
+		}
+		json_object_end(&j);
+	}
+	json_close(&j);
+
+	free(ids);
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * idr_test/idr_test.c's 4095/4096 checks against the userspace idmap, plus
+ * the edges the idmap adds (page boundaries, the top of the int range,
+ * pages coming and going) and a random run checked against a flat array.
+ * Prints "hmmm" for anything wrong, exits non-zero if there was any.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "idmap.h"
+
+static unsigned int checks, failures;
+
+#define CHECK(cond, fmt, ...) do { \
+		checks++; \
+		if (!(cond)) { \
+			failures++; \
+			printf("hmmm, " fmt "\n", ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+#define ID_PTR(id)	((void *)(uintptr_t)(id))
+
+/* the original module: two ids above 4095, find them, find 0, remove them */
+static void test_idr_4096(void)
+{
+	struct idmap m;
+	int forty95, forty96;
+
+	idmap_init(&m);
+	forty95 = idmap_alloc_above(&m, ID_PTR(4095), 4095);
+	CHECK(forty95 == 4095, "forty95=%d (should be 4095)", forty95);
+	forty96 = idmap_alloc_above(&m, ID_PTR(4096), 4095);
+	CHECK(forty96 == 4096, "forty96=%d (should be 4096)", forty96);
+
+	CHECK(idmap_find(&m, forty95) == ID_PTR(forty95), "after find forty95=%d addr=%p",
+	      forty95, idmap_find(&m, forty95));
+	CHECK(idmap_find(&m, forty96) == ID_PTR(forty96), "after find forty96=%d addr=%p",
+	      forty96, idmap_find(&m, forty96));
+	CHECK(!idmap_find(&m, 0), "found an entry at id=0 for addr=%p", idmap_find(&m, 0));
+
+	CHECK(idmap_remove(&m, forty95) == ID_PTR(forty95), "remove forty95");
+	CHECK(idmap_remove(&m, forty96) == ID_PTR(forty96), "remove forty96");
+	CHECK(!idmap_find(&m, forty95) && !idmap_find(&m, forty96), "found after remove");
+	CHECK(!m.count && !m.pages, "count=%u pages=%u after removing everything", m.count, m.pages);
+	idmap_destroy(&m);
+}
+
+/* the same boundary reached the other ways round */
+static void test_4096_orders(void)
+{
+	struct idmap m;
+	int id;
+
+	idmap_init(&m);
+	CHECK(!idmap_insert(&m, 4096, ID_PTR(4096)), "insert 4096");
+	id = idmap_alloc_above(&m, ID_PTR(4095), 4095);
+	CHECK(id == 4095, "above 4095 with 4096 taken gave %d", id);
+	id = idmap_alloc_above(&m, ID_PTR(4097), 4095);
+	CHECK(id == 4097, "above 4095 with 4095 and 4096 taken gave %d", id);
+	CHECK(idmap_insert(&m, 4096, NULL) && errno == EEXIST, "second insert of 4096");
+	CHECK(idmap_find(&m, 4096) == ID_PTR(4096), "4096 clobbered by failed insert");
+
+	/* 4096 itself sits at the start of a page, 4095 at the end of one */
+	idmap_remove(&m, 4096);
+	id = idmap_alloc_above(&m, ID_PTR(4096), 0);
+	CHECK(id == 0, "above 0 gave %d", id);
+	id = idmap_alloc_above(&m, ID_PTR(4096), 4000);
+	CHECK(id == 4000, "above 4000 gave %d", id);
+	id = idmap_alloc_above(&m, ID_PTR(4096), 4096);
+	CHECK(id == 4096, "refill 4096 gave %d", id);
+	idmap_destroy(&m);
+}
+
+static void test_page_edges(void)
+{
+	struct idmap m;
+	int i, id;
+
+	idmap_init(&m);
+	for (i = 0; i < 2 * IDMAP_PAGE_SIZE + 1; i++) {
+		id = idmap_alloc_above(&m, ID_PTR(i), 0);
+		CHECK(id == i, "dense fill %d gave %d", i, id);
+	}
+	CHECK(m.pages == 3, "pages=%u after %d ids", m.pages, i);
+	/* a hole in a full page is found before moving on */
+	idmap_remove(&m, IDMAP_PAGE_SIZE - 1);
+	id = idmap_alloc_above(&m, NULL, 1);
+	CHECK(id == IDMAP_PAGE_SIZE - 1, "hole at the end of page 0, got %d", id);
+	id = idmap_alloc_above(&m, NULL, 1);
+	CHECK(id == 2 * IDMAP_PAGE_SIZE + 1, "past the full pages got %d", id);
+	/* emptying a page frees it */
+	for (i = IDMAP_PAGE_SIZE; i < 2 * IDMAP_PAGE_SIZE; i++)
+		idmap_remove(&m, i);
+	CHECK(m.pages == 2, "pages=%u after emptying page 1", m.pages);
+	CHECK(!idmap_find(&m, IDMAP_PAGE_SIZE), "find in an emptied page");
+	CHECK(idmap_find(&m, 2 * IDMAP_PAGE_SIZE) == ID_PTR(2 * IDMAP_PAGE_SIZE),
+	      "page 2 lost when page 1 went");
+	idmap_destroy(&m);
+}
+
+static void test_range_ends(void)
+{
+	struct idmap m;
+	int id;
+
+	idmap_init(&m);
+	CHECK(!idmap_find(&m, -1) && !idmap_find(&m, INT_MIN), "found a negative id");
+	CHECK(idmap_insert(&m, -1, NULL) && errno == EINVAL, "inserted a negative id");
+	id = idmap_alloc_above(&m, ID_PTR(1), INT_MAX);
+	CHECK(id == INT_MAX, "above INT_MAX gave %d", id);
+	CHECK(idmap_find(&m, INT_MAX) == ID_PTR(1), "find INT_MAX");
+	id = idmap_alloc_above(&m, ID_PTR(2), INT_MAX);
+	CHECK(id == -1 && errno == ENOSPC, "above a full INT_MAX gave %d", id);
+	id = idmap_alloc_above(&m, ID_PTR(3), -5);
+	CHECK(id == 0, "above a negative start gave %d", id);
+	idmap_destroy(&m);
+}
+
+/* ids spread so far apart that every one is its own page and they all collide a lot */
+static void test_sparse(void)
+{
+	struct idmap m;
+	int i, id;
+
+	idmap_init(&m);
+	for (i = 0; i < 512; i++) {
+		id = i << 22;
+		CHECK(!idmap_insert(&m, id, ID_PTR(id + 1)), "sparse insert %d", id);
+	}
+	CHECK(m.pages == 512, "pages=%u for 512 sparse ids", m.pages);
+	for (i = 0; i < 512; i += 2)
+		idmap_remove(&m, i << 22);
+	for (i = 0; i < 512; i++) {
+		id = i << 22;
+		if (i & 1)
+			CHECK(idmap_find(&m, id) == ID_PTR(id + 1), "sparse find %d", id);
+		else
+			CHECK(!idmap_find(&m, id), "sparse find %d after remove", id);
+		CHECK(!idmap_find(&m, id + 1), "sparse neighbour %d", id + 1);
+	}
+	idmap_destroy(&m);
+}
+
+/* random inserts, allocs, removes and finds, checked against a flat array */
+#define RANDOM_IDS	(1 << 16)
+static void test_random(void)
+{
+	static void *ref[RANDOM_IDS];
+	uint64_t rng = 4096;
+	unsigned int i, op = 0, live = 0;
+	struct idmap m;
+	int id = 0;
+
+	idmap_init(&m);
+	for (i = 0; i < 1000000; i++) {
+		void *ptr = ID_PTR(i + 1);
+
+		op = bench_rand(&rng) % 4;
+		/* allocs start low enough that they can't run off the end of ref */
+		id = bench_rand(&rng) % (op ? RANDOM_IDS : RANDOM_IDS / 2);
+		if (op == 0) {
+			int start = id;
+
+			id = idmap_alloc_above(&m, ptr, start);
+			if (id < 0 || id >= RANDOM_IDS || ref[id])
+				break;
+			/* and it has to be the lowest free one */
+			while (start < id && ref[start])
+				start++;
+			if (start != id)
+				break;
+			ref[id] = ptr;
+			live++;
+		} else if (op == 1) {
+			if (!idmap_insert(&m, id, ptr) != !ref[id])
+				break;
+			if (!ref[id]) {
+				ref[id] = ptr;
+				live++;
+			}
+		} else {
+			if (idmap_remove(&m, id) != ref[id])
+				break;
+			if (ref[id])
+				live--;
+			ref[id] = NULL;
+		}
+		if (m.count != live)
+			break;
+	}
+	CHECK(i == 1000000, "random op %u (%u on id %d) count=%u live=%u", i, op, id, m.count, live);
+	for (id = 0; id < RANDOM_IDS; id++)
+		if (idmap_find(&m, id) != ref[id])
+			break;
+	CHECK(id == RANDOM_IDS, "random run ended with id %d different from the reference", id);
+	idmap_destroy(&m);
+}
+
+int main(void)
+{
+	test_idr_4096();
+	test_4096_orders();
+	test_page_edges();
+	test_range_ends();
+	test_sparse();
+	test_random();
+
+	printf("idmap_test: %u checks, %u failures\n", checks, failures);
+	return failures ? 1 : 0;
+}
@@ -8,9 +8,22 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <getopt.h>
 #include <sys/inotify.h>
 #include <sys/time.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "evbatch.h"
+#include "idmap.h"
+
+static struct bench_opts bench;
+static unsigned long iterations, events;
+static uint64_t start_ns;
 
 int makeFile (const char* filename) {
     FILE *file;
@@ -25,14 +38,525 @@ int makeFile (const char* filename) {
     return 0;
 }
 
-int main (int argc __attribute__((unused)), char* argv[] __attribute__((unused))) {
+/* write the summary and hand back the exit code */
+static int finish (const char *result, int rc) {
+    struct json j;
+
+    if (json_open (&j, bench.json))
+	return rc;
+    json_bench_header (&j, "inotify-oneshot", &bench);
+    json_string (&j, "result", result);
+    json_int (&j, "exit_code", rc);
+    json_uint (&j, "iterations", iterations);
+    json_uint (&j, "events", events);
+    json_double (&j, "elapsed", (now_ns () - start_ns) / 1e9);
+    json_close (&j);
+
+    return rc;
+}
+
+/*
+ * --bench: the same one-shot watches over thousands of files and several
+ * threads, to see what re-arming costs.  Each thread pair owns a shard of
+ * the files and its own inotify fd: the writer closes random files in the
+ * shard after opening them for writing, the reader drains the fd and re-arms.
+ *   oneshot     IN_ONESHOT, re-added after every event (a new wd each time)
+ *   persistent  a plain watch, nothing to re-arm
+ *   maskadd     a plain watch, updated with IN_MASK_ADD after every event
+ * An event for a wd which isn't live (its one-shot already fired) is the bug
+ * the original test looks for, and is checked for in every mode.
+ */
+enum bench_mode {
+    MODE_ONESHOT,
+    MODE_PERSISTENT,
+    MODE_MASKADD,
+    NR_MODES,
+};
+
+static const char *mode_names[NR_MODES] = { "oneshot", "persistent", "maskadd" };
+
+struct bench_file {
+    /* when the writer last opened it while it was watched, for the delivery latency */
+    volatile uint64_t touched_ns;
+    /* live wd, -1 while a fired one-shot waits to be re-added */
+    volatile int wd;
+};
+
+struct shard {
+    pthread_t reader, writer;
+    int fd;
+    unsigned int first, nr;
+    /* live wd -> file index + 1 */
+    struct idmap wds;
+    unsigned long touches;
+    unsigned long events, rearms, ignored, late, lost, mismatched, overflows;
+    struct hist rearm, delivery;
+};
+
+struct mode_result {
+    double elapsed;
+    unsigned long touches;
+    unsigned long events, rearms, ignored, late, lost, mismatched, overflows;
+    struct hist rearm, delivery;
+};
+
+static const char *bench_dir = "/tmp/inotify_oneshot.d";
+static unsigned int nr_files = 4096, nr_threads = 4;
+static int benchmark, bench_modes;
+static enum bench_mode cur_mode;
+static struct bench_file *files;
+static struct shard *shards;
+static struct mode_result results[NR_MODES];
+static int queue_limit;
+static volatile int measuring, writers_stop, readers_stop;
+
+#define FILE_PTR(i)	((void *)(uintptr_t)((i) + 1))
+#define PTR_FILE(p)	((unsigned int)(uintptr_t)(p) - 1)
+
+static void file_path (char *buf, size_t len, unsigned int i) {
+    snprintf (buf, len, "%s/%u", bench_dir, i);
+}
+
+/* (re)watch file i for the current mode, update is the IN_MASK_ADD re-arm */
+static int arm (struct shard *s, unsigned int i, int update) {
+    char path[PATH_MAX];
+    uint32_t mask = IN_CLOSE_WRITE;
+    int wd;
+
+    if (cur_mode == MODE_ONESHOT)
+	mask |= IN_ONESHOT;
+    else if (cur_mode == MODE_MASKADD && update)
+	mask |= IN_MASK_ADD;
+    file_path (path, sizeof(path), i);
+    wd = inotify_add_watch (s->fd, path, mask);
+    if (wd < 0) {
+	fprintf (stderr, "inotify_add_watch(%s) failed: %s\n", path, strerror (errno));
+	exit (1);
+    }
+    if (wd != files[i].wd) {
+	if (files[i].wd >= 0)
+	    idmap_remove (&s->wds, files[i].wd);
+	if (idmap_insert (&s->wds, wd, FILE_PTR(i))) {
+	    /* a wd handed out again while still live: the kernel lost track */
+	    fprintf (stderr, "inotify: wd %d for %s is already live\n", wd, path);
+	    exit (1);
+	}
+	files[i].wd = wd;
+    }
+    return wd;
+}
+
+/* after an overflow nobody knows which one-shots fired, so add everything again */
+static void resync (struct shard *s) {
+    unsigned int i;
+
+    for (i = s->first; i < s->first + s->nr; i++)
+	arm (s, i, 0);
+}
+
+static void handle_event (struct shard *s, const struct inotify_event *ev) {
+    unsigned int i;
+    uint64_t t0, t1;
+    void *p;
+    int wd;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+	s->overflows++;
+	resync (s);
+	return;
+    }
+    p = idmap_find (&s->wds, ev->wd);
+    if (!p) {
+	/* the IN_IGNORED for a fired one-shot comes after its last event */
+	if (ev->mask & IN_IGNORED)
+	    s->ignored += measuring;
+	else {
+	    s->late++;
+	    fprintf (stderr, "inotify: bug detected, event on wd %d after its one-shot fired, mask=%x!\n",
+		ev->wd, ev->mask);
+	}
+	return;
+    }
+    i = PTR_FILE(p);
+    if (ev->mask & IN_IGNORED) {
+	/* a live watch went away by itself */
+	s->lost++;
+	idmap_remove (&s->wds, ev->wd);
+	files[i].wd = -1;
+	arm (s, i, 0);
+	return;
+    }
+
+    if (measuring) {
+	uint64_t now = now_ns (), touched = files[i].touched_ns;
+
+	s->events++;
+	/* the writer may have gone again since now, that touch isn't this event's */
+	if (touched && touched <= now)
+	    hist_record (&s->delivery, now - touched);
+    }
+    if (cur_mode == MODE_PERSISTENT)
+	return;
+    if (cur_mode == MODE_ONESHOT) {
+	/* it's gone already, anything else on this wd is the bug */
+	idmap_remove (&s->wds, ev->wd);
+	files[i].wd = -1;
+    }
+    t0 = now_ns ();
+    wd = arm (s, i, 1);
+    t1 = now_ns ();
+    if (cur_mode == MODE_MASKADD && wd != ev->wd)
+	s->mismatched++;
+    if (measuring) {
+	s->rearms++;
+	hist_record (&s->rearm, t1 - t0);
+    }
+}
+
+static void *reader (void *arg) {
+    char buf[65536] __attribute__ ((aligned (__alignof__(struct inotify_event))));
+    struct shard *s = arg;
+    struct pollfd pollfd;
+    ssize_t len;
+    char *p;
+
+    pollfd.fd = s->fd;
+    pollfd.events = POLLIN;
+    for (;;) {
+	/* once the writers are done, drain what's left so late events still show */
+	if (poll (&pollfd, 1, 100) == 0) {
+	    if (readers_stop)
+		break;
+	    continue;
+	}
+	len = read (s->fd, buf, sizeof(buf));
+	if (len < 0) {
+	    if (errno == EINTR || errno == EAGAIN)
+		continue;
+	    fprintf (stderr, "inotify read() failed: %s\n", strerror (errno));
+	    exit (1);
+	}
+	for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+	    handle_event (s, (struct inotify_event *)p);
+    }
+    return NULL;
+}
+
+static void *writer (void *arg) {
+    struct shard *s = arg;
+    char path[PATH_MAX];
+    uint64_t rng = bench.seed + (s - shards);
+    unsigned long n;
+    unsigned int i;
+    int fd;
+
+    for (n = 0; !writers_stop; n++) {
+	/* keep the queue short of overflowing, the reader has to keep up */
+	if (!(n & 31))
+	    while (ev_queued_bytes (s->fd) > queue_limit && !writers_stop)
+		usleep (100);
+	i = s->first + bench_rand (&rng) % s->nr;
+	file_path (path, sizeof(path), i);
+	/* a touch while a fired one-shot waits to be re-added makes no event */
+	if (files[i].wd >= 0)
+	    files[i].touched_ns = now_ns ();
+	fd = open (path, O_WRONLY);
+	if (fd < 0) {
+	    fprintf (stderr, "open(%s) failed: %s\n", path, strerror (errno));
+	    exit (1);
+	}
+	close (fd);
+	if (measuring)
+	    s->touches++;
+    }
+    return NULL;
+}
+
+static unsigned long total_events (void) {
+    unsigned long events = 0;
+    unsigned int t;
+
+    for (t = 0; t < nr_threads; t++)
+	events += shards[t].events;
+    return events;
+}
+
+static void run_mode (enum bench_mode mode) {
+    struct mode_result *r = &results[mode];
+    uint64_t start, end;
+    unsigned int t, i;
+
+    cur_mode = mode;
+    measuring = writers_stop = readers_stop = 0;
+    for (i = 0; i < nr_files; i++) {
+	files[i].wd = -1;
+	files[i].touched_ns = 0;
+    }
+    for (t = 0; t < nr_threads; t++) {
+	struct shard *s = &shards[t];
+
+	memset (s, 0, sizeof(*s));
+	s->first = t * nr_files / nr_threads;
+	s->nr = (t + 1) * nr_files / nr_threads - s->first;
+	if ((s->fd = inotify_init ()) < 0) {
+	    fprintf (stderr, "inotify_init() failed: %s\n", strerror (errno));
+	    exit (1);
+	}
+	if (idmap_init (&s->wds)) {
+	    fprintf (stderr, "idmap_init() failed\n");
+	    exit (1);
+	}
+	resync (s);
+    }
+    for (t = 0; t < nr_threads; t++) {
+	if (pthread_create (&shards[t].reader, NULL, reader, &shards[t]) ||
+	    pthread_create (&shards[t].writer, NULL, writer, &shards[t])) {
+	    fprintf (stderr, "pthread_create() failed\n");
+	    exit (1);
+	}
+    }
+
+    if (bench.warmup)
+	usleep (bench.warmup * 1e6);
+    start = now_ns ();
+    measuring = 1;
+    for (;;) {
+	usleep (10000);
+	end = now_ns ();
+	if (bench.duration && end - start >= bench.duration * 1e9)
+	    break;
+	if (bench.ops && total_events () >= bench.ops)
+	    break;
+    }
+    measuring = 0;
+    writers_stop = 1;
+    for (t = 0; t < nr_threads; t++)
+	pthread_join (shards[t].writer, NULL);
+    readers_stop = 1;
+    for (t = 0; t < nr_threads; t++)
+	pthread_join (shards[t].reader, NULL);
+
+    memset (r, 0, sizeof(*r));
+    r->elapsed = (end - start) / 1e9;
+    for (t = 0; t < nr_threads; t++) {
+	struct shard *s = &shards[t];
+
+	r->touches += s->touches;
+	r->events += s->events;
+	r->rearms += s->rearms;
+	r->ignored += s->ignored;
+	r->late += s->late;
+	r->lost += s->lost;
+	r->mismatched += s->mismatched;
+	r->overflows += s->overflows;
+	hist_merge (&r->rearm, &s->rearm);
+	hist_merge (&r->delivery, &s->delivery);
+	close (s->fd);
+	idmap_destroy (&s->wds);
+    }
+}
+
+static void print_mode (enum bench_mode mode) {
+    struct mode_result *r = &results[mode];
+
+    printf ("%s: %lu events in %.2fs, %.0f events/s, %lu touches (%.1f%% seen)\n",
+	mode_names[mode], r->events, r->elapsed, r->events / r->elapsed, r->touches,
+	r->touches ? 100.0 * r->events / r->touches : 0.0);
+    printf ("  late %lu  ignored %lu  lost %lu  wd changed %lu  overflows %lu\n",
+	r->late, r->ignored, r->lost, r->mismatched, r->overflows);
+    if (r->rearm.count)
+	hist_print (stdout, "  re-arm", &r->rearm);
+    hist_print (stdout, "  delivery", &r->delivery);
+}
+
+static int bench_finish (void) {
+    unsigned long late = 0;
+    struct json j;
+    int m, rc;
+
+    for (m = 0; m < NR_MODES; m++)
+	if (bench_modes & (1 << m))
+	    late += results[m].late;
+    rc = late ? 2 : 0;
+    if (json_open (&j, bench.json))
+	return rc;
+    json_bench_header (&j, "inotify-oneshot", &bench);
+    json_string (&j, "mode", "bench");
+    json_string (&j, "result", late ? "bug" : "no bug");
+    json_int (&j, "exit_code", rc);
+    json_object_begin (&j, "config");
+    json_uint (&j, "files", nr_files);
+    json_uint (&j, "threads", nr_threads);
+    json_int (&j, "queue_limit", queue_limit);
+    json_object_end (&j);
+    for (m = 0; m < NR_MODES; m++) {
+	struct mode_result *r = &results[m];
+
+	if (!(bench_modes & (1 << m)))
+	    continue;
+	json_object_begin (&j, mode_names[m]);
+	json_double (&j, "elapsed", r->elapsed);
+	json_uint (&j, "touches", r->touches);
+	json_uint (&j, "events", r->events);
+	json_double (&j, "events_per_sec", r->events / r->elapsed);
+	json_uint (&j, "rearms", r->rearms);
+	json_uint (&j, "late", r->late);
+	json_uint (&j, "ignored", r->ignored);
+	json_uint (&j, "lost", r->lost);
+	json_uint (&j, "wd_changed", r->mismatched);
+	json_uint (&j, "overflows", r->overflows);
+	json_hist (&j, "rearm", &r->rearm);
+	json_hist (&j, "delivery", &r->delivery);
+	json_object_end (&j);
+    }
+    json_close (&j);
+    return rc;
+}
+
+/* unlink the first nr files and bench_dir, if nothing else is left in it */
+static void remove_files (unsigned int nr) {
+    char path[PATH_MAX];
+    unsigned int i;
+
+    for (i = 0; i < nr; i++) {
+	file_path (path, sizeof(path), i);
+	unlink (path);
+    }
+    rmdir (bench_dir);
+}
+
+static int run_bench (void) {
+    char path[PATH_MAX];
+    unsigned long max_queued;
+    unsigned int i;
+    int m, rc;
+
+    if (!nr_threads || nr_files < nr_threads) {
+	fprintf (stderr, "need at least one file per thread\n");
+	return 1;
+    }
+    /* the original test has its own end, the benchmark measures each mode this long */
+    if (!bench.ops && !bench.duration)
+	bench.duration = 2;
+    /* half the queue, as each writer checks only every 32 files; 16384 is the default */
+    max_queued = inotify_limit ("max_queued_events");
+    queue_limit = (max_queued ? max_queued : 16384) / 2 * sizeof(struct inotify_event);
+
+    if (mkdir (bench_dir, 0755) && errno != EEXIST) {
+	fprintf (stderr, "mkdir(%s) failed: %s\n", bench_dir, strerror (errno));
+	return 1;
+    }
+    files = calloc (nr_files, sizeof(*files));
+    shards = calloc (nr_threads, sizeof(*shards));
+    if (!files || !shards) {
+	fprintf (stderr, "out of memory\n");
+	return 1;
+    }
+    for (i = 0; i < nr_files; i++) {
+	file_path (path, sizeof(path), i);
+	if (makeFile (path)) {
+	    remove_files (i);
+	    return 1;
+	}
+    }
+
+    printf ("%u files, %u threads\n", nr_files, nr_threads);
+    for (m = 0; m < NR_MODES; m++) {
+	if (!(bench_modes & (1 << m)))
+	    continue;
+	run_mode (m);
+	print_mode (m);
+    }
+    rc = bench_finish ();
+    remove_files (nr_files);
+    free (shards);
+    free (files);
+    return rc;
+}
+
+static int parse_modes (const char *arg) {
+    char *copy, *tok, *save;
+    int m, modes = 0;
+
+    if (!strcmp (arg, "all"))
+	return (1 << NR_MODES) - 1;
+    copy = strdup (arg);
+    for (tok = strtok_r (copy, ",", &save); tok; tok = strtok_r (NULL, ",", &save)) {
+	for (m = 0; m < NR_MODES; m++)
+	    if (!strcmp (tok, mode_names[m]))
+		break;
+	if (m == NR_MODES) {
+	    modes = 0;
+	    break;
+	}
+	modes |= 1 << m;
+    }
+    free (copy);
+    return modes;
+}
+
+static void usage (const char *prog) {
+    fprintf (stderr, "usage: %s [--ops N] [--duration SECS] [--json PATH]\n"
+	"       %s --bench [--files N] [--threads N] [--mode oneshot,persistent,maskadd|all]\n"
+	"\t[--dir PATH] [--ops N] [--duration SECS] [--warmup SECS] [--json PATH]\n",
+	prog, prog);
+    exit (1);
+}
+
+int main (int argc, char* argv[]) {
+    static struct option long_options[] = {
+	BENCH_LONG_OPTIONS,
+	{"bench", no_argument, 0, 'b'},
+	{"files", required_argument, 0, 'f'},
+	{"threads", required_argument, 0, 't'},
+	{"mode", required_argument, 0, 'm'},
+	{"dir", required_argument, 0, 'd'},
+	{0, 0, 0, 0}
+    };
     const char filename[] = "/tmp/inotify_oneshot_test.test";
     struct inotify_event event;
-    int notifyFD, wd, ret, i;
+    int notifyFD, wd, ret, i, c, timeout;
+
+    bench_opts_init (&bench);
+    while ((c = getopt_long (argc, argv, "bf:t:m:d:", long_options, NULL)) != -1) {
+	switch (c) {
+	case 'b':
+	    break;
+	case 'f':
+	    nr_files = strtoul (optarg, NULL, 0);
+	    break;
+	case 't':
+	    nr_threads = strtoul (optarg, NULL, 0);
+	    break;
+	case 'm':
+	    if (!(bench_modes = parse_modes (optarg)))
+		usage (argv[0]);
+	    break;
+	case 'd':
+	    bench_dir = optarg;
+	    break;
+	default:
+	    if (c < BENCH_OPT_BASE || bench_parse_opt (&bench, c, optarg))
+		usage (argv[0]);
+	    continue;
+	}
+	/* any of the benchmark's own options asks for it */
+	benchmark = 1;
+    }
+    /* the original test only has an end, the benchmark is random and warms up */
+    if (bench_opts_done (&bench, benchmark ? BENCH_ALL : BENCH_DURATION | BENCH_OPS))
+	return 1;
+    start_ns = now_ns ();
+
+    if (benchmark) {
+	if (!bench_modes)
+	    bench_modes = (1 << NR_MODES) - 1;
+	return run_bench ();
+    }
 
     if ((notifyFD = inotify_init()) < 0) {
 	fprintf(stderr, "inotify_init() failed: %s\n", strerror(errno));
-	return 1;
+	return finish ("error", 1);
     }
 
     makeFile ( filename );
@@ -41,47 +565,63 @@ int main (int argc __attribute__((unused)), char* argv[] __attribute__((unused))
     wd = inotify_add_watch (notifyFD, filename, IN_CLOSE_WRITE | IN_DELETE_SELF | IN_ONESHOT);
     if (wd < 0) {
 	fprintf ( stderr, "inotify_add_watch() failed: %s\n", strerror (errno));
-	return 1;
+	return finish ("error", 1);
     }
 
     for (i = 0 ; ; i++) {
 	struct pollfd pollfd;
-	
+
+	if (bench.ops && (unsigned long)i >= bench.ops)
+	    return finish ("ops done", 0);
+
+	/* never wait past the end of --duration */
+	timeout = 5000;
+	if (bench.duration) {
+	    double left = bench.duration * 1000 - (now_ns () - start_ns) / 1e6;
+
+	    if (left <= 0)
+		return finish ("duration done", 0);
+	    if (left < timeout)
+		timeout = left;
+	}
+
 	memset(&pollfd, 0, sizeof(pollfd));
 	pollfd.fd = notifyFD;
 	pollfd.events = POLLIN;
 	
 	/* create an event on the file */
 	makeFile (filename);
+	iterations++;
 	
-	if (poll(&pollfd, 1, 5000) == 0) {
+	if (poll(&pollfd, 1, timeout) == 0) {
     	    /* in case of no bug this is default */
     	    fprintf (stderr, "inotify: no bug detected!\n");
-    	    return 0;
+    	    return finish ("no bug", 0);
 	}
 	
 	ret = read(notifyFD, &event, sizeof(event));
 	
 	if (ret < 0) {
 	    fprintf (stderr, "inotify read() failed: %s\n", strerror(errno));
-	    return 1;
+	    return finish ("error", 1);
 	}
 	else if (ret != sizeof(event)) {
 	    fprintf ( stderr, "inotify read() returned %d not %d\n", ret, (int)sizeof(event));
-	    return 1;
+	    return finish ("error", 1);
 	}
 	else if (event.wd != wd) {
 	    fprintf ( stderr, "Watch mismatch, expected %d, got %d\n", wd, event.wd);
-	    return 1;
+	    return finish ("error", 1);
 	}
-	else if (i > 1) {
+	events++;
+	if (i > 1) {
     	    fprintf (stderr, "inotify: bug detected, mask=%x!\n", event.mask);
-    	    return 2;
+    	    return finish ("bug", 2);
 	}
 
 	/* progress report... */
 	fprintf ( stderr, " %d : %d  \r", i, wd );
     }
 
-    return 0;
+    return finish ("done", 0);
 }
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/inotify.h>
@@ -8,17 +9,43 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-int main(int argc, char *argv[] __attribute__ ((unused)))
+#include "bench.h"
+#include "evbatch.h"
+
+int main(int argc, char *argv[])
 {
-	int i, ifd, ret, tfd, wd;
+	static struct option long_options[] = {
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct bench_opts bench;
+	struct json j;
+	int c, ifd, ret, tfd, wd;
+	unsigned long i, events = 0, named = 0, mask_bits[32] = { 0 };
+	uint64_t start, end;
 	ssize_t len;
-	FILE *ifile;
-	struct inotify_event ie;
 	char buf[sizeof(struct inotify_event)];
+	char evbuf[4096] __attribute__ ((aligned (8)));
+	size_t pos;
+	const struct inotify_event *event;
 	uint32_t mask = IN_ALL_EVENTS;
 
 	assert(sizeof(struct inotify_event) > sizeof("hello"));
 
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+			fprintf(stderr, "usage: %s [--ops N] [--duration SECS] [--json PATH] [anything]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_DURATION | BENCH_OPS))
+		return 1;
+	/* the original test did 5 rounds of write and read */
+	if (!bench.ops && !bench.duration)
+		bench.ops = 5;
+
 	/* set up inotify */
 	ifd = inotify_init();
 	if (ifd < 0) {
@@ -26,13 +53,8 @@ int main(int argc, char *argv[] __attribute__ ((unused)))
 		return 1;
 	}
 
-	ifile = fdopen(ifd, "r");
-	if (!ifile) {
-		perror("fdopen");
-		return 1;
-	}
-
-	if (argc > 1)
+	/* any non-option argument turns on the extra mask bit */
+	if (optind < argc)
 		mask |= 0x04000000;
 
 	ret = mkdir("/tmp/inotify", S_IRWXU);
@@ -57,7 +79,13 @@ int main(int argc, char *argv[] __attribute__ ((unused)))
 	}
 
 	/* generate a lot of events */
-	for (i = 0; i < 5; i++) {
+	start = now_ns();
+	for (i = 0; ; i++) {
+		if (bench.ops && i >= bench.ops)
+			break;
+		if (bench.duration && now_ns() - start >= bench.duration * 1e9)
+			break;
+
 		lseek(tfd, 0, SEEK_SET);
 
 		len = write(tfd, "hello", 6);
@@ -75,21 +103,41 @@ int main(int argc, char *argv[] __attribute__ ((unused)))
 		}
 	}
 
+	end = now_ns();
+
+	/* so the loop below ends once the queue is empty rather than blocking */
+	fcntl(ifd, F_SETFL, fcntl(ifd, F_GETFL) | O_NONBLOCK);
+
 	/*check what inotify events we got */
-	while(fread(&ie, sizeof(ie), 1, ifile)) {
-		printf("wd=%d mask=%x", ie.wd, ie.mask);
-		if (ie.len) {
-			assert(ie.len <= sizeof(buf));
-			if (!fread(buf, ie.len, 1, ifile)) {
-				perror("fread-ing name");
-				return 1;
+	while ((len = read(ifd, evbuf, sizeof(evbuf))) > 0) {
+		for (pos = 0; pos < (size_t)len; pos += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *)(evbuf + pos);
+			events++;
+			ev_classify_mask(event->mask, mask_bits);
+			printf("wd=%d mask=%x", event->wd, event->mask);
+			if (event->len) {
+				printf(" name=%s", event->name);
+				named++;
 			}
-			printf(" name=%s", buf);
+			printf("\n");
 		}
-		printf("\n");
 	}
 
 	rmdir("/tmp/inotify");
 
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "inotify-unlink", &bench);
+	json_uint(&j, "rounds", i);
+	json_double(&j, "elapsed", (end - start) / 1e9);
+	json_uint(&j, "events", events);
+	json_uint(&j, "named_events", named);
+	json_object_begin(&j, "events_by_type");
+	for (c = 0; c < 32; c++)
+		if (mask_bits[c] && ev_mask_bit_name(c))
+			json_uint(&j, ev_mask_bit_name(c), mask_bits[c]);
+	json_object_end(&j);
+	json_close(&j);
+
 	return 0;
 }
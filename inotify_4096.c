@@ -1,22 +1,539 @@
 #include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <math.h>
+#include <unistd.h>
 
-int main(void)
+#include "bench.h"
+#include "memacct.h"
+
+static struct bench_opts bench;
+
+/*
+ * --scale MAX: how do inotify_add_watch and inotify_rm_watch cost grow with
+ * the number of watches in one group?  Every watch is on its own file in
+ * --dir.  At each size point (--start, then times --factor up to MAX) the
+ * group is grown to that many live watches and then churned --ops times:
+ * remove a random live watch and watch its file again, and add_watch a
+ * file which is already watched (the update path).  The wds handed out
+ * show whether the kernel reuses freed wds or keeps counting up, and
+ * whether it ever wrapped.
+ *
+ * --mem also samples memory (see memacct.h) at every size point, for what
+ * a watch costs in the kernel and in this process, and at the end fills
+ * the queue to see what a queued event costs.  Without --scale it grows
+ * the group up to fs.inotify.max_user_watches.
+ */
+static unsigned long scale_max;
+static unsigned long scale_start = 1000;
+static double scale_factor = 2;
+static const char *scale_dir = "inotify_4096.d";
+static int mem_mode;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [--scale MAX [--start N] [--factor F] [--dir DIR] [--mem]]\n"
+		"\t[--ops N] [--duration SECS] [--warmup SECS] [--seed N] [--json PATH]\n", prog);
+	exit(1);
+}
+
+static void process_args(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"scale",	required_argument,	0, 'S'},
+		{"start",	required_argument,	0, 's'},
+		{"factor",	required_argument,	0, 'f'},
+		{"dir",		required_argument,	0, 'd'},
+		{"mem",		no_argument,		0, 'm'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "S:s:f:d:m", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'S':
+			scale_max = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			scale_start = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			scale_factor = strtod(optarg, NULL);
+			break;
+		case 'd':
+			scale_dir = optarg;
+			break;
+		case 'm':
+			mem_mode = 1;
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg))
+				usage(argv[0]);
+		}
+	}
+	if (scale_factor <= 1 || !scale_start)
+		usage(argv[0]);
+	/* capped at max_user_watches later */
+	if (mem_mode && !scale_max)
+		scale_max = ULONG_MAX;
+	/* the scale test churns straight after growing, there's nothing to warm up */
+	if (bench_opts_done(&bench, scale_max ? BENCH_DURATION | BENCH_OPS | BENCH_SEED :
+				    BENCH_DURATION | BENCH_OPS | BENCH_WARMUP))
+		exit(1);
+
+	/* the original test: 5000 times round, the scale test churns 10000 per point */
+	if (!bench.ops && !bench.duration)
+		bench.ops = scale_max ? 10000 : 5000;
+}
+
+struct scale_point {
+	unsigned long watches;
+	/* adds growing the group to this size */
+	struct hist grow;
+	/* new watches, removals and updates while churning at this size */
+	struct hist add;
+	struct hist rm;
+	struct hist update;
+	/* churn rounds run, --ops or as many as fit in --duration */
+	unsigned long churned;
+	int max_wd;
+	/* new wds at or below one handed out before, and lower than the one just before */
+	unsigned long reused;
+	unsigned long wrapped;
+	/* with --mem, right after growing to watches */
+	struct memacct mem;
+};
+
+/* what filling the queue with one event per watch cost, with --mem */
+struct queue_cost {
+	unsigned long events;
+	struct memacct before, after;
+	int queued_bytes;
+};
+
+static int high_wd, last_wd;
+
+static void note_wd(struct scale_point *pt, int wd)
+{
+	if (wd <= high_wd)
+		pt->reused++;
+	if (wd < last_wd)
+		pt->wrapped++;
+	last_wd = wd;
+	if (wd > high_wd)
+		high_wd = wd;
+}
+
+static void file_name(char *buf, size_t len, unsigned long i)
+{
+	snprintf(buf, len, "%s/%lu", scale_dir, i);
+}
+
+/* least squares slope of mean latency against log2(watches), ns per doubling */
+static double per_doubling(const struct scale_point *pts, unsigned int n, size_t off)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	unsigned int i;
+
+	if (n < 2)
+		return 0.0;
+	for (i = 0; i < n; i++) {
+		const struct hist *h = (const void *)((const char *)&pts[i] + off);
+		double x = log2(pts[i].watches);
+		double y = h->count ? (double)h->total / h->count : 0.0;
+
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	if (n * sxx - sx * sx == 0)
+		return 0.0;
+	return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+static double hist_mean(const struct hist *h)
+{
+	return h->count ? (double)h->total / h->count : 0.0;
+}
+
+/* bytes per watch of everything memacct sees, relative to before any watches */
+struct watch_cost {
+	double mark;
+	double kernel;
+	double slab;
+	double rss;
+	double heap;
+};
+
+static void watch_cost(const struct memacct *base, const struct scale_point *pt,
+		       struct watch_cost *c)
+{
+	const struct memacct *m = &pt->mem;
+	unsigned long n = pt->watches;
+
+	c->mark = memacct_per(memacct_cache_bytes(&base->mark), memacct_cache_bytes(&m->mark), 1, n);
+	c->kernel = c->mark;
+	/* a connector per watched inode, which is every watch here */
+	if (c->mark >= 0 && memacct_cache_bytes(&m->connector) >= 0)
+		c->kernel += memacct_per(memacct_cache_bytes(&base->connector),
+					 memacct_cache_bytes(&m->connector), 1, n);
+	c->slab = memacct_per(base->slab_kb, m->slab_kb, 1024, n);
+	c->rss = memacct_per(base->rss_kb, m->rss_kb, 1024, n);
+	c->heap = memacct_per(base->heap_bytes, m->heap_bytes, 1, n);
+}
+
+/* write the same byte to each of the first n files, returns how many worked */
+static unsigned long touch_files(unsigned long n)
+{
+	char name[PATH_MAX];
+	unsigned long i;
+	int file;
+
+	for (i = 0; i < n; i++) {
+		file_name(name, sizeof(name), i);
+		file = open(name, O_WRONLY);
+		if (file < 0 || pwrite(file, "x", 1, 0) != 1) {
+			perror(name);
+			break;
+		}
+		close(file);
+	}
+	return i;
+}
+
+/*
+ * one event on each of the first n watches, they are on different files so
+ * none merge.  The files are written once first and the queue emptied, so
+ * what the filesystem allocates for the writes isn't counted.
+ */
+static void fill_queue(int fd, unsigned long n, struct queue_cost *q)
+{
+	char buf[65536];
+	int queued;
+
+	touch_files(n);
+	while (!ioctl(fd, FIONREAD, &queued) && queued > 0)
+		if (read(fd, buf, sizeof(buf)) <= 0)
+			break;
+
+	memacct_sample(&q->before);
+	q->events = touch_files(n);
+	memacct_sample(&q->after);
+	if (ioctl(fd, FIONREAD, &q->queued_bytes))
+		q->queued_bytes = -1;
+}
+
+static void print_mem_table(const struct memacct *base, const struct scale_point *pts,
+			    unsigned long npoints, unsigned long limit)
+{
+	const struct scale_point *last = &pts[npoints - 1];
+	struct watch_cost c;
+	unsigned long i;
+
+	printf("memory per watch (marks from %s, -1 is unknown):\n", memacct_source());
+	printf("%8s %10s %10s %10s %10s %10s %10s\n", "watches", "mark_objs", "mark_B",
+	       "kernel_B", "slab_B", "rss_B", "heap_B");
+	for (i = 0; i < npoints; i++) {
+		watch_cost(base, &pts[i], &c);
+		printf("%8lu %10ld %10.1f %10.1f %10.1f %10.1f %10.1f\n", pts[i].watches,
+		       pts[i].mem.mark.objs, c.mark, c.kernel, c.slab, c.rss, c.heap);
+	}
+	watch_cost(base, last, &c);
+	if (limit && c.slab >= 0)
+		printf("at max_user_watches=%lu: slab ~%.1fMB, rss ~%.1fMB\n", limit,
+		       c.slab * limit / 1048576, c.rss >= 0 ? c.rss * limit / 1048576 : -1.0);
+}
+
+static void print_queue_cost(const struct queue_cost *q, unsigned long max_queued)
+{
+	double slab = memacct_per(q->before.slab_kb, q->after.slab_kb, 1024, q->events);
+
+	printf("%lu queued events: slab %.1f B/event, %.1f B/event to read", q->events, slab,
+	       q->events ? (double)q->queued_bytes / q->events : 0.0);
+	if (max_queued && slab >= 0)
+		printf(", a full queue (max_queued_events=%lu) ~%.1fMB", max_queued,
+		       slab * max_queued / 1048576);
+	printf("\n");
+}
+
+static void json_mem(struct json *j, const struct memacct *base, const struct scale_point *pt)
+{
+	struct watch_cost c;
+
+	watch_cost(base, pt, &c);
+	json_object_begin(j, "memory");
+	json_int(j, "mark_objs", pt->mem.mark.objs);
+	json_int(j, "connector_objs", pt->mem.connector.objs);
+	json_int(j, "slab_kb", pt->mem.slab_kb);
+	json_int(j, "rss_kb", pt->mem.rss_kb);
+	json_int(j, "heap_bytes", pt->mem.heap_bytes);
+	json_double(j, "mark_bytes_per_watch", c.mark);
+	json_double(j, "kernel_bytes_per_watch", c.kernel);
+	json_double(j, "slab_bytes_per_watch", c.slab);
+	json_double(j, "rss_bytes_per_watch", c.rss);
+	json_double(j, "heap_bytes_per_watch", c.heap);
+	json_object_end(j);
+}
+
+static int run_scale(void)
 {
-	int fd = inotify_init();
-	int i;
+	struct scale_point *pts;
+	unsigned long i, k, size, next, live = 0, limit, npoints = 0, max_points, max_queued;
+	uint64_t rng = bench.seed, t, close_ns, churn_end;
+	struct memacct mem_base;
+	struct queue_cost queue;
+	char name[PATH_MAX];
+	int fd, wd, *wds, full = 0;
+	struct json j;
 
+	limit = inotify_limit("max_user_watches");
+	max_queued = inotify_limit("max_queued_events");
+	if (!limit && scale_max == ULONG_MAX) {
+		fprintf(stderr, "can't read fs.inotify.max_user_watches, give --scale\n");
+		return 1;
+	}
+	if (limit && scale_max > limit) {
+		fprintf(stderr, "capping --scale at fs.inotify.max_user_watches=%lu\n", limit);
+		scale_max = limit;
+	}
+	if (scale_start > scale_max)
+		scale_start = scale_max;
+
+	max_points = 2;
+	for (size = scale_start; size < scale_max; size = size * scale_factor + 1)
+		max_points++;
+	pts = calloc(max_points, sizeof(*pts));
+	wds = calloc(scale_max, sizeof(*wds));
+	if (!pts || !wds)
+		abort();
+
+	mkdir(scale_dir, 0700);
+	t = now_ns();
+	for (i = 0; i < scale_max; i++) {
+		file_name(name, sizeof(name), i);
+		fd = open(name, O_RDONLY | O_CREAT, 0600);
+		if (fd < 0) {
+			perror(name);
+			return 1;
+		}
+		close(fd);
+	}
+	printf("created %lu files in %.2fs\n", scale_max, (now_ns() - t) / 1e9);
+
+	/* after the files, their inodes and dentries aren't what we are measuring */
+	if (mem_mode)
+		memacct_sample(&mem_base);
+	fd = inotify_init();
 	if (fd < 0)
 		abort();
 
-	for (i = 0; i < 5000; i++) {
-		int one = inotify_add_watch(fd, ".", IN_MODIFY);
-		int two = inotify_add_watch(fd, "..", IN_MODIFY);
+	for (size = scale_start; !full; size = next) {
+		struct scale_point *pt = &pts[npoints++];
+
+		while (live < size) {
+			file_name(name, sizeof(name), live);
+			t = now_ns();
+			wd = inotify_add_watch(fd, name, IN_MODIFY);
+			t = now_ns() - t;
+			if (wd < 0) {
+				/* other groups hold some of max_user_watches too */
+				if (errno != ENOSPC) {
+					perror("inotify_add_watch");
+					return 1;
+				}
+				printf("ENOSPC at %lu watches, stopping there\n", live);
+				size = live;
+				full = 1;
+				break;
+			}
+			hist_record(&pt->grow, t);
+			note_wd(pt, wd);
+			wds[live++] = wd;
+		}
+		pt->watches = live;
+		if (!live)
+			break;
+		if (mem_mode)
+			memacct_sample(&pt->mem);
+
+		/* --ops rounds or --duration seconds at each point, whichever ends first */
+		churn_end = bench.duration ? now_ns() + bench.duration * 1e9 : 0;
+		for (k = 0; (!bench.ops || k < bench.ops) && (!churn_end || now_ns() < churn_end); k++) {
+			i = bench_rand(&rng) % live;
+			t = now_ns();
+			if (inotify_rm_watch(fd, wds[i])) {
+				perror("inotify_rm_watch");
+				return 1;
+			}
+			hist_record(&pt->rm, now_ns() - t);
+
+			file_name(name, sizeof(name), i);
+			t = now_ns();
+			wd = inotify_add_watch(fd, name, IN_MODIFY);
+			t = now_ns() - t;
+			if (wd < 0) {
+				perror("inotify_add_watch");
+				return 1;
+			}
+			hist_record(&pt->add, t);
+			note_wd(pt, wd);
+			wds[i] = wd;
+
+			file_name(name, sizeof(name), bench_rand(&rng) % live);
+			t = now_ns();
+			if (inotify_add_watch(fd, name, IN_MODIFY) < 0) {
+				perror("inotify_add_watch");
+				return 1;
+			}
+			hist_record(&pt->update, now_ns() - t);
+		}
+		pt->churned = k;
+		pt->max_wd = high_wd;
+
+		printf("%8lu watches: %lu churned, add mean=%.2fus p99=%.2fus  rm mean=%.2fus p99=%.2fus  "
+		       "update mean=%.2fus  max_wd=%d reused=%lu wrapped=%lu\n",
+		       pt->watches, pt->churned, hist_mean(&pt->add) / 1e3, hist_percentile(&pt->add, 99) / 1e3,
+		       hist_mean(&pt->rm) / 1e3, hist_percentile(&pt->rm, 99) / 1e3,
+		       hist_mean(&pt->update) / 1e3, pt->max_wd, pt->reused, pt->wrapped);
+
+		if (size >= scale_max)
+			break;
+		next = size * scale_factor;
+		if (next <= size)
+			next = size + 1;
+		if (next > scale_max)
+			next = scale_max;
+	}
+
+	if (mem_mode) {
+		print_mem_table(&mem_base, pts, npoints, limit);
+		fill_queue(fd, max_queued && max_queued - 1 < live ? max_queued - 1 : live, &queue);
+		print_queue_cost(&queue, max_queued);
+	}
+
+	/* tearing down a big group all at once */
+	t = now_ns();
+	close(fd);
+	close_ns = now_ns() - t;
+	printf("close() with %lu watches took %.2fms\n", live, close_ns / 1e6);
+	printf("per doubling: add %+.0fns rm %+.0fns update %+.0fns\n",
+	       per_doubling(pts, npoints, offsetof(struct scale_point, add)),
+	       per_doubling(pts, npoints, offsetof(struct scale_point, rm)),
+	       per_doubling(pts, npoints, offsetof(struct scale_point, update)));
+
+	for (i = 0; i < scale_max; i++) {
+		file_name(name, sizeof(name), i);
+		unlink(name);
+	}
+	rmdir(scale_dir);
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "inotify_4096", &bench);
+	json_string(&j, "mode", "scale");
+	json_object_begin(&j, "config");
+	json_uint(&j, "max", scale_max);
+	json_uint(&j, "start", scale_start);
+	json_double(&j, "factor", scale_factor);
+	json_uint(&j, "churn_per_point", bench.ops);
+	json_double(&j, "churn_secs_per_point", bench.duration);
+	json_uint(&j, "max_user_watches", limit);
+	json_object_end(&j);
+	json_array_begin(&j, "points");
+	for (i = 0; i < npoints; i++) {
+		struct scale_point *pt = &pts[i];
+
+		json_object_begin(&j, NULL);
+		json_uint(&j, "watches", pt->watches);
+		json_uint(&j, "churned", pt->churned);
+		json_hist(&j, "grow_latency", &pt->grow);
+		json_hist(&j, "add_watch_latency", &pt->add);
+		json_hist(&j, "rm_watch_latency", &pt->rm);
+		json_hist(&j, "update_latency", &pt->update);
+		json_int(&j, "max_wd", pt->max_wd);
+		json_uint(&j, "reused", pt->reused);
+		json_uint(&j, "wrapped", pt->wrapped);
+		if (mem_mode)
+			json_mem(&j, &mem_base, pt);
+		json_object_end(&j);
+	}
+	json_array_end(&j);
+	json_double(&j, "add_ns_per_doubling", per_doubling(pts, npoints, offsetof(struct scale_point, add)));
+	json_double(&j, "rm_ns_per_doubling", per_doubling(pts, npoints, offsetof(struct scale_point, rm)));
+	json_double(&j, "update_ns_per_doubling",
+		    per_doubling(pts, npoints, offsetof(struct scale_point, update)));
+	json_uint(&j, "close_ns", close_ns);
+	if (mem_mode) {
+		json_string(&j, "mark_source", memacct_source());
+		json_object_begin(&j, "queued_events");
+		json_uint(&j, "events", queue.events);
+		json_uint(&j, "max_queued_events", max_queued);
+		json_double(&j, "slab_bytes_per_event",
+			    memacct_per(queue.before.slab_kb, queue.after.slab_kb, 1024, queue.events));
+		json_double(&j, "read_bytes_per_event",
+			    queue.events ? (double)queue.queued_bytes / queue.events : 0.0);
+		json_object_end(&j);
+	}
+	json_close(&j);
+
+	free(pts);
+	free(wds);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd;
+	unsigned long i, measured = 0;
+	int min_wd = -1, max_wd = -1;
+	uint64_t start, t, measure_start = 0;
+	struct hist *add_lat, *rm_lat;
+	struct json j;
+
+	process_args(argc, argv);
+	if (scale_max)
+		return run_scale();
+
+	add_lat = calloc(1, sizeof(*add_lat));
+	rm_lat = calloc(1, sizeof(*rm_lat));
+	if (!add_lat || !rm_lat)
+		abort();
+
+	fd = inotify_init();
+	if (fd < 0)
+		abort();
+
+	start = now_ns();
+	for (i = 0; ; i++) {
+		uint64_t add_ns, rm_ns;
+		int one, two;
 		int s;
 
+		t = now_ns();
+		if (!measure_start && t - start >= bench.warmup * 1e9)
+			measure_start = t;
+		if (measure_start) {
+			if (bench.ops && measured >= bench.ops)
+				break;
+			if (bench.duration && t - measure_start >= bench.duration * 1e9)
+				break;
+		}
+
+		one = inotify_add_watch(fd, ".", IN_MODIFY);
+		two = inotify_add_watch(fd, "..", IN_MODIFY);
+		add_ns = now_ns() - t;
+
 		if (one < 0) {
 			printf("failed to add_watch one=%d\n", one);
 			abort();
@@ -29,6 +546,7 @@ int main(void)
 
 		printf("one=%d two=%d\n", one, two);
 
+		t = now_ns();
 		s = inotify_rm_watch(fd, one);
 		if (s != 0) {
 			printf("failed to rm_watch wd %d: %s\n",
@@ -42,6 +560,37 @@ int main(void)
 			       two, strerror(errno));
 			abort();
 		}
+		rm_ns = now_ns() - t;
+
+		if (min_wd < 0 || one < min_wd)
+			min_wd = one;
+		if (two > max_wd)
+			max_wd = two;
+
+		if (measure_start) {
+			/* each sample is a pair of calls */
+			hist_record(add_lat, add_ns / 2);
+			hist_record(rm_lat, rm_ns / 2);
+			measured++;
+		}
 	}
+	t = now_ns();
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "inotify_4096", &bench);
+	json_uint(&j, "iterations", i);
+	json_uint(&j, "measured_iterations", measured);
+	json_double(&j, "elapsed", measure_start ? (t - measure_start) / 1e9 : 0.0);
+	json_double(&j, "add_watch_per_sec", measure_start && t > measure_start ?
+		    2.0 * measured / ((t - measure_start) / 1e9) : 0.0);
+	json_int(&j, "min_wd", min_wd);
+	json_int(&j, "max_wd", max_wd);
+	json_hist(&j, "add_watch_latency", add_lat);
+	json_hist(&j, "rm_watch_latency", rm_lat);
+	json_close(&j);
+
+	free(add_lat);
+	free(rm_lat);
 	return 0;
 }
@@ -1,15 +1,77 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <sys/inotify.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "coalesce.h"
+#include "evbatch.h"
+#include "evout.h"
+#include "uring.h"
+
 int wd1 = -1;
 int should_exit = 0;
 int inotify_fd = 0;
 
+static struct bench_opts bench;
+static unsigned long total_events, total_reads, total_bytes;
+static unsigned long mask_bits[32];
+/* IN_Q_OVERFLOW seen, with the events read ahead of them and bytes queued after */
+static unsigned long overflows, overflow_ahead, overflow_queued;
+
+/*
+ * verbose is the original printf and hex dump per event.  csv and binary
+ * hand events to a writer thread which writes them in large batches.
+ */
+enum output_mode {
+	OUTPUT_VERBOSE,
+	OUTPUT_CSV,
+	OUTPUT_BINARY,
+};
+static enum output_mode output_mode = OUTPUT_VERBOSE;
+static const char *output_path = "-";
+static unsigned int ring_slots = 65536;
+static struct evout *evout;
+/*
+ * the writer thread write()s records straight to its fd, so when that is
+ * stdout the banner and summary go to stderr rather than being mixed in to
+ * the records whenever stdio gets round to flushing them
+ */
+static FILE *info;
+
+/*
+ * poll is poll() then reads sized from FIONREAD until the queue is empty.
+ * uring keeps a multishot read posted on the fd and reaps and re-posts
+ * with one io_uring_enter().
+ */
+enum reader_mode {
+	READER_POLL,
+	READER_URING,
+};
+static enum reader_mode reader_mode = READER_POLL;
+static struct uring ring;
+static struct ev_reader reader;
+static unsigned long total_syscalls;
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* --coalesce WINDOW_MS[,COUNT] */
+static double coalesce_ms;
+static unsigned int coalesce_count;
+static struct coalesce *coalescer;
+
 static void handler(int sig, siginfo_t *si __attribute__ ((unused)), void *data __attribute__ ((unused)))
 {
 	int ret;
@@ -25,64 +87,260 @@ static void handler(int sig, siginfo_t *si __attribute__ ((unused)), void *data
 	} else if (sig == SIGINT) {
 		should_exit = 1;
 	}
-	printf("got signal=%d\n", sig);
+	fprintf(info, "got signal=%d\n", sig);
+}
+
+/* where events go once read, or once they come out of the coalescer */
+static void emit_event(void *arg __attribute__ ((unused)), const struct coalesce_event *ev)
+{
+	if (evout) {
+		evout_push(evout, ev->ts_ns, ev->wd, ev->mask, ev->cookie, ev->name);
+		return;
+	}
+	printf("wd=%d mask=%x cookie=%d count=%u", ev->wd, ev->mask, ev->cookie, ev->count);
+	if (ev->name)
+		printf(" event->name=%s", ev->name);
+	printf("\n\n");
+}
+
+/* wake up in time for the next coalesced event to be due */
+static int poll_timeout(void)
+{
+	uint64_t deadline, now;
+
+	if (!coalescer || !(deadline = coalesce_deadline(coalescer)))
+		return 50;
+	now = now_ns();
+	if (deadline <= now)
+		return 0;
+	if (deadline - now >= 50000000ull)
+		return 50;
+	return (deadline - now + 999999) / 1000000;
+}
+
+/*
+ * the kernel dropped events, so whatever the consumer built from the ones it
+ * did see may be stale.  The files named on the command line are all this
+ * tool knows about, so they are all that can be resynced.
+ */
+static void note_overflow(unsigned long ahead)
+{
+	int queued = ev_queued_bytes(inotify_fd);
+
+	overflows++;
+	overflow_ahead += ahead;
+	if (queued > 0)
+		overflow_queued += queued;
+	fprintf(stderr, "queue overflowed: %lu events read ahead of it, %d bytes queued since, "
+		"watched files need a rescan\n", ahead, queued);
+}
+
+static void handle_events(const char *buf, int ret)
+{
+	const struct inotify_event *event;
+	const uint32_t *cur;
+	unsigned long read_events = 0;
+	const char *name;
+	size_t pos;
+	uint64_t now;
+	int i, event_len;
+
+	total_reads++;
+	total_bytes += ret;
+	now = now_ns();
+
+	/* one pass, each event is classified and handed on as it is walked */
+	for (pos = 0; pos < (size_t)ret; pos += sizeof(*event) + event->len, read_events++) {
+		event = (const struct inotify_event *)(buf + pos);
+		name = event->len ? event->name : NULL;
+		ev_classify_mask(event->mask, mask_bits);
+		if (event->mask & IN_Q_OVERFLOW)
+			note_overflow(read_events);
+
+		if (coalescer) {
+			coalesce_push(coalescer, now, event->wd, event->mask, event->cookie, name);
+			continue;
+		}
+
+		if (evout) {
+			evout_push(evout, now, event->wd, event->mask, event->cookie, name);
+			continue;
+		}
+
+		cur = (const uint32_t *)event;
+		event_len = sizeof(struct inotify_event) + event->len;
+		/* print the RAW inotify_event */
+		for (i = 0; i < event_len / (int)sizeof(uint32_t); i += 4)
+			printf("\t%08x  %08x  %08x  %08x\n",
+				cur[i+0], cur[i+1], cur[i+2] , cur[i+3]);
+
+		printf("wd=%d mask=%x cookie=%d len=%d", event->wd, event->mask,
+		       event->cookie, event->len);
+		if (name)
+			printf(" event->name=%s", name);
+		printf("\n\n");
+	}
+	total_events += read_events;
 }
 
 static int print_events(void)
 {
-	char buf[8192];	
-	char *p;
-	struct inotify_event *event;
+	unsigned long calls = reader.reads + reader.queries;
 	struct pollfd fds;
-	uint32_t *cur;
-	int ret, i, event_len;
+	int ret;
 
 	fds.fd = inotify_fd;
 	fds.events = (POLLIN);
 
-	ret = poll(&fds, 1, 50);
+	ret = poll(&fds, 1, poll_timeout());
+	total_syscalls++;
 	if (ret < 0) {
 		perror("poll");
 		return 1;
 	} else if (ret == 0)
 		return 1;
 
-	ret = read(inotify_fd, buf, 8192);
-	if (ret <= 0) {
+	/* the first read can't block, poll said so, and the rest ask FIONREAD first */
+	do {
+		ret = ev_reader_read(&reader, inotify_fd);
+		if (ret > 0)
+			handle_events(reader.buf, ret);
+	} while (ret > 0 && reader.more);
+	total_syscalls += reader.reads + reader.queries - calls;
+	if (ret == 0 || (ret < 0 && errno != EAGAIN)) {
 		perror("read");
 		exit(1);
 	}
+	return 0;
+}
 
-	p = &buf[0];
-	while (p < &buf[0] + ret) {
-		event = (struct inotify_event *)p;
-		cur = (uint32_t *)p;
+static int uring_events(void)
+{
+	const char *buf;
+	uint64_t user_data;
+	int len, ret;
 
-		event_len = sizeof(struct inotify_event) + event->len;
-		/* print the RAW inotify_event */
-		for (i = 0; i < event_len / sizeof(uint32_t); i += 4)
-			printf("\t%08x  %08x  %08x  %08x\n",
-				cur[i+0], cur[i+1], cur[i+2] , cur[i+3]);
+	ret = uring_wait(&ring, poll_timeout());
+	total_syscalls = ring.stats.enters;
+	if (ret < 0) {
+		perror("io_uring_enter");
+		exit(1);
+	}
+	if (!ret)
+		return 1;
+	while (uring_next(&ring, &user_data, &buf, &len)) {
+		if (len < 0) {
+			errno = -len;
+			perror("read");
+			exit(1);
+		}
+		if (len > 0)
+			handle_events(buf, len);
+	}
+	return 0;
+}
 
-		printf("wd=%d mask=%x cookie=%d len=%d", event->wd, event->mask, event->cookie, event->len);
-		if (event->len)
-			printf(" event->name=%s", event->name);
-		printf("\n\n");
+static void usage(const char *prog)
+{
+	printf("usage: %s [--output verbose|csv|binary] [--out PATH] [--ring SLOTS]\n"
+	       "\t[--coalesce WINDOW_MS[,COUNT]] [--reader poll|uring]\n"
+	       "\t[--duration SECS] [--ops EVENTS] [--json PATH] [FILENAME]...\n", prog);
+}
 
-		p += sizeof(struct inotify_event) + event->len;
-	}
+static int start_output(void)
+{
+	int fd = STDOUT_FILENO;
 
+	if (output_mode == OUTPUT_VERBOSE)
+		return 0;
+
+	if (strcmp(output_path, "-")) {
+		fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			perror(output_path);
+			return 1;
+		}
+	}
+	evout = evout_start(fd, output_mode == OUTPUT_CSV ? EVOUT_CSV : EVOUT_BINARY, ring_slots);
+	if (!evout) {
+		fprintf(stderr, "unable to start the output writer (--ring must be a power of 2)\n");
+		return 1;
+	}
 	return 0;
 }
 
 int main(int argc, char *argv[])
 {
+	static struct option long_options[] = {
+		{"output",	required_argument,	0, 'o'},
+		{"out",		required_argument,	0, 'w'},
+		{"ring",	required_argument,	0, 'r'},
+		{"coalesce",	required_argument,	0, 'c'},
+		{"reader",	required_argument,	0, 'R'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
 	int ret;
 	struct sigaction act;
-	int wd, i;
+	struct json j;
+	struct evout_stats *out_stats = NULL;
+	const struct coalesce_stats *cstats = NULL;
+	char *end;
+	uint64_t start, measure_start = 0, last_report = 0;
+	unsigned long base_events = 0, base_syscalls = 0, reported_drops = 0;
+	uint64_t base_cpu = 0, cpu_ns;
+	double events, syscalls;
+	int wd, i, c;
 
-	if (argc < 2) {
-		printf("usage: %s [FILENAME]\n", argv[0]);
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "o:w:r:c:R:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			if (!strcmp(optarg, "verbose"))
+				output_mode = OUTPUT_VERBOSE;
+			else if (!strcmp(optarg, "csv"))
+				output_mode = OUTPUT_CSV;
+			else if (!strcmp(optarg, "binary"))
+				output_mode = OUTPUT_BINARY;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'w':
+			output_path = optarg;
+			break;
+		case 'r':
+			ring_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			coalesce_ms = strtod(optarg, &end);
+			if (*end == ',')
+				coalesce_count = strtoul(end + 1, NULL, 0);
+			break;
+		case 'R':
+			if (!strcmp(optarg, "poll"))
+				reader_mode = READER_POLL;
+			else if (!strcmp(optarg, "uring"))
+				reader_mode = READER_URING;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_DURATION | BENCH_OPS | BENCH_WARMUP))
+		return 1;
+	info = output_mode != OUTPUT_VERBOSE && !strcmp(output_path, "-") ? stderr : stdout;
+
+	if (optind >= argc) {
+		usage(argv[0]);
 		return 1;
 	}
 
@@ -93,31 +351,180 @@ int main(int argc, char *argv[])
 	sigaction(SIGUSR1, &act, NULL);
 	sigaction(SIGUSR2, &act, NULL);
 
-	inotify_fd = inotify_init();
+	/* io_uring only tries the read once data is there if it won't block */
+	inotify_fd = reader_mode == READER_URING ? inotify_init1(IN_NONBLOCK) : inotify_init();
 	if (inotify_fd < 0) {
 		perror("inotify_init");
 		return 1;
 	}
-	printf("inotify fd=%d sizeof(struct inotify_event)=%zd\n", inotify_fd, sizeof(struct inotify_event));
+	fprintf(info, "inotify fd=%d sizeof(struct inotify_event)=%zd\n", inotify_fd,
+		sizeof(struct inotify_event));
 
-	for (i = 1; i < argc; i++) {
+	for (i = optind; i < argc; i++) {
 		ret = inotify_add_watch(inotify_fd, argv[i], IN_ALL_EVENTS);
 		if (ret < 0) {
 			perror("inotify_add_watch");
 			return 1;
 		} else {
 			wd = ret;
-			printf("wd=%d for %s\n", wd, argv[i]);
-			if (i == 1)
+			fprintf(info, "wd=%d for %s\n", wd, argv[i]);
+			if (i == optind)
 				wd1 = wd;
 		}
 	}
 
+	if (reader_mode == READER_URING) {
+		uint64_t user_data = 0;
+
+		if (uring_init(&ring, 64, 8192) || uring_add_reads(&ring, &inotify_fd, &user_data, 1)) {
+			perror("io_uring");
+			return 1;
+		}
+	} else if (ev_reader_init(&reader, 0, 0)) {
+		perror("malloc");
+		return 1;
+	}
+
+	if (start_output())
+		return 1;
+	if (coalesce_ms > 0 || coalesce_count) {
+		coalescer = coalesce_create(coalesce_ms * 1e6, coalesce_count, 4096, emit_event, NULL);
+		if (!coalescer) {
+			perror("coalesce_create");
+			return 1;
+		}
+	}
+
+	start = now_ns();
 	while(1) {
+		uint64_t now;
+
 		if (should_exit)
 			break;
-		print_events();
+		if (reader_mode == READER_URING)
+			uring_events();
+		else
+			print_events();
+
+		now = now_ns();
+		if (coalescer)
+			coalesce_tick(coalescer, now);
+		/* let people know once a second if the writer can't keep up */
+		if (evout && now - last_report >= 1000000000ull) {
+			unsigned long drops = evout_dropped(evout);
+
+			if (drops != reported_drops)
+				fprintf(stderr, "writer behind: dropped %lu events (%lu total), %lu queued\n",
+					drops - reported_drops, drops, evout_depth(evout));
+			reported_drops = drops;
+			last_report = now;
+		}
+		if (!measure_start && now - start >= bench.warmup * 1e9) {
+			measure_start = now;
+			base_events = total_events;
+			base_syscalls = total_syscalls;
+			base_cpu = thread_cpu_ns();
+		}
+		if (!measure_start)
+			continue;
+		if (bench.duration && now - measure_start >= bench.duration * 1e9)
+			break;
+		if (bench.ops && total_events - base_events >= bench.ops)
+			break;
+	}
+
+	/* what reading cost, for comparing the reader modes */
+	cpu_ns = thread_cpu_ns() - base_cpu;
+	events = total_events - base_events;
+	syscalls = total_syscalls - base_syscalls;
+	fprintf(stderr, "reader: mode=%s events=%.0f syscalls=%.0f syscalls/event=%.3f cpu=%.1fms cpu/event=%.0fns\n",
+		reader_mode == READER_URING ? "uring" : "poll", events, syscalls,
+		events ? syscalls / events : 0.0, cpu_ns / 1e6, events ? cpu_ns / events : 0.0);
+
+	if (coalescer) {
+		coalesce_flush(coalescer, now_ns());
+		cstats = coalesce_stats(coalescer);
+		fprintf(stderr, "coalesce: in=%lu out=%lu reduction=%.1fx barriers=%lu "
+			"flushes window=%lu count=%lu full=%lu barrier=%lu\n",
+			cstats->in, cstats->out, cstats->out ? (double)cstats->in / cstats->out : 0.0,
+			cstats->barriers, cstats->window_flushes, cstats->count_flushes,
+			cstats->full_flushes, cstats->barrier_flushes);
+		hist_print(stderr, "coalesce delay", &cstats->delay);
+	}
+
+	if (evout) {
+		/* much too big for the stack */
+		out_stats = malloc(sizeof(*out_stats));
+		if (!out_stats)
+			return 1;
+		evout_stop(evout, out_stats);
+		fprintf(stderr, "output: queued=%lu written=%lu dropped=%lu writes=%lu bytes=%lu max_depth=%lu\n",
+			out_stats->queued, out_stats->written, out_stats->dropped,
+			out_stats->writes, out_stats->bytes, out_stats->max_depth);
+		hist_print(stderr, "output lag", &out_stats->lag);
+	}
+
+	if (json_open_std(&j, bench.json, info))
+		return 1;
+	json_bench_header(&j, "inotify_tester", &bench);
+	json_uint(&j, "watches", argc - optind);
+	json_double(&j, "elapsed", measure_start ? (now_ns() - measure_start) / 1e9 : 0.0);
+	json_uint(&j, "events", total_events - base_events);
+	json_uint(&j, "total_events", total_events);
+	json_uint(&j, "reads", total_reads);
+	json_uint(&j, "bytes", total_bytes);
+	json_object_begin(&j, "reader");
+	json_string(&j, "mode", reader_mode == READER_URING ? "uring" : "poll");
+	json_uint(&j, "syscalls", syscalls);
+	json_double(&j, "syscalls_per_event", events ? syscalls / events : 0.0);
+	json_uint(&j, "cpu_ns", cpu_ns);
+	json_double(&j, "cpu_ns_per_event", events ? cpu_ns / events : 0.0);
+	if (reader_mode == READER_URING) {
+		json_string(&j, "reads", ring.multishot ? "multishot" : "single shot");
+		json_uint(&j, "reposts", ring.stats.reposts);
+		json_uint(&j, "out_of_buffers", ring.stats.nobufs);
+		json_uint(&j, "errors", ring.stats.errors);
+	}
+	json_object_end(&j);
+	json_object_begin(&j, "overflow");
+	json_uint(&j, "count", overflows);
+	json_double(&j, "events_ahead", overflows ? (double)overflow_ahead / overflows : 0.0);
+	json_double(&j, "queued_bytes", overflows ? (double)overflow_queued / overflows : 0.0);
+	json_object_end(&j);
+	json_object_begin(&j, "events_by_type");
+	for (i = 0; i < 32; i++)
+		if (mask_bits[i] && ev_mask_bit_name(i))
+			json_uint(&j, ev_mask_bit_name(i), mask_bits[i]);
+	json_object_end(&j);
+	if (cstats) {
+		json_object_begin(&j, "coalesce");
+		json_double(&j, "window_ms", coalesce_ms);
+		json_uint(&j, "max_count", coalesce_count);
+		json_uint(&j, "in", cstats->in);
+		json_uint(&j, "out", cstats->out);
+		json_double(&j, "reduction", cstats->out ? (double)cstats->in / cstats->out : 0.0);
+		json_uint(&j, "barriers", cstats->barriers);
+		json_uint(&j, "window_flushes", cstats->window_flushes);
+		json_uint(&j, "count_flushes", cstats->count_flushes);
+		json_uint(&j, "full_flushes", cstats->full_flushes);
+		json_uint(&j, "barrier_flushes", cstats->barrier_flushes);
+		json_hist(&j, "delay", &cstats->delay);
+		json_object_end(&j);
+	}
+	if (out_stats) {
+		json_object_begin(&j, "output");
+		json_string(&j, "mode", output_mode == OUTPUT_CSV ? "csv" : "binary");
+		json_uint(&j, "queued", out_stats->queued);
+		json_uint(&j, "written", out_stats->written);
+		json_uint(&j, "dropped", out_stats->dropped);
+		json_uint(&j, "writes", out_stats->writes);
+		json_uint(&j, "bytes", out_stats->bytes);
+		json_uint(&j, "max_depth", out_stats->max_depth);
+		json_hist(&j, "lag", &out_stats->lag);
+		json_object_end(&j);
+		free(out_stats);
 	}
+	json_close(&j);
 
 	return 0;
 }
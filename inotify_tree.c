@@ -0,0 +1,741 @@
+/*
+ * watch a whole directory tree.  The initial registration is done by
+ * several walker threads (openat + getdents64 + inotify_add_watch) while the
+ * main thread runs the usual poll/read event loop, so directories created
+ * during the walk are picked up from their IN_CREATE events and walked too.
+ * Reports how long it took for the whole tree to be watched.
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "evbatch.h"
+#include "memacct.h"
+#include "wdtable.h"
+
+#define TREE_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		   IN_DELETE_SELF | IN_MOVE_SELF | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE)
+
+static struct bench_opts bench;
+static unsigned int num_walkers;
+/* create a tree with this many directories under the root first */
+static unsigned long populate_dirs;
+static unsigned int populate_fanout = 10;
+/* stop as soon as the tree is watched rather than watching events */
+static int watch_only;
+/* --mem: what the watches cost, sampled before the walk and once it is done */
+static int mem_mode;
+static struct memacct mem_before, mem_after;
+static const char *root;
+
+static int inotify_fd;
+static volatile int stopped;
+
+/* directories still to be walked */
+struct walk_item {
+	struct walk_item *next;
+	/* already watched as wd, only relist it if it changed */
+	int rescan_wd;
+	int parent_wd;
+	/* the last component of path */
+	const char *name;
+	char path[];
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct walk_item *queue_head, *queue_tail;
+/* queued plus being walked, the tree is fully watched when it hits 0 */
+static unsigned long pending;
+
+/* wd to path, so events can be turned back in to paths */
+static pthread_mutex_t paths_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct wd_table paths;
+/* each directory's mtime when we last listed it, by wd */
+static struct timespec *listed;
+static unsigned int listed_size;
+
+struct walker_stats {
+	unsigned long dirs;
+	unsigned long watches;
+	unsigned long dup_watches;
+	unsigned long add_errors;
+	unsigned long getdents;
+	unsigned long entries;
+	/* directories looked at after an overflow, relisted and found gone */
+	unsigned long rescanned;
+	unsigned long relisted;
+	unsigned long gone;
+} __attribute__ ((aligned (64)));
+
+static struct walker_stats *walker_stats;
+
+static uint64_t start_ns, watched_ns;
+static unsigned long event_dirs, renames, total_events;
+/* total_events when measuring started, events before it are the walk's */
+static unsigned long base_events;
+
+/*
+ * after IN_Q_OVERFLOW any directory may have changed without us hearing
+ * about it, so every watched directory is queued for a rescan
+ */
+static unsigned long overflows, overflow_ahead, overflow_queued;
+static uint64_t rescan_start_ns, rescan_ns;
+
+static void sigfunc(int sig_num)
+{
+	if (sig_num == SIGINT)
+		stopped = 1;
+}
+
+static void push_item(struct walk_item *item)
+{
+	pthread_mutex_lock(&queue_lock);
+	if (queue_tail)
+		queue_tail->next = item;
+	else
+		queue_head = item;
+	queue_tail = item;
+	pending++;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static void enqueue(const char *parent, int parent_wd, const char *name)
+{
+	struct walk_item *item;
+	size_t len;
+
+	len = strlen(parent) + (name ? strlen(name) + 1 : 0) + 1;
+	item = malloc(sizeof(*item) + len);
+	if (!item) {
+		perror("allocating walk item");
+		exit(1);
+	}
+	if (name) {
+		snprintf(item->path, len, "%s/%s", parent, name);
+		item->name = item->path + strlen(parent) + 1;
+	} else {
+		strcpy(item->path, parent);
+		item->name = item->path;
+	}
+	item->rescan_wd = -1;
+	item->parent_wd = parent_wd;
+	item->next = NULL;
+	push_item(item);
+}
+
+/* path is the whole path of wd, as the table has it now */
+static void enqueue_rescan(const char *path, int wd, int parent_wd)
+{
+	struct walk_item *item;
+	size_t len = strlen(path) + 1;
+	const char *slash;
+
+	item = malloc(sizeof(*item) + len);
+	if (!item) {
+		perror("allocating walk item");
+		exit(1);
+	}
+	memcpy(item->path, path, len);
+	slash = strrchr(item->path, '/');
+	item->name = parent_wd == WDTABLE_NO_PARENT || !slash ? item->path : slash + 1;
+	item->rescan_wd = wd;
+	item->parent_wd = parent_wd;
+	item->next = NULL;
+	push_item(item);
+}
+
+/* walkers stay around for directories that show up later, NULL when stopping */
+static struct walk_item *dequeue(void)
+{
+	struct walk_item *item;
+
+	pthread_mutex_lock(&queue_lock);
+	while (!queue_head && !stopped)
+		pthread_cond_wait(&queue_cond, &queue_lock);
+	item = queue_head;
+	if (item) {
+		queue_head = item->next;
+		if (!queue_head)
+			queue_tail = NULL;
+	}
+	pthread_mutex_unlock(&queue_lock);
+	return item;
+}
+
+static void walk_done(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	if (--pending == 0) {
+		if (!watched_ns)
+			watched_ns = now_ns();
+		if (rescan_start_ns) {
+			rescan_ns += now_ns() - rescan_start_ns;
+			rescan_start_ns = 0;
+		}
+	}
+	pthread_mutex_unlock(&queue_lock);
+}
+
+/* returns 1 if wd is new, 0 if something already watched this directory */
+static int remember_path(int wd, int parent_wd, const char *name)
+{
+	int ret;
+
+	pthread_mutex_lock(&paths_lock);
+	ret = wdtable_add(&paths, wd, parent_wd, name);
+	pthread_mutex_unlock(&paths_lock);
+	if (ret < 0) {
+		perror("adding to the path table");
+		exit(1);
+	}
+	return ret;
+}
+
+static void forget_path(int wd)
+{
+	pthread_mutex_lock(&paths_lock);
+	wdtable_remove(&paths, wd);
+	pthread_mutex_unlock(&paths_lock);
+}
+
+/*
+ * drop wd, unless it has been renamed since path was looked up.  If its
+ * parent has already been dropped it is under a deleted directory too.
+ */
+static void forget_path_if(int wd, const char *path)
+{
+	char cur[PATH_MAX];
+
+	pthread_mutex_lock(&paths_lock);
+	if (wdtable_path(&paths, wd, cur, sizeof(cur)) < 0 || !strcmp(cur, path))
+		wdtable_remove(&paths, wd);
+	pthread_mutex_unlock(&paths_lock);
+}
+
+/*
+ * note the mtime wd was listed at, returns 0 if it is the same as last
+ * time.  mtime granularity means a change in the same tick as the last
+ * listing can be missed, the same is true of every mtime based rescanner.
+ */
+static int listed_at(int wd, const struct timespec *mtime)
+{
+	int ret = 1;
+
+	pthread_mutex_lock(&paths_lock);
+	if ((unsigned int)wd >= listed_size) {
+		unsigned int size = listed_size ? listed_size : 1024;
+		struct timespec *l;
+
+		while (size <= (unsigned int)wd)
+			size *= 2;
+		l = realloc(listed, size * sizeof(*listed));
+		if (!l) {
+			perror("growing the listed table");
+			exit(1);
+		}
+		memset(l + listed_size, 0, (size - listed_size) * sizeof(*listed));
+		listed = l;
+		listed_size = size;
+	}
+	if (listed[wd].tv_sec == mtime->tv_sec && listed[wd].tv_nsec == mtime->tv_nsec)
+		ret = 0;
+	listed[wd] = *mtime;
+	pthread_mutex_unlock(&paths_lock);
+	return ret;
+}
+
+/* copy the path for wd in to buf, returns -1 if we don't know it */
+static int lookup_path(int wd, char *buf, size_t len)
+{
+	int ret;
+
+	pthread_mutex_lock(&paths_lock);
+	ret = wdtable_path(&paths, wd, buf, len);
+	pthread_mutex_unlock(&paths_lock);
+	return ret < 0 ? -1 : 0;
+}
+
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/*
+ * watch first, then list.  Anything created after the watch went on shows
+ * up as an event, anything before it is in the listing, so nothing is missed.
+ */
+static void walk_dir(struct walker_stats *stats, struct walk_item *item, char *buf, size_t len)
+{
+	const char *path = item->path;
+	struct linux_dirent64 *d;
+	struct stat st;
+	long nread, pos;
+	int dfd, wd;
+
+	if (item->rescan_wd >= 0)
+		stats->rescanned++;
+
+	wd = inotify_add_watch(inotify_fd, path, TREE_MASK | IN_ONLYDIR);
+	if (wd < 0) {
+		/* gone already, or we ran out of watches */
+		if (errno != ENOENT && errno != ENOTDIR) {
+			stats->add_errors++;
+		} else if (item->rescan_wd >= 0) {
+			/* its IN_IGNORED may have been lost in the overflow */
+			forget_path_if(item->rescan_wd, path);
+			stats->gone++;
+		}
+		return;
+	}
+	/* a directory moved within the tree only gets its entry updated */
+	if (remember_path(wd, item->parent_wd, item->name)) {
+		stats->watches++;
+	} else if (item->rescan_wd < 0) {
+		stats->dup_watches++;
+		return;
+	}
+	/* replaced by another directory of the same name while we weren't looking */
+	if (item->rescan_wd >= 0 && wd != item->rescan_wd)
+		forget_path_if(item->rescan_wd, path);
+
+	dfd = openat(AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd < 0)
+		return;
+	/* the mtime before listing, so a change during it shows up next time */
+	if (!fstat(dfd, &st) && !listed_at(wd, &st.st_mtim) && item->rescan_wd >= 0) {
+		close(dfd);
+		return;
+	}
+	if (item->rescan_wd >= 0)
+		stats->relisted++;
+	stats->dirs++;
+
+	while ((nread = syscall(SYS_getdents64, dfd, buf, len)) > 0) {
+		stats->getdents++;
+		for (pos = 0; pos < nread; pos += d->d_reclen) {
+			d = (struct linux_dirent64 *)(buf + pos);
+			if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+				continue;
+			stats->entries++;
+			if (d->d_type == DT_UNKNOWN) {
+				if (fstatat(dfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) ||
+				    !S_ISDIR(st.st_mode))
+					continue;
+			} else if (d->d_type != DT_DIR) {
+				continue;
+			}
+			enqueue(path, wd, d->d_name);
+		}
+	}
+	close(dfd);
+}
+
+static void *__walker(void *ptr)
+{
+	struct walker_stats *stats = ptr;
+	struct walk_item *item;
+	char *buf;
+
+	buf = malloc(64 * 1024);
+	if (!buf) {
+		perror("allocating getdents buffer");
+		exit(1);
+	}
+
+	while ((item = dequeue())) {
+		walk_dir(stats, item, buf, 64 * 1024);
+		free(item);
+		walk_done();
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* directory n (1 based) lives in directory (n - 1) / fanout, like a heap */
+static int tree_path(unsigned long n, char *buf, size_t len)
+{
+	int ret;
+
+	if (!n)
+		return snprintf(buf, len, "%s", root);
+	ret = tree_path((n - 1) / populate_fanout, buf, len);
+	if (ret < 0 || (size_t)ret >= len)
+		return ret;
+	return ret + snprintf(buf + ret, len - ret, "/d%lu", n);
+}
+
+/* breadth first tree of populate_dirs directories, populate_fanout wide */
+static int populate(void)
+{
+	char path[PATH_MAX];
+	unsigned long n;
+
+	mkdir(root, S_IRWXU);
+	for (n = 1; n <= populate_dirs; n++) {
+		if (tree_path(n, path, sizeof(path)) >= (int)sizeof(path)) {
+			fprintf(stderr, "tree too deep, raise --fanout\n");
+			return -1;
+		}
+		if (mkdir(path, S_IRWXU) && errno != EEXIST) {
+			perror(path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* returns 1 if the directory was already watched and has been renamed */
+static int moved_dir(const char *parent, int parent_wd, const char *name)
+{
+	char path[PATH_MAX];
+	int wd;
+
+	snprintf(path, sizeof(path), "%s/%s", parent, name);
+	wd = inotify_add_watch(inotify_fd, path, TREE_MASK | IN_ONLYDIR);
+	if (wd < 0)
+		return 1;
+	if (!remember_path(wd, parent_wd, name)) {
+		renames++;
+		return 1;
+	}
+	/* moved in from outside, let a walker add it again and list it */
+	forget_path(wd);
+	return 0;
+}
+
+/* queue every watched directory to be checked, walkers only relist changed ones */
+static void start_rescan(void)
+{
+	char path[PATH_MAX];
+	unsigned int wd;
+
+	pthread_mutex_lock(&queue_lock);
+	if (!rescan_start_ns)
+		rescan_start_ns = now_ns();
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_mutex_lock(&paths_lock);
+	for (wd = 0; wd < paths.size; wd++) {
+		const struct wd_entry *e = wdtable_lookup(&paths, wd);
+
+		if (e && wdtable_path(&paths, wd, path, sizeof(path)) >= 0)
+			enqueue_rescan(path, wd, e->parent_wd);
+	}
+	pthread_mutex_unlock(&paths_lock);
+}
+
+static void handle_overflow(unsigned long ahead)
+{
+	int queued = ev_queued_bytes(inotify_fd);
+
+	overflows++;
+	overflow_ahead += ahead;
+	if (queued > 0)
+		overflow_queued += queued;
+	fprintf(stderr, "queue overflowed: %lu events read ahead of it, %d bytes queued since, rescanning\n",
+		ahead, queued);
+	start_rescan();
+}
+
+static void handle_events(char *buf, size_t len)
+{
+	static struct ev_batch batch;
+	char path[PATH_MAX];
+	unsigned long read_events = 0;
+	size_t pos = 0;
+	unsigned int n;
+
+	while (pos < len) {
+		pos += ev_batch_decode(&batch, buf + pos, len - pos);
+		total_events += batch.count;
+
+		for (n = 0; n < batch.count; n++) {
+			uint32_t mask = batch.mask[n];
+
+			if (mask & IN_Q_OVERFLOW) {
+				handle_overflow(read_events + n);
+				continue;
+			}
+
+			if (mask & IN_IGNORED) {
+				forget_path(batch.wd[n]);
+				continue;
+			}
+			if (!(mask & IN_ISDIR) || !(mask & (IN_CREATE | IN_MOVED_TO)) ||
+			    lookup_path(batch.wd[n], path, sizeof(path)))
+				continue;
+			/*
+			 * a directory moved within the tree has to be renamed
+			 * before we look at the next event, which may be from
+			 * underneath it, so don't leave it to the walkers
+			 */
+			if ((mask & IN_MOVED_TO) &&
+			    moved_dir(path, batch.wd[n], ev_batch_name(&batch, n)))
+				continue;
+			/* a new directory, created or moved in, needs walking */
+			enqueue(path, batch.wd[n], ev_batch_name(&batch, n));
+			event_dirs++;
+		}
+		read_events += batch.count;
+	}
+}
+
+static void event_loop(void)
+{
+	char buf[64 * 1024];
+	struct pollfd pfd;
+	uint64_t measure_start = 0;
+	int ret;
+
+	pfd.fd = inotify_fd;
+	pfd.events = POLLIN;
+	while (!stopped) {
+		if (watch_only && watched_ns)
+			break;
+		if (watched_ns && !measure_start) {
+			measure_start = now_ns();
+			base_events = total_events;
+		}
+		if (measure_start && bench.duration &&
+		    now_ns() - measure_start >= bench.duration * 1e9)
+			break;
+		if (measure_start && bench.ops && total_events - base_events >= bench.ops)
+			break;
+
+		ret = poll(&pfd, 1, 50);
+		if (ret <= 0)
+			continue;
+		ret = read(inotify_fd, buf, sizeof(buf));
+		if (ret <= 0)
+			continue;
+		handle_events(buf, ret);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [--threads N] [--populate DIRS] [--fanout N] [--watch-only] [--mem]\n"
+		"\t[--duration SECS] [--ops EVENTS] [--json PATH] DIRECTORY\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"threads",	required_argument,	0, 't'},
+		{"populate",	required_argument,	0, 'p'},
+		{"fanout",	required_argument,	0, 'f'},
+		{"watch-only",	no_argument,		0, 'w'},
+		{"mem",		no_argument,		0, 'm'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct walker_stats total;
+	struct sigaction setmask;
+	pthread_t *walkers;
+	struct json j;
+	double secs;
+	unsigned int i;
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "t:p:f:wm", long_options, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			num_walkers = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			populate_dirs = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			populate_fanout = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			watch_only = 1;
+			break;
+		case 'm':
+			mem_mode = 1;
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg))
+				usage(argv[0]);
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_DURATION | BENCH_OPS))
+		return 1;
+	if (optind != argc - 1)
+		usage(argv[0]);
+	root = argv[optind];
+	if (!num_walkers)
+		num_walkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (populate_fanout < 1)
+		populate_fanout = 1;
+
+	sigemptyset(&setmask.sa_mask);
+	setmask.sa_handler = sigfunc;
+	setmask.sa_flags = 0;
+	sigaction(SIGINT, &setmask, NULL);
+
+	if (populate_dirs) {
+		fprintf(stdout, "Populating %s with %lu directories\n", root, populate_dirs);
+		if (populate())
+			return 1;
+	}
+
+	if (mem_mode)
+		memacct_sample(&mem_before);
+	inotify_fd = inotify_init1(O_NONBLOCK | O_CLOEXEC);
+	if (inotify_fd < 0) {
+		perror("inotify_init1");
+		return 1;
+	}
+
+	/* calloc() doesn't honour the stats' alignment, so neighbours could share a line */
+	if (posix_memalign((void **)&walker_stats, 64, num_walkers * sizeof(*walker_stats))) {
+		perror("allocating walkers");
+		return 1;
+	}
+	memset(walker_stats, 0, num_walkers * sizeof(*walker_stats));
+	walkers = calloc(num_walkers, sizeof(*walkers));
+	if (!walkers) {
+		perror("allocating walkers");
+		return 1;
+	}
+
+	if (wdtable_init(&paths)) {
+		perror("allocating the path table");
+		return 1;
+	}
+
+	start_ns = now_ns();
+	enqueue(root, WDTABLE_NO_PARENT, NULL);
+	for (i = 0; i < num_walkers; i++) {
+		if (pthread_create(&walkers[i], NULL, __walker, &walker_stats[i])) {
+			perror("creating walker threads");
+			return 1;
+		}
+	}
+
+	event_loop();
+	if (mem_mode)
+		memacct_sample(&mem_after);
+
+	/* wake up walkers stuck waiting for work if we were interrupted */
+	pthread_mutex_lock(&queue_lock);
+	stopped = 1;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+	for (i = 0; i < num_walkers; i++)
+		pthread_join(walkers[i], NULL);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < num_walkers; i++) {
+		total.dirs += walker_stats[i].dirs;
+		total.watches += walker_stats[i].watches;
+		total.dup_watches += walker_stats[i].dup_watches;
+		total.add_errors += walker_stats[i].add_errors;
+		total.getdents += walker_stats[i].getdents;
+		total.entries += walker_stats[i].entries;
+		total.rescanned += walker_stats[i].rescanned;
+		total.relisted += walker_stats[i].relisted;
+		total.gone += walker_stats[i].gone;
+	}
+	secs = watched_ns ? (watched_ns - start_ns) / 1e9 : 0;
+
+	fprintf(stdout, "watched %lu directories with %u threads in %.3fs (%.0f watches/s), "
+		"%lu found by events, %lu renamed, %lu duplicate adds, %lu add errors\n",
+		total.watches, num_walkers, secs, secs ? total.watches / secs : 0.0,
+		event_dirs, renames, total.dup_watches, total.add_errors);
+	if (overflows)
+		fprintf(stdout, "overflows: %lu, rescanned %lu directories in %.3fs, "
+			"relisted %lu, %lu gone\n", overflows, total.rescanned, rescan_ns / 1e9,
+			total.relisted, total.gone);
+	fprintf(stdout, "path table: %zu bytes for %u watches (%.1f bytes/watch), %u unique names\n",
+		wdtable_bytes(&paths), paths.live,
+		paths.live ? (double)wdtable_bytes(&paths) / paths.live : 0.0,
+		paths.intern_count);
+	if (mem_mode)
+		fprintf(stdout, "memory per watch: marks %.1f bytes (from %s), slab %.1f, rss %.1f, heap %.1f\n",
+			memacct_per(memacct_cache_bytes(&mem_before.mark),
+				    memacct_cache_bytes(&mem_after.mark), 1, paths.live),
+			memacct_source(),
+			memacct_per(mem_before.slab_kb, mem_after.slab_kb, 1024, paths.live),
+			memacct_per(mem_before.rss_kb, mem_after.rss_kb, 1024, paths.live),
+			memacct_per(mem_before.heap_bytes, mem_after.heap_bytes, 1, paths.live));
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "inotify_tree", &bench);
+	json_object_begin(&j, "config");
+	json_uint(&j, "threads", num_walkers);
+	json_uint(&j, "populate", populate_dirs);
+	json_uint(&j, "fanout", populate_fanout);
+	json_object_end(&j);
+	json_int(&j, "fully_watched", watched_ns != 0);
+	json_double(&j, "time_to_watched", secs);
+	json_uint(&j, "watches", total.watches);
+	json_double(&j, "watches_per_sec", secs ? total.watches / secs : 0.0);
+	json_uint(&j, "dirs_walked", total.dirs);
+	json_uint(&j, "dirs_from_events", event_dirs);
+	json_uint(&j, "renames", renames);
+	json_uint(&j, "duplicate_adds", total.dup_watches);
+	json_uint(&j, "add_errors", total.add_errors);
+	json_uint(&j, "getdents_calls", total.getdents);
+	json_uint(&j, "entries", total.entries);
+	json_uint(&j, "events", total_events - base_events);
+	json_uint(&j, "total_events", total_events);
+	json_object_begin(&j, "overflow");
+	json_uint(&j, "count", overflows);
+	json_double(&j, "events_ahead", overflows ? (double)overflow_ahead / overflows : 0.0);
+	json_double(&j, "queued_bytes", overflows ? (double)overflow_queued / overflows : 0.0);
+	json_uint(&j, "rescanned", total.rescanned);
+	json_uint(&j, "relisted", total.relisted);
+	json_uint(&j, "gone", total.gone);
+	json_double(&j, "rescan_time", rescan_ns / 1e9);
+	json_object_end(&j);
+	json_object_begin(&j, "path_table");
+	json_uint(&j, "bytes", wdtable_bytes(&paths));
+	json_uint(&j, "live", paths.live);
+	json_uint(&j, "unique_names", paths.intern_count);
+	json_double(&j, "bytes_per_watch", paths.live ? (double)wdtable_bytes(&paths) / paths.live : 0.0);
+	json_object_end(&j);
+	if (mem_mode) {
+		json_object_begin(&j, "memory");
+		json_string(&j, "mark_source", memacct_source());
+		json_double(&j, "mark_bytes_per_watch",
+			    memacct_per(memacct_cache_bytes(&mem_before.mark),
+					memacct_cache_bytes(&mem_after.mark), 1, paths.live));
+		json_double(&j, "slab_bytes_per_watch",
+			    memacct_per(mem_before.slab_kb, mem_after.slab_kb, 1024, paths.live));
+		json_double(&j, "rss_bytes_per_watch",
+			    memacct_per(mem_before.rss_kb, mem_after.rss_kb, 1024, paths.live));
+		json_double(&j, "heap_bytes_per_watch",
+			    memacct_per(mem_before.heap_bytes, mem_after.heap_bytes, 1, paths.live));
+		json_object_end(&j);
+	}
+	json_close(&j);
+
+	return 0;
+}
@@ -0,0 +1,933 @@
+/*
+ * open loop filesystem event generator with a paired reader.  Generator
+ * threads run a weighted mix of create, write, attrib, rename, unlink and
+ * mkdir over their own set of file slots in one directory, at a fixed
+ * aggregate rate.  Every name has the thread, slot and a sequence number in
+ * it (t<thread>.f<slot>.s<seq>) so the reader, watching the directory, can
+ * tell which operation each event came from and record how long it took to
+ * go from the operation to read().
+ *
+ * Latency is measured from when the operation was scheduled, not when the
+ * generator got around to it, so a generator falling behind shows up as
+ * latency instead of quietly lowering the rate.  Each slot keeps a short
+ * queue of the operations the reader hasn't seen yet, and an event is matched
+ * to one by its sequence number and operation.  When several operations on
+ * one file are merged in to a single event (the kernel merges an event
+ * with an identical one queued right before it) the event is charged to the
+ * oldest of them and the rest count as merged.
+ *
+ * The reader is either inotify watching the directory (read with poll() and
+ * read(), or through an io_uring with a multishot read) or fanotify with
+ * FAN_REPORT_DFID_NAME (names without opening anything) and an inode,
+ * mount or filesystem mark, so the two can be compared on the same
+ * workload (same --seed).  fanotify needs root.  A mount mark can't report
+ * directory entry events, so with one only writes are timed.  fanotify
+ * reports a directory's own events (chmod of a mkdir'd slot) as "." in the
+ * directory itself, those aren't timed and count as foreign.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "evbatch.h"
+#include "hist.h"
+#include "memacct.h"
+#include "uring.h"
+
+enum op {
+	OP_CREATE,
+	OP_WRITE,
+	OP_ATTRIB,
+	OP_RENAME,
+	OP_UNLINK,
+	OP_MKDIR,
+	NR_OPS,
+};
+static const char *op_names[] = {
+	[OP_CREATE]	= "create",
+	[OP_WRITE]	= "write",
+	[OP_ATTRIB]	= "attrib",
+	[OP_RENAME]	= "rename",
+	[OP_UNLINK]	= "unlink",
+	[OP_MKDIR]	= "mkdir",
+};
+#define READER_MASK (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_MOVED_TO | IN_DELETE)
+#define FAN_READER_MASK (FAN_CREATE | FAN_MODIFY | FAN_ATTRIB | FAN_MOVED_TO | FAN_DELETE | FAN_ONDIR)
+
+enum backend {
+	BACKEND_INOTIFY,
+	BACKEND_INOTIFY_URING,
+	BACKEND_FANOTIFY,
+	NR_BACKENDS,
+};
+static const char *backend_names[] = {
+	[BACKEND_INOTIFY]	= "inotify",
+	[BACKEND_INOTIFY_URING]	= "inotify-uring",
+	[BACKEND_FANOTIFY]	= "fanotify",
+};
+
+enum mark {
+	MARK_INODE,
+	MARK_MOUNT,
+	MARK_FILESYSTEM,
+	NR_MARKS,
+};
+static const char *mark_names[] = {
+	[MARK_INODE]		= "inode",
+	[MARK_MOUNT]		= "mount",
+	[MARK_FILESYSTEM]	= "filesystem",
+};
+
+static struct bench_opts bench;
+static const char *dir = "loadgen.d";
+static unsigned int num_threads = 1;
+static unsigned int num_slots = 64;
+/* aggregate ops/sec over every thread, 0 means as fast as possible */
+static double rate;
+static unsigned int mix[NR_OPS] = {
+	[OP_CREATE]	= 20,
+	[OP_WRITE]	= 40,
+	[OP_ATTRIB]	= 10,
+	[OP_RENAME]	= 10,
+	[OP_UNLINK]	= 15,
+	[OP_MKDIR]	= 5,
+};
+static unsigned int mix_total;
+static enum backend backend = BACKEND_INOTIFY;
+static enum mark mark = MARK_INODE;
+/* ops the reader gets events for, only those are timed */
+static unsigned int observed_ops = (1 << NR_OPS) - 1;
+
+enum slot_state {
+	SLOT_EMPTY,
+	SLOT_FILE,
+	SLOT_DIR,
+};
+
+/* operations on one slot waiting for their event, a power of 2 */
+#define SLOT_PENDING	8
+
+/* a timed operation: when it was due and the name its event will carry */
+struct pending {
+	uint64_t due;
+	uint64_t seq;
+	/* NR_OPS once the operation failed, so nothing matches it */
+	unsigned int op;
+};
+
+/*
+ * the slot's owning generator pushes at tail before doing an operation, the
+ * reader pops from head as events come in.  Events for one slot arrive in
+ * the order the operations were done, so anything ahead of the entry an
+ * event matches never got an event of its own.
+ */
+struct slot {
+	struct pending pending[SLOT_PENDING];
+	unsigned int head;
+	unsigned int tail;
+	uint64_t seq;
+	enum slot_state state;
+};
+
+struct gen_stats {
+	unsigned long ops[NR_OPS];
+	unsigned long errors;
+	/* ops issued more than a millisecond after they were due */
+	unsigned long late;
+	/* measured ops not timed because their slot's queue was full */
+	unsigned long untimed;
+} __attribute__ ((aligned (64)));
+
+struct generator {
+	unsigned int id;
+	struct slot *slots;
+	uint64_t rng;
+	struct gen_stats stats;
+} __attribute__ ((aligned (64)));
+
+static struct generator *gens;
+static volatile int stopped;
+/* set once the warmup is over, only ops after it are counted and timed */
+static volatile int measuring;
+static uint64_t measure_start;
+/* measured ops handed out, so --ops stops exactly */
+static unsigned long issued;
+
+/* reader side */
+static int notify_fd;
+static uint64_t reader_cpu_ns;
+static unsigned long reader_syscalls;
+static volatile int gens_done;
+static struct hist *op_lat;
+static struct hist *all_lat;
+/*
+ * events charged to an op, ops folded in to an event charged to an earlier
+ * one, events with no op waiting for them
+ */
+static unsigned long events, matched, merged, unmatched, foreign, overflows;
+
+static void slot_name(char *buf, size_t len, unsigned int thread, unsigned int slot, uint64_t seq)
+{
+	snprintf(buf, len, "%s/t%u.f%u.s%lu", dir, thread, slot, (unsigned long)seq);
+}
+
+static enum op pick_op(uint64_t *rng)
+{
+	unsigned int r = bench_rand(rng) % mix_total;
+	unsigned int i;
+
+	for (i = 0; r >= mix[i]; i++)
+		r -= mix[i];
+	return i;
+}
+
+/*
+ * ops that need an empty slot turn in to an unlink on a full one and ops
+ * that need a file turn in to a create on an empty one, which keeps the
+ * population roughly steady whatever the mix
+ */
+static enum op fit_op(enum op op, const struct slot *s)
+{
+	switch (op) {
+	case OP_CREATE:
+	case OP_MKDIR:
+		return s->state == SLOT_EMPTY ? op : OP_UNLINK;
+	case OP_WRITE:
+		if (s->state == SLOT_DIR)
+			return OP_ATTRIB;
+		/* fall through */
+	default:
+		return s->state == SLOT_EMPTY ? OP_CREATE : op;
+	}
+}
+
+static int observed(enum op op, const struct slot *s)
+{
+	if (backend == BACKEND_FANOTIFY && op == OP_ATTRIB && s->state == SLOT_DIR)
+		return 0;
+	return observed_ops & (1 << op);
+}
+
+static int do_op(struct generator *g, unsigned int idx, enum op op)
+{
+	struct slot *s = &g->slots[idx];
+	char path[PATH_MAX], new_path[PATH_MAX];
+	int fd, ret = 0;
+
+	slot_name(path, sizeof(path), g->id, idx, s->seq);
+	switch (op) {
+	case OP_CREATE:
+		slot_name(path, sizeof(path), g->id, idx, ++s->seq);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			return -1;
+		close(fd);
+		s->state = SLOT_FILE;
+		break;
+	case OP_MKDIR:
+		slot_name(path, sizeof(path), g->id, idx, ++s->seq);
+		ret = mkdir(path, S_IRWXU);
+		if (!ret)
+			s->state = SLOT_DIR;
+		break;
+	case OP_WRITE:
+		fd = open(path, O_WRONLY);
+		if (fd < 0)
+			return -1;
+		ret = pwrite(fd, "x", 1, 0) == 1 ? 0 : -1;
+		close(fd);
+		break;
+	case OP_ATTRIB:
+		ret = chmod(path, s->state == SLOT_DIR ? S_IRWXU : S_IRUSR | S_IWUSR);
+		break;
+	case OP_RENAME:
+		slot_name(new_path, sizeof(new_path), g->id, idx, s->seq + 1);
+		ret = rename(path, new_path);
+		if (!ret)
+			s->seq++;
+		break;
+	case OP_UNLINK:
+		ret = s->state == SLOT_DIR ? rmdir(path) : unlink(path);
+		if (!ret)
+			s->state = SLOT_EMPTY;
+		break;
+	default:
+		break;
+	}
+	return ret;
+}
+
+/* the sequence number in the name of the event op on s will produce */
+static uint64_t op_seq(enum op op, const struct slot *s)
+{
+	switch (op) {
+	case OP_CREATE:
+	case OP_MKDIR:
+	case OP_RENAME:
+		return s->seq + 1;
+	default:
+		return s->seq;
+	}
+}
+
+/* queue op for the reader to time, before doing it, NULL if the queue is full */
+static struct pending *push_pending(struct slot *s, enum op op, uint64_t due)
+{
+	struct pending *p;
+
+	if (s->tail - __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) >= SLOT_PENDING)
+		return NULL;
+	p = &s->pending[s->tail & (SLOT_PENDING - 1)];
+	p->due = due;
+	p->seq = op_seq(op, s);
+	p->op = op;
+	__atomic_store_n(&s->tail, s->tail + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+static void *__generator(void *arg)
+{
+	struct generator *g = arg;
+	double interval = rate > 0 ? 1e9 * num_threads / rate : 0;
+	uint64_t start, due, now;
+	unsigned long n;
+
+	/* spread the threads' arrivals over the interval */
+	start = now_ns() + interval * g->id / num_threads;
+	for (n = 0; !stopped; n++) {
+		struct pending *p = NULL;
+		struct slot *s;
+		unsigned int idx;
+		int measured;
+		enum op op;
+
+		due = interval ? start + n * interval : now_ns();
+		now = now_ns();
+		/* sleep when there is time to, spinning would starve the reader */
+		if (due > now + 50000) {
+			struct timespec ts = {
+				.tv_sec = due / 1000000000ull,
+				.tv_nsec = due % 1000000000ull,
+			};
+
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		} else if (now > due + 1000000 && measuring) {
+			g->stats.late++;
+		}
+		while (now_ns() < due)
+			;
+
+		measured = measuring;
+		if (measured && bench.ops &&
+		    __atomic_add_fetch(&issued, 1, __ATOMIC_RELAXED) > bench.ops)
+			break;
+
+		idx = bench_rand(&g->rng) % num_slots;
+		s = &g->slots[idx];
+		op = fit_op(pick_op(&g->rng), s);
+
+		if (measured && observed(op, s)) {
+			p = push_pending(s, op, due);
+			if (!p)
+				g->stats.untimed++;
+		}
+		if (do_op(g, idx, op)) {
+			if (p)
+				__atomic_store_n(&p->op, NR_OPS, __ATOMIC_RELAXED);
+			g->stats.errors++;
+			continue;
+		}
+		if (measured)
+			g->stats.ops[op]++;
+	}
+	return NULL;
+}
+
+/* t<thread>.f<slot>.s<seq>, returns the slot or NULL */
+static struct slot *name_slot(const char *name, uint64_t *seq)
+{
+	unsigned int thread, slot;
+	unsigned long n;
+
+	if (!name || sscanf(name, "t%u.f%u.s%lu", &thread, &slot, &n) != 3)
+		return NULL;
+	if (thread >= num_threads || slot >= num_slots)
+		return NULL;
+	*seq = n;
+	return &gens[thread].slots[slot];
+}
+
+/* the ops (1 << op) an inotify event could have come from */
+static unsigned int mask_ops(uint32_t mask)
+{
+	if (mask & IN_CREATE)
+		return 1 << (mask & IN_ISDIR ? OP_MKDIR : OP_CREATE);
+	if (mask & IN_MODIFY)
+		return 1 << OP_WRITE;
+	if (mask & IN_ATTRIB)
+		return 1 << OP_ATTRIB;
+	if (mask & IN_MOVED_TO)
+		return 1 << OP_RENAME;
+	return 1 << OP_UNLINK;
+}
+
+/* fanotify merges masks, so an event can stand for several ops */
+static unsigned int fan_mask_ops(uint64_t mask)
+{
+	unsigned int ops = 0;
+
+	if (mask & FAN_CREATE)
+		ops |= 1 << (mask & FAN_ONDIR ? OP_MKDIR : OP_CREATE);
+	if (mask & FAN_MODIFY)
+		ops |= 1 << OP_WRITE;
+	if (mask & FAN_ATTRIB)
+		ops |= 1 << OP_ATTRIB;
+	if (mask & FAN_MOVED_TO)
+		ops |= 1 << OP_RENAME;
+	if (mask & FAN_DELETE)
+		ops |= 1 << OP_UNLINK;
+	return ops;
+}
+
+/*
+ * charge the event to the oldest op on its slot with the same sequence
+ * number and one of ops, dropping the ones ahead of it
+ */
+static void time_event(const char *name, unsigned int ops, uint64_t now)
+{
+	uint64_t seq;
+	struct slot *s = name_slot(name, &seq);
+	const struct pending *p;
+	unsigned int head, tail, i, op;
+	uint64_t due;
+
+	if (!s) {
+		foreign++;
+		return;
+	}
+	head = s->head;
+	tail = __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+	for (i = head; i != tail; i++) {
+		p = &s->pending[i & (SLOT_PENDING - 1)];
+		op = __atomic_load_n(&p->op, __ATOMIC_RELAXED);
+		if (op < NR_OPS && p->seq == seq && (ops & (1 << op)))
+			break;
+	}
+	if (i == tail) {
+		unmatched++;
+		return;
+	}
+	due = p->due;
+	for (; head != i; head++)
+		if (__atomic_load_n(&s->pending[head & (SLOT_PENDING - 1)].op, __ATOMIC_RELAXED) < NR_OPS)
+			merged++;
+	__atomic_store_n(&s->head, i + 1, __ATOMIC_RELEASE);
+	if (due > now) {
+		unmatched++;
+		return;
+	}
+	hist_record(&op_lat[op], now - due);
+	hist_record(all_lat, now - due);
+	matched++;
+}
+
+static void read_inotify(const char *buf, size_t len)
+{
+	static struct ev_batch batch;
+	unsigned int n;
+
+	for (size_t pos = 0; pos < len; ) {
+		uint64_t now = now_ns();
+
+		pos += ev_batch_decode(&batch, buf + pos, len - pos);
+		events += batch.count;
+		for (n = 0; n < batch.count; n++) {
+			if (batch.mask[n] & IN_Q_OVERFLOW) {
+				overflows++;
+				continue;
+			}
+			time_event(ev_batch_name(&batch, n), mask_ops(batch.mask[n]), now);
+		}
+	}
+}
+
+/* the entry name follows the parent's file handle in the DFID_NAME record */
+static const char *fan_event_name(const struct fanotify_event_metadata *meta)
+{
+	const char *pos = (const char *)meta + meta->metadata_len;
+	const char *end = (const char *)meta + meta->event_len;
+
+	while (pos + sizeof(struct fanotify_event_info_header) <= end) {
+		const struct fanotify_event_info_header *hdr = (const void *)pos;
+
+		if (!hdr->len)
+			break;
+		if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+			const struct fanotify_event_info_fid *fid = (const void *)hdr;
+			const struct file_handle *fh = (const void *)fid->handle;
+
+			return (const char *)fh->f_handle + fh->handle_bytes;
+		}
+		pos += hdr->len;
+	}
+	return NULL;
+}
+
+static void read_fanotify(const char *buf, size_t len)
+{
+	const struct fanotify_event_metadata *meta = (const void *)buf;
+	uint64_t now = now_ns();
+	ssize_t left = len;
+
+	for (; FAN_EVENT_OK(meta, left); meta = FAN_EVENT_NEXT(meta, left)) {
+		events++;
+		if (meta->mask & FAN_Q_OVERFLOW) {
+			overflows++;
+			continue;
+		}
+		/* reporting fids means no fd is opened, but be sure */
+		if (meta->fd >= 0)
+			close(meta->fd);
+		time_event(fan_event_name(meta), fan_mask_ops(meta->mask), now);
+	}
+}
+
+/* the same as poll_reader() with the read kept posted on an io_uring */
+static void uring_reader(void)
+{
+	uint64_t user_data = 0;
+	struct uring ring;
+	const char *buf;
+	int len, ret;
+
+	if (uring_init(&ring, 64, 64 * 1024) ||
+	    uring_add_reads(&ring, &notify_fd, &user_data, 1)) {
+		perror("io_uring");
+		exit(1);
+	}
+	for (;;) {
+		ret = uring_wait(&ring, 100);
+		reader_syscalls = ring.stats.enters;
+		if (ret < 0) {
+			perror("io_uring_enter");
+			exit(1);
+		}
+		if (!ret) {
+			if (gens_done)
+				break;
+			continue;
+		}
+		while (uring_next(&ring, &user_data, &buf, &len)) {
+			if (len < 0 && len != -EAGAIN) {
+				errno = -len;
+				perror("read");
+				exit(1);
+			}
+			if (len > 0)
+				read_inotify(buf, len);
+		}
+	}
+	uring_destroy(&ring);
+}
+
+static void poll_reader(void)
+{
+	char buf[64 * 1024] __attribute__ ((aligned (8)));
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = notify_fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		ret = poll(&pfd, 1, 100);
+		reader_syscalls++;
+		if (ret <= 0) {
+			/* the generators are done and the queue has gone quiet */
+			if (gens_done)
+				break;
+			continue;
+		}
+		ret = read(notify_fd, buf, sizeof(buf));
+		reader_syscalls++;
+		if (ret <= 0)
+			continue;
+
+		if (backend == BACKEND_FANOTIFY)
+			read_fanotify(buf, ret);
+		else
+			read_inotify(buf, ret);
+	}
+}
+
+static void *__reader(void *arg __attribute__ ((unused)))
+{
+	struct timespec cpu0, cpu1;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+	if (backend == BACKEND_INOTIFY_URING)
+		uring_reader();
+	else
+		poll_reader();
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+	reader_cpu_ns = (cpu1.tv_sec - cpu0.tv_sec) * 1000000000ull + cpu1.tv_nsec - cpu0.tv_nsec;
+	return NULL;
+}
+
+/*
+ * set up the reader's fd and its one watch or mark on dir.  The fanotify
+ * group reports the parent's fid and the entry name, so nothing is opened
+ * per event and the names can be matched just like inotify's.
+ */
+static int backend_init(void)
+{
+	unsigned int flags = FAN_MARK_ADD;
+	uint64_t mask = FAN_READER_MASK;
+
+	if (backend != BACKEND_FANOTIFY) {
+		/* io_uring needs it non-blocking, see uring.h */
+		notify_fd = inotify_init1(O_CLOEXEC | (backend == BACKEND_INOTIFY_URING ? IN_NONBLOCK : 0));
+		if (notify_fd < 0) {
+			perror("inotify_init1");
+			return -1;
+		}
+		if (inotify_add_watch(notify_fd, dir, READER_MASK) < 0) {
+			perror("inotify_add_watch");
+			return -1;
+		}
+		return 0;
+	}
+
+	notify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_DFID_NAME, O_RDONLY);
+	if (notify_fd < 0) {
+		perror("fanotify_init");
+		return -1;
+	}
+	switch (mark) {
+	case MARK_INODE:
+		mask |= FAN_EVENT_ON_CHILD;
+		break;
+	case MARK_MOUNT:
+		/* only the events that come with a path can be filtered by mount */
+		flags |= FAN_MARK_MOUNT;
+		mask = FAN_MODIFY;
+		observed_ops = 1 << OP_WRITE;
+		break;
+	case MARK_FILESYSTEM:
+		flags |= FAN_MARK_FILESYSTEM;
+		break;
+	default:
+		break;
+	}
+	if (fanotify_mark(notify_fd, flags, mask, AT_FDCWD, dir)) {
+		perror("fanotify_mark");
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned long total_ops(void)
+{
+	unsigned long total = 0;
+	unsigned int i, op;
+
+	for (i = 0; i < num_threads; i++)
+		for (op = 0; op < NR_OPS; op++)
+			total += gens[i].stats.ops[op];
+	return total;
+}
+
+/* create=20,write=40,... any op left out gets a weight of 0 */
+static int parse_mix(const char *arg)
+{
+	char *copy = strdup(arg), *tok, *save = NULL;
+	unsigned int i;
+
+	if (!copy)
+		return -1;
+	memset(mix, 0, sizeof(mix));
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(tok, '=');
+
+		if (eq)
+			*eq = '\0';
+		for (i = 0; i < NR_OPS; i++)
+			if (!strcmp(tok, op_names[i]))
+				break;
+		if (i == NR_OPS) {
+			fprintf(stderr, "unknown op %s\n", tok);
+			free(copy);
+			return -1;
+		}
+		mix[i] = eq ? strtoul(eq + 1, NULL, 0) : 1;
+	}
+	free(copy);
+	return 0;
+}
+
+/* remove whatever the generators left behind */
+static void cleanup(void)
+{
+	char path[PATH_MAX];
+	unsigned int i, j;
+
+	for (i = 0; i < num_threads; i++) {
+		for (j = 0; j < num_slots; j++) {
+			struct slot *s = &gens[i].slots[j];
+
+			slot_name(path, sizeof(path), i, j, s->seq);
+			if (s->state == SLOT_DIR)
+				rmdir(path);
+			else if (s->state == SLOT_FILE)
+				unlink(path);
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [--dir DIR] [--threads N] [--files SLOTS] [--rate OPS/S]\n"
+		"\t[--mix create=W,write=W,attrib=W,rename=W,unlink=W,mkdir=W]\n"
+		"\t[--backend inotify|inotify-uring|fanotify] [--mark inode|mount|filesystem]\n"
+		"\t[--duration SECS] [--ops OPS] [--warmup SECS] [--seed N] [--json PATH]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"dir",		required_argument,	0, 'd'},
+		{"threads",	required_argument,	0, 't'},
+		{"files",	required_argument,	0, 'f'},
+		{"rate",	required_argument,	0, 'r'},
+		{"mix",		required_argument,	0, 'm'},
+		{"backend",	required_argument,	0, 'b'},
+		{"mark",	required_argument,	0, 'M'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct gen_stats total;
+	pthread_t *threads, reader;
+	uint64_t start, setup_start, setup_ns;
+	long slab_base, slab_setup, slab_peak;
+	double secs;
+	struct json j;
+	unsigned int i, op, n;
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "d:t:f:r:m:b:M:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 't':
+			num_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			num_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtod(optarg, NULL);
+			break;
+		case 'm':
+			if (parse_mix(optarg))
+				usage(argv[0]);
+			break;
+		case 'b':
+			for (backend = 0; backend < NR_BACKENDS; backend++)
+				if (!strcmp(optarg, backend_names[backend]))
+					break;
+			if (backend == NR_BACKENDS)
+				usage(argv[0]);
+			break;
+		case 'M':
+			for (mark = 0; mark < NR_MARKS; mark++)
+				if (!strcmp(optarg, mark_names[mark]))
+					break;
+			if (mark == NR_MARKS)
+				usage(argv[0]);
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg))
+				usage(argv[0]);
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_ALL))
+		return 1;
+	if (!bench.duration && !bench.ops)
+		bench.duration = 5;
+	for (mix_total = 0, op = 0; op < NR_OPS; op++)
+		mix_total += mix[op];
+	if (!num_threads || !num_slots || !mix_total)
+		usage(argv[0]);
+
+	if (mkdir(dir, S_IRWXU) && errno != EEXIST) {
+		perror(dir);
+		return 1;
+	}
+	slab_base = memacct_slab_kb();
+	setup_start = now_ns();
+	if (backend_init())
+		return 1;
+	setup_ns = now_ns() - setup_start;
+	slab_setup = slab_peak = memacct_slab_kb();
+
+	op_lat = calloc(NR_OPS, sizeof(*op_lat));
+	all_lat = calloc(1, sizeof(*all_lat));
+	gens = aligned_alloc(64, num_threads * sizeof(*gens));
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!op_lat || !all_lat || !gens || !threads) {
+		perror("allocating generators");
+		return 1;
+	}
+	memset(gens, 0, num_threads * sizeof(*gens));
+	for (i = 0; i < num_threads; i++) {
+		gens[i].id = i;
+		gens[i].rng = bench.seed + i;
+		gens[i].slots = calloc(num_slots, sizeof(*gens[i].slots));
+		if (!gens[i].slots) {
+			perror("allocating slots");
+			return 1;
+		}
+	}
+
+	if (pthread_create(&reader, NULL, __reader, NULL)) {
+		perror("creating the reader");
+		return 1;
+	}
+	/* with no warmup every op is measured, from the first */
+	start = now_ns();
+	if (bench.warmup <= 0) {
+		measure_start = start;
+		measuring = 1;
+	}
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, __generator, &gens[i])) {
+			perror("creating generators");
+			return 1;
+		}
+	}
+
+	if (!measuring) {
+		while (now_ns() - start < bench.warmup * 1e9)
+			usleep(10000);
+		measure_start = now_ns();
+		measuring = 1;
+	}
+	for (n = 0; !stopped; n++) {
+		usleep(1000);
+		/* the queued events are kernel memory too */
+		if (!(n % 100)) {
+			long kb = memacct_slab_kb();
+
+			if (kb > slab_peak)
+				slab_peak = kb;
+		}
+		if (bench.duration && now_ns() - measure_start >= bench.duration * 1e9)
+			stopped = 1;
+		if (bench.ops && issued >= bench.ops)
+			stopped = 1;
+	}
+	secs = (now_ns() - measure_start) / 1e9;
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	gens_done = 1;
+	pthread_join(reader, NULL);
+	cleanup();
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < num_threads; i++) {
+		for (op = 0; op < NR_OPS; op++)
+			total.ops[op] += gens[i].stats.ops[op];
+		total.errors += gens[i].stats.errors;
+		total.late += gens[i].stats.late;
+		total.untimed += gens[i].stats.untimed;
+	}
+
+	printf("%lu ops in %.2fs (%.0f ops/s, target %.0f), %lu late, %lu errors\n",
+	       total_ops(), secs, total_ops() / secs, rate, total.late, total.errors);
+	printf("%lu events, %lu timed, %lu ops merged, %lu unmatched, %lu foreign, %lu overflows, "
+	       "%lu ops untimed\n", events, matched, merged, unmatched, foreign, overflows, total.untimed);
+	for (op = 0; op < NR_OPS; op++) {
+		char label[32];
+
+		if (!op_lat[op].count)
+			continue;
+		snprintf(label, sizeof(label), "%-6s (%lu ops)", op_names[op], total.ops[op]);
+		hist_print(stdout, label, &op_lat[op]);
+	}
+	hist_print(stdout, "all", all_lat);
+	printf("%s%s%s reader: %.0f events/s, %.3f syscalls and %.0f ns cpu per event, %.1f us setting up, "
+	       "slab +%ld kB (peak +%ld kB)\n",
+	       backend_names[backend], backend == BACKEND_FANOTIFY ? " " : "",
+	       backend == BACKEND_FANOTIFY ? mark_names[mark] : "", events / secs,
+	       events ? (double)reader_syscalls / events : 0.0,
+	       events ? (double)reader_cpu_ns / events : 0.0, setup_ns / 1e3,
+	       slab_setup - slab_base, slab_peak - slab_base);
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "loadgen", &bench);
+	json_object_begin(&j, "config");
+	json_uint(&j, "threads", num_threads);
+	json_uint(&j, "files", num_slots);
+	json_double(&j, "rate", rate);
+	json_string(&j, "backend", backend_names[backend]);
+	if (backend == BACKEND_FANOTIFY)
+		json_string(&j, "mark", mark_names[mark]);
+	json_object_begin(&j, "mix");
+	for (op = 0; op < NR_OPS; op++)
+		json_uint(&j, op_names[op], mix[op]);
+	json_object_end(&j);
+	json_object_end(&j);
+	json_double(&j, "elapsed", secs);
+	json_uint(&j, "ops", total_ops());
+	json_double(&j, "ops_per_sec", total_ops() / secs);
+	json_uint(&j, "late", total.late);
+	json_uint(&j, "errors", total.errors);
+	json_uint(&j, "events", events);
+	json_uint(&j, "matched", matched);
+	json_uint(&j, "merged_ops", merged);
+	json_uint(&j, "unmatched", unmatched);
+	json_uint(&j, "untimed_ops", total.untimed);
+	json_uint(&j, "foreign", foreign);
+	json_uint(&j, "overflows", overflows);
+	json_object_begin(&j, "reader");
+	json_double(&j, "events_per_sec", events / secs);
+	json_uint(&j, "syscalls", reader_syscalls);
+	json_double(&j, "syscalls_per_event", events ? (double)reader_syscalls / events : 0.0);
+	json_uint(&j, "cpu_ns", reader_cpu_ns);
+	json_double(&j, "cpu_ns_per_event", events ? (double)reader_cpu_ns / events : 0.0);
+	json_uint(&j, "setup_ns", setup_ns);
+	json_int(&j, "slab_setup_kb", slab_setup - slab_base);
+	json_int(&j, "slab_peak_kb", slab_peak - slab_base);
+	json_object_end(&j);
+	json_object_begin(&j, "ops_by_type");
+	for (op = 0; op < NR_OPS; op++)
+		json_uint(&j, op_names[op], total.ops[op]);
+	json_object_end(&j);
+	json_object_begin(&j, "latency");
+	for (op = 0; op < NR_OPS; op++)
+		if (op_lat[op].count)
+			json_hist(&j, op_names[op], &op_lat[op]);
+	json_hist(&j, "all", all_lat);
+	json_object_end(&j);
+	json_close(&j);
+
+	rmdir(dir);
+	return 0;
+}
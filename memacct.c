@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memacct.h"
+
+/* older kernels called the inotify mark cache fsnotify_mark */
+static const char *mark_caches[] = { "inotify_inode_mark", "fsnotify_mark", NULL };
+static const char *connector_caches[] = { "fsnotify_mark_connector", NULL };
+
+static const char *source = "none";
+
+static int slabinfo_cache(const char **names, struct memacct_cache *c)
+{
+	char line[512], name[64];
+	long active, total, size;
+	FILE *f;
+	int i, found = 0;
+
+	f = fopen("/proc/slabinfo", "r");
+	if (!f)
+		return -1;
+	while (!found && fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %ld %ld %ld", name, &active, &total, &size) != 4)
+			continue;
+		for (i = 0; names[i]; i++) {
+			if (strcmp(name, names[i]))
+				continue;
+			c->objs = active;
+			c->obj_size = size;
+			found = 1;
+			break;
+		}
+	}
+	fclose(f);
+	return found ? 0 : -1;
+}
+
+static long sysfs_long(const char *cache, const char *file)
+{
+	char path[256];
+	long val = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/kernel/slab/%s/%s", cache, file);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	/* "objects" is followed by a per node breakdown */
+	if (fscanf(f, "%ld", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static int sysfs_cache(const char **names, struct memacct_cache *c)
+{
+	int i;
+
+	for (i = 0; names[i]; i++) {
+		c->objs = sysfs_long(names[i], "objects");
+		c->obj_size = sysfs_long(names[i], "object_size");
+		if (c->objs >= 0 && c->obj_size >= 0)
+			return 0;
+	}
+	return -1;
+}
+
+/* returns where the numbers came from */
+static const char *sample_cache(const char **names, struct memacct_cache *c)
+{
+	if (!slabinfo_cache(names, c))
+		return "slabinfo";
+	if (!sysfs_cache(names, c))
+		return "sysfs";
+	c->objs = c->obj_size = -1;
+	return "none";
+}
+
+/* the first "<key> N kB" line of a /proc file */
+static long proc_kb(const char *path, const char *key)
+{
+	size_t len = strlen(key);
+	char line[256];
+	long kb = -1;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, key, len) && sscanf(line + len, "%ld", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb;
+}
+
+long memacct_slab_kb(void)
+{
+	return proc_kb("/proc/meminfo", "Slab:");
+}
+
+/* big allocations are mmap()ed and only show up in hblkhd */
+long memacct_heap_bytes(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+}
+
+void memacct_sample(struct memacct *m)
+{
+	source = sample_cache(mark_caches, &m->mark);
+	sample_cache(connector_caches, &m->connector);
+	m->slab_kb = memacct_slab_kb();
+	m->rss_kb = proc_kb("/proc/self/status", "VmRSS:");
+	m->data_kb = proc_kb("/proc/self/status", "VmData:");
+	m->heap_bytes = memacct_heap_bytes();
+}
+
+const char *memacct_source(void)
+{
+	return source;
+}
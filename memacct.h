@@ -0,0 +1,57 @@
+#ifndef __MEMACCT_H
+#define __MEMACCT_H
+
+#include <stddef.h>
+
+/*
+ * what watches cost in memory, from everywhere we can see it.  In the
+ * kernel each inode watch is an inotify_inode_mark plus, per watched inode,
+ * an fsnotify_mark_connector.  Both are counted from /proc/slabinfo when it
+ * is readable, else from /sys/kernel/slab (which still works when SLUB has
+ * merged the cache with others of the same size, but then counts theirs
+ * too).  Slab from /proc/meminfo catches the rest, like the idr nodes behind
+ * the wds and the queued events, which are plain kmalloc()s.  For this
+ * process there is VmRSS and VmData from /proc/self/status and what malloc
+ * has handed out (mallinfo2).
+ *
+ * Anything which couldn't be read is -1.  Samples are only worth comparing
+ * with each other, so take one before adding watches and subtract.
+ */
+struct memacct_cache {
+	long objs;
+	long obj_size;
+};
+
+struct memacct {
+	struct memacct_cache mark;
+	struct memacct_cache connector;
+	/* kB */
+	long slab_kb;
+	long rss_kb;
+	long data_kb;
+	long heap_bytes;
+};
+
+void memacct_sample(struct memacct *m);
+/* just the system wide Slab line of /proc/meminfo, cheap enough to sample often */
+long memacct_slab_kb(void);
+/* just what malloc has handed out, the heap_bytes of a sample */
+long memacct_heap_bytes(void);
+/* where the mark counts come from: "slabinfo", "sysfs" or "none" */
+const char *memacct_source(void);
+
+/* bytes of the cache in use, -1 if it couldn't be read */
+static inline long memacct_cache_bytes(const struct memacct_cache *c)
+{
+	return c->objs < 0 ? -1 : c->objs * c->obj_size;
+}
+
+/* bytes each of n things cost going from a to b, for a pair of -1 aware values */
+static inline double memacct_per(long a, long b, double scale, unsigned long n)
+{
+	if (a < 0 || b < 0 || !n)
+		return -1;
+	return (b - a) * scale / n;
+}
+
+#endif /* __MEMACCT_H */
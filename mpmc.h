@@ -0,0 +1,105 @@
+#ifndef __MPMC_H
+#define __MPMC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * bounded lock-free multi producer multi consumer queue of uintptr_t's
+ * (Vyukov's sequence numbered ring).  Every cell carries a sequence number
+ * which tells producers and consumers whose turn it is, so the only shared
+ * writes are one CAS on head or tail per operation.
+ */
+#define MPMC_CACHELINE 64
+
+struct mpmc_cell {
+	uint64_t seq;
+	uintptr_t val;
+};
+
+struct mpmc_queue {
+	struct mpmc_cell *cells;
+	uint64_t mask;
+	uint64_t head __attribute__ ((aligned (MPMC_CACHELINE)));
+	uint64_t tail __attribute__ ((aligned (MPMC_CACHELINE)));
+} __attribute__ ((aligned (MPMC_CACHELINE)));
+
+/* size must be a power of 2 */
+static inline int mpmc_init(struct mpmc_queue *q, uint64_t size)
+{
+	uint64_t i;
+
+	if (!size || (size & (size - 1)))
+		return -1;
+	q->cells = calloc(size, sizeof(*q->cells));
+	if (!q->cells)
+		return -1;
+	for (i = 0; i < size; i++)
+		q->cells[i].seq = i;
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+	return 0;
+}
+
+static inline void mpmc_destroy(struct mpmc_queue *q)
+{
+	free(q->cells);
+	q->cells = NULL;
+}
+
+/* returns 0 on success, -1 if the queue is full */
+static inline int mpmc_push(struct mpmc_queue *q, uintptr_t val)
+{
+	struct mpmc_cell *cell;
+	uint64_t pos, seq;
+	int64_t diff;
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (int64_t)seq - (int64_t)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+	cell->val = val;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* returns 0 on success, -1 if the queue is empty */
+static inline int mpmc_pop(struct mpmc_queue *q, uintptr_t *val)
+{
+	struct mpmc_cell *cell;
+	uint64_t pos, seq;
+	int64_t diff;
+
+	pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (int64_t)seq - (int64_t)(pos + 1);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	*val = cell->val;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+#endif /* __MPMC_H */
@@ -0,0 +1,300 @@
+/*
+ * how fast does a consumer have to drain to keep up?  A generator thread
+ * writes to a handful of files at a fixed rate, producing IN_MODIFY events
+ * (round robin, so the kernel can't merge them with the one queued before),
+ * while the reader spends a fixed amount of time on every event it reads.
+ * Each step of the sweep makes the reader slower, until the queue hits
+ * fs.inotify.max_queued_events and overflows.  Reports what was lost, when
+ * the first overflow happened, and how deep the queue got.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "evbatch.h"
+
+#define MAX_FILES	64
+/* every event has a name like "f00", padded to 16 by the kernel */
+#define RECORD_SIZE	(sizeof(struct inotify_event) + 16)
+
+static struct bench_opts bench;
+static unsigned long rate = 100000;
+static long fixed_cost = -1;
+static unsigned int num_files = 16;
+static char dir[] = "/tmp/overflow_bench.XXXXXX";
+static unsigned long max_queued;
+
+struct step {
+	/* reader time per event, ns */
+	unsigned long cost;
+	unsigned long generated;
+	unsigned long received;
+	unsigned long overflows;
+	unsigned long max_depth;
+	double first_overflow;
+	double elapsed;
+};
+
+static volatile int gen_done;
+static unsigned long generated;
+
+static void *__generator(void *arg __attribute__ ((unused)))
+{
+	struct timespec tick = { 0, 1000000 };
+	int fds[MAX_FILES];
+	char path[PATH_MAX];
+	uint64_t start, now;
+	unsigned int i, f = 0;
+
+	for (i = 0; i < num_files; i++) {
+		snprintf(path, sizeof(path), "%s/f%02u", dir, i);
+		fds[i] = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+		if (fds[i] < 0) {
+			perror(path);
+			exit(1);
+		}
+	}
+
+	/* catch up to rate every millisecond, sleeping in between */
+	start = now_ns();
+	while ((now = now_ns()) - start < bench.duration * 1e9) {
+		unsigned long due = (now - start) / 1e9 * rate;
+
+		while (generated < due) {
+			if (pwrite(fds[f], "x", 1, 0) < 0)
+				perror("pwrite");
+			f = (f + 1) % num_files;
+			generated++;
+		}
+		nanosleep(&tick, NULL);
+	}
+
+	for (i = 0; i < num_files; i++)
+		close(fds[i]);
+	gen_done = 1;
+	return NULL;
+}
+
+/* pretend to do cost ns of work on an event */
+static void consume(unsigned long cost)
+{
+	uint64_t until;
+
+	if (!cost)
+		return;
+	until = now_ns() + cost;
+	while (now_ns() < until)
+		;
+}
+
+static void run_step(struct step *st)
+{
+	static struct ev_batch batch;
+	char buf[64 * 1024];
+	struct pollfd pfd;
+	pthread_t gen;
+	uint64_t start;
+	unsigned int n;
+	int fd, ret, queued;
+
+	fd = inotify_init1(O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		perror("inotify_init1");
+		exit(1);
+	}
+	if (inotify_add_watch(fd, dir, IN_MODIFY) < 0) {
+		perror("inotify_add_watch");
+		exit(1);
+	}
+
+	gen_done = 0;
+	generated = 0;
+	start = now_ns();
+	if (pthread_create(&gen, NULL, __generator, NULL)) {
+		perror("creating the generator");
+		exit(1);
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		ret = poll(&pfd, 1, 10);
+		if (ret <= 0) {
+			if (gen_done)
+				break;
+			continue;
+		}
+		queued = ev_queued_bytes(fd);
+		if (queued > 0 && (unsigned long)queued / RECORD_SIZE > st->max_depth)
+			st->max_depth = queued / RECORD_SIZE;
+
+		ret = read(fd, buf, sizeof(buf));
+		if (ret <= 0)
+			continue;
+		for (size_t pos = 0; pos < (size_t)ret; ) {
+			pos += ev_batch_decode(&batch, buf + pos, ret - pos);
+			for (n = 0; n < batch.count; n++) {
+				if (batch.mask[n] & IN_Q_OVERFLOW) {
+					if (!st->overflows++)
+						st->first_overflow = (now_ns() - start) / 1e9;
+					continue;
+				}
+				st->received++;
+				consume(st->cost);
+			}
+		}
+	}
+	st->elapsed = (now_ns() - start) / 1e9;
+	pthread_join(gen, NULL);
+	st->generated = generated;
+	close(fd);
+}
+
+static void print_step(const struct step *st)
+{
+	unsigned long lost = st->generated - st->received;
+
+	printf("cost %7luns", st->cost);
+	if (st->cost)
+		printf(" (drain <= %9.0f/s)", 1e9 / st->cost);
+	else
+		printf(" (no cost)          ");
+	printf(": generated %lu received %lu lost %lu (%.1f%%) overflows %lu", st->generated,
+	       st->received, lost, st->generated ? 100.0 * lost / st->generated : 0.0,
+	       st->overflows);
+	if (st->overflows)
+		printf(" first at %.3fs", st->first_overflow);
+	printf(" max depth %lu\n", st->max_depth);
+}
+
+static void json_step(struct json *j, const struct step *st)
+{
+	json_object_begin(j, NULL);
+	json_uint(j, "cost_ns", st->cost);
+	json_double(j, "drain_capacity", st->cost ? 1e9 / st->cost : 0.0);
+	json_uint(j, "generated", st->generated);
+	json_uint(j, "received", st->received);
+	json_uint(j, "lost", st->generated - st->received);
+	json_uint(j, "overflows", st->overflows);
+	json_double(j, "first_overflow", st->first_overflow);
+	json_uint(j, "max_depth", st->max_depth);
+	json_double(j, "elapsed", st->elapsed);
+	/* how long the queue should last if the reader is slower than the writer */
+	if (st->cost && 1e9 / st->cost < rate)
+		json_double(j, "predicted_overflow", max_queued / (rate - 1e9 / st->cost));
+	json_object_end(j);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"rate",	required_argument,	0, 'r'},
+		{"cost",	required_argument,	0, 'c'},
+		{"files",	required_argument,	0, 'f'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct step steps[32];
+	unsigned int i, num_steps = 0;
+	long last_ok = -1;
+	struct json j;
+	char path[PATH_MAX];
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "r:c:f:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			fixed_cost = strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			num_files = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+				fprintf(stderr, "usage: %s [--rate EVENTS/S] [--cost NS] [--files N] "
+					"[--duration SECS] [--json PATH]\n", argv[0]);
+				return 1;
+			}
+		}
+	}
+	/* a fixed rate for a fixed time: nothing is random and nothing warms up */
+	if (bench_opts_done(&bench, BENCH_DURATION))
+		return 1;
+	if (!bench.duration)
+		bench.duration = 2;
+	if (num_files < 2 || num_files > MAX_FILES) {
+		fprintf(stderr, "--files must be between 2 and %d\n", MAX_FILES);
+		return 1;
+	}
+	if (!rate)
+		rate = 1;
+
+	max_queued = inotify_limit("max_queued_events");
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	printf("%lu events/s for %.1fs per step, max_queued_events=%lu\n",
+	       rate, bench.duration, max_queued);
+
+	/*
+	 * without --cost start with a free reader and double the cost until
+	 * the reader is a quarter of the generator's speed, past where it
+	 * has to overflow
+	 */
+	for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		struct step *st = &steps[num_steps++];
+
+		memset(st, 0, sizeof(*st));
+		if (fixed_cost >= 0)
+			st->cost = fixed_cost;
+		else
+			st->cost = i ? 250ul << (i - 1) : 0;
+		run_step(st);
+		print_step(st);
+		if (st->generated == st->received)
+			last_ok = st->cost;
+		if (fixed_cost >= 0 || (st->cost && 1e9 / st->cost < rate / 4.0))
+			break;
+	}
+	if (last_ok > 0)
+		printf("slowest reader with no loss: %ldns/event, %.0f events/s\n",
+		       last_ok, 1e9 / last_ok);
+
+	for (i = 0; i < num_files; i++) {
+		snprintf(path, sizeof(path), "%s/f%02u", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "overflow_bench", &bench);
+	json_uint(&j, "rate", rate);
+	json_uint(&j, "files", num_files);
+	json_uint(&j, "max_queued_events", max_queued);
+	json_int(&j, "slowest_ok_cost_ns", last_ok);
+	json_array_begin(&j, "steps");
+	for (i = 0; i < num_steps; i++)
+		json_step(&j, &steps[i]);
+	json_array_end(&j);
+	json_close(&j);
+
+	return 0;
+}
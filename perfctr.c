@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} counters[PERF_NR_COUNTERS] = {
+	[PERF_TASK_CLOCK]	= { "task_clock_ns",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_TASK_CLOCK },
+	[PERF_CONTEXT_SWITCHES]	= { "context_switches",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_CPU_MIGRATIONS]	= { "cpu_migrations",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_CPU_MIGRATIONS },
+	[PERF_CYCLES]		= { "cycles",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS]	= { "instructions",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CACHE_MISSES]	= { "cache_misses",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CACHE_MISSES },
+};
+
+/* what each read() of a counter fd returns with our read_format */
+struct perf_read {
+	uint64_t value;
+	uint64_t time_enabled;
+	uint64_t time_running;
+};
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+			   int group_fd, unsigned long flags)
+{
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+unsigned int perf_counters_open(struct perf_counters *p)
+{
+	struct perf_event_attr attr;
+	unsigned int i, valid = 0;
+
+	p->user_only = 0;
+	for (i = 0; i < PERF_NR_COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counters[i].type;
+		attr.config = counters[i].config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		/* user and kernel, the syscalls are the interesting part */
+		attr.exclude_hv = 1;
+
+		/* this thread only, on any cpu */
+		p->fd[i] = perf_event_open(&attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		/* perf_event_paranoid >= 2 only lets the unprivileged count user space */
+		if (p->fd[i] < 0 && (errno == EACCES || errno == EPERM)) {
+			attr.exclude_kernel = 1;
+			p->fd[i] = perf_event_open(&attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+			if (p->fd[i] >= 0)
+				p->user_only |= 1u << i;
+		}
+		if (p->fd[i] >= 0)
+			valid |= 1u << i;
+	}
+	return valid;
+}
+
+void perf_counters_read(const struct perf_counters *p, struct perf_values *v)
+{
+	struct perf_read r;
+	unsigned int i;
+
+	memset(v, 0, sizeof(*v));
+	for (i = 0; i < PERF_NR_COUNTERS; i++) {
+		if (p->fd[i] < 0 || read(p->fd[i], &r, sizeof(r)) != sizeof(r))
+			continue;
+		/* multiplexed with other events, scale up to the whole time */
+		if (r.time_running && r.time_running < r.time_enabled)
+			r.value = (double)r.value * r.time_enabled / r.time_running;
+		v->val[i] = r.value;
+		v->valid |= 1u << i;
+	}
+}
+
+void perf_counters_close(struct perf_counters *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < PERF_NR_COUNTERS; i++) {
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+}
+
+void perf_values_subtract(struct perf_values *dst, const struct perf_values *src)
+{
+	unsigned int i;
+
+	dst->valid &= src->valid;
+	for (i = 0; i < PERF_NR_COUNTERS; i++)
+		dst->val[i] -= src->val[i];
+}
+
+/* every thread in a process sees the same PMU, so valid bits just accumulate */
+void perf_values_add(struct perf_values *dst, const struct perf_values *src)
+{
+	unsigned int i;
+
+	dst->valid |= src->valid;
+	for (i = 0; i < PERF_NR_COUNTERS; i++)
+		dst->val[i] += src->val[i];
+}
+
+const char *perf_counter_name(enum perf_counter c)
+{
+	return counters[c].name;
+}
@@ -0,0 +1,50 @@
+#ifndef __PERFCTR_H
+#define __PERFCTR_H
+
+#include <stdint.h>
+
+/*
+ * per thread perf_event_open counters.  Each counter is opened on its own
+ * rather than as a group, so a PMU which can't do one of the hardware
+ * events (or a VM with no PMU at all) still gets the software ones.  The
+ * fds can be read from any thread, and still hold the final counts after
+ * the thread has exited.
+ */
+enum perf_counter {
+	PERF_TASK_CLOCK,
+	PERF_CONTEXT_SWITCHES,
+	PERF_CPU_MIGRATIONS,
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_NR_COUNTERS,
+};
+
+struct perf_counters {
+	/* -1 for counters which couldn't be opened */
+	int fd[PERF_NR_COUNTERS];
+	/*
+	 * bit n set if counter n only counts user space, because
+	 * perf_event_paranoid wouldn't let us see the kernel
+	 */
+	unsigned int user_only;
+};
+
+struct perf_values {
+	/* scaled up if the counter was multiplexed */
+	uint64_t val[PERF_NR_COUNTERS];
+	/* bit n set if val[n] means something */
+	unsigned int valid;
+};
+
+/* open every counter for the calling thread, returns the valid bits */
+unsigned int perf_counters_open(struct perf_counters *p);
+void perf_counters_read(const struct perf_counters *p, struct perf_values *v);
+void perf_counters_close(struct perf_counters *p);
+/* dst -= src, for counters valid in both */
+void perf_values_subtract(struct perf_values *dst, const struct perf_values *src);
+/* dst += src */
+void perf_values_add(struct perf_values *dst, const struct perf_values *src);
+const char *perf_counter_name(enum perf_counter c);
+
+#endif /* __PERFCTR_H */
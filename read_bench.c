@@ -0,0 +1,313 @@
+/*
+ * how many syscalls does it take to empty an inotify queue, and how fast?
+ * Each round queues a fixed number of IN_MODIFY events (writes to 64 files
+ * round robin, so the kernel can't merge one with the one queued before it)
+ * and then times emptying the queue with each read strategy:
+ *
+ *   fixed N	read() into an N byte buffer until EAGAIN, like an edge
+ *		triggered reader that can't tell it is done until it is told
+ *   adaptive	an ev_reader, reads sized from the last one and FIONREAD,
+ *		stopping once a read had room to spare
+ *   struct	one struct inotify_event per read(), like the oneshot and
+ *		unlink tests; only with --no-names since a name won't fit
+ *
+ * Syscalls are reads plus FIONREAD ioctls.  The writes which fill the queue
+ * are not timed.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "evbatch.h"
+
+#define NUM_FILES	64
+#define MAX_DEPTHS	16
+
+enum strategy {
+	STRAT_FIXED_4K,
+	STRAT_FIXED_8K,
+	STRAT_FIXED_64K,
+	STRAT_ADAPTIVE,
+	STRAT_STRUCT,
+	NUM_STRATS,
+};
+
+static const char *strat_names[NUM_STRATS] = {
+	[STRAT_FIXED_4K]	= "fixed-4096",
+	[STRAT_FIXED_8K]	= "fixed-8192",
+	[STRAT_FIXED_64K]	= "fixed-65536",
+	[STRAT_ADAPTIVE]	= "adaptive",
+	[STRAT_STRUCT]		= "struct",
+};
+
+static const size_t strat_sizes[NUM_STRATS] = {
+	[STRAT_FIXED_4K]	= 4096,
+	[STRAT_FIXED_8K]	= 8192,
+	[STRAT_FIXED_64K]	= 65536,
+	[STRAT_STRUCT]		= sizeof(struct inotify_event),
+};
+
+struct cell {
+	unsigned long depth;
+	enum strategy strat;
+	unsigned long rounds;
+	unsigned long events;
+	unsigned long reads;
+	unsigned long queries;
+	/* rounds which didn't read back exactly what was queued */
+	unsigned long short_rounds;
+	uint64_t ns;
+};
+
+static struct bench_opts bench;
+static char dir[] = "/tmp/read_bench.XXXXXX";
+static int no_names;
+static int fds[NUM_FILES];
+static unsigned int next_file;
+static size_t record_size;
+
+static int setup_watches(int inotify_fd)
+{
+	char path[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < NUM_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/f%02u", dir, i);
+		fds[i] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fds[i] < 0) {
+			perror(path);
+			return -1;
+		}
+		/* a watch per file reports no name, so every record is a bare struct */
+		if (no_names && inotify_add_watch(inotify_fd, path, IN_MODIFY) < 0) {
+			perror("inotify_add_watch");
+			return -1;
+		}
+	}
+	if (!no_names && inotify_add_watch(inotify_fd, dir, IN_MODIFY) < 0) {
+		perror("inotify_add_watch");
+		return -1;
+	}
+	/* "fNN" padded to 16 by the kernel */
+	record_size = sizeof(struct inotify_event) + (no_names ? 0 : 16);
+	return 0;
+}
+
+static void fill_queue(unsigned long depth)
+{
+	unsigned long i;
+
+	for (i = 0; i < depth; i++) {
+		if (pwrite(fds[next_file], "x", 1, 0) != 1) {
+			perror("pwrite");
+			exit(1);
+		}
+		next_file = (next_file + 1) % NUM_FILES;
+	}
+}
+
+/* empty the queue, returns the bytes read */
+static size_t drain(int inotify_fd, struct ev_reader *rd, enum strategy strat)
+{
+	size_t bytes = 0;
+	ssize_t ret;
+
+	for (;;) {
+		ret = ev_reader_read(rd, inotify_fd);
+		if (ret > 0)
+			bytes += ret;
+		if (ret <= 0 || (strat == STRAT_ADAPTIVE && !rd->more))
+			break;
+	}
+	if (ret < 0 && errno != EAGAIN) {
+		perror("read");
+		exit(1);
+	}
+	return bytes;
+}
+
+static void run_cell(int inotify_fd, struct cell *c)
+{
+	struct ev_reader rd;
+	unsigned long target;
+	size_t bytes;
+	uint64_t start;
+
+	if (ev_reader_init(&rd, strat_sizes[c->strat], strat_sizes[c->strat])) {
+		perror("malloc");
+		exit(1);
+	}
+	/* ev_reader won't go under EV_RECORD_MAX by itself */
+	if (c->strat == STRAT_STRUCT)
+		rd.min = rd.max = rd.want = strat_sizes[c->strat];
+
+	target = bench.ops > c->depth ? bench.ops : c->depth;
+	while (c->events < target) {
+		fill_queue(c->depth);
+		start = now_ns();
+		bytes = drain(inotify_fd, &rd, c->strat);
+		c->ns += now_ns() - start;
+		c->rounds++;
+		c->events += bytes / record_size;
+		if (bytes != c->depth * record_size)
+			c->short_rounds++;
+	}
+	c->reads = rd.reads;
+	c->queries = rd.queries;
+	ev_reader_free(&rd);
+}
+
+static double cell_syscalls(const struct cell *c)
+{
+	return c->events ? (double)(c->reads + c->queries) / c->events : 0.0;
+}
+
+static void json_cell(struct json *j, const struct cell *c)
+{
+	json_object_begin(j, NULL);
+	json_uint(j, "depth", c->depth);
+	json_string(j, "strategy", strat_names[c->strat]);
+	json_uint(j, "rounds", c->rounds);
+	json_uint(j, "events", c->events);
+	json_uint(j, "reads", c->reads);
+	json_uint(j, "fionread", c->queries);
+	json_double(j, "syscalls_per_event", cell_syscalls(c));
+	json_double(j, "ns_per_event", c->events ? (double)c->ns / c->events : 0.0);
+	json_double(j, "events_per_sec", c->ns ? c->events * 1e9 / c->ns : 0.0);
+	json_uint(j, "short_rounds", c->short_rounds);
+	json_object_end(j);
+}
+
+static int parse_depths(const char *arg, unsigned long *depths)
+{
+	char *end;
+	int n = 0;
+
+	while (*arg && n < MAX_DEPTHS) {
+		depths[n] = strtoul(arg, &end, 0);
+		if (end == arg || !depths[n])
+			return -1;
+		n++;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"depths",	required_argument,	0, 'd'},
+		{"no-names",	no_argument,		0, 'N'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	unsigned long depths[MAX_DEPTHS] = { 1, 8, 64, 512, 4096, 16000 };
+	struct cell *cells;
+	unsigned int d, s, num_cells = 0;
+	int num_depths = 6;
+	unsigned long max_queued;
+	char path[PATH_MAX];
+	struct json j;
+	int inotify_fd, c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "d:N", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			num_depths = parse_depths(optarg, depths);
+			if (num_depths <= 0) {
+				fprintf(stderr, "bad --depths %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'N':
+			no_names = 1;
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+				fprintf(stderr, "usage: %s [--depths N,N,...] [--no-names] "
+					"[--ops EVENTS] [--json PATH]\n", argv[0]);
+				return 1;
+			}
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_OPS))
+		return 1;
+	if (!bench.ops)
+		bench.ops = 100000;
+
+	/* a full queue overflows, and the overflow event would throw the counts off */
+	max_queued = inotify_limit("max_queued_events");
+	for (d = 0; max_queued && d < (unsigned int)num_depths; d++)
+		if (depths[d] >= max_queued)
+			depths[d] = max_queued - 1;
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	inotify_fd = inotify_init1(IN_NONBLOCK);
+	if (inotify_fd < 0) {
+		perror("inotify_init1");
+		return 1;
+	}
+	if (setup_watches(inotify_fd))
+		return 1;
+
+	cells = calloc(num_depths * NUM_STRATS, sizeof(*cells));
+	if (!cells) {
+		perror("calloc");
+		return 1;
+	}
+	printf("%zu byte events, %lu per cell, max_queued_events=%lu\n",
+	       record_size, bench.ops, max_queued);
+	printf("%8s %-12s %10s %10s %10s %12s\n", "depth", "strategy", "reads/ev",
+	       "syscall/ev", "ns/event", "events/s");
+	for (d = 0; d < (unsigned int)num_depths; d++) {
+		for (s = 0; s < NUM_STRATS; s++) {
+			struct cell *cl = &cells[num_cells];
+
+			if (s == STRAT_STRUCT && !no_names)
+				continue;
+			num_cells++;
+			cl->depth = depths[d];
+			cl->strat = s;
+			run_cell(inotify_fd, cl);
+			printf("%8lu %-12s %10.4f %10.4f %10.1f %12.0f%s\n", cl->depth,
+			       strat_names[s], (double)cl->reads / cl->events, cell_syscalls(cl),
+			       (double)cl->ns / cl->events, cl->events * 1e9 / cl->ns,
+			       cl->short_rounds ? " (short rounds!)" : "");
+		}
+	}
+
+	close(inotify_fd);
+	for (d = 0; d < NUM_FILES; d++) {
+		close(fds[d]);
+		snprintf(path, sizeof(path), "%s/f%02u", dir, d);
+		unlink(path);
+	}
+	rmdir(dir);
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "read_bench", &bench);
+	json_uint(&j, "record_size", record_size);
+	json_uint(&j, "max_queued_events", max_queued);
+	json_array_begin(&j, "cells");
+	for (d = 0; d < num_cells; d++)
+		json_cell(&j, &cells[d]);
+	json_array_end(&j);
+	json_close(&j);
+	free(cells);
+
+	return 0;
+}
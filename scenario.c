@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "bench.h"
+#include "evbatch.h"
+#include "hist.h"
+#include "scenario.h"
+
+static const char *role_names[] = {
+	[SCENARIO_ADDER]	= "adder",
+	[SCENARIO_REMOVER]	= "remover",
+	[SCENARIO_LOWNUM]	= "lownum",
+	[SCENARIO_CREATER]	= "creater",
+};
+
+static const char *op_names[] = {
+	[SCENARIO_CREATE]	= "create",
+	[SCENARIO_UNLINK]	= "unlink",
+	[SCENARIO_WRITE]	= "write",
+	[SCENARIO_ATTRIB]	= "attrib",
+	[SCENARIO_RENAME]	= "rename",
+	[SCENARIO_OPEN]		= "open",
+};
+
+const char *scenario_role_name(enum scenario_role role)
+{
+	return role_names[role];
+}
+
+const char *scenario_op_name(enum scenario_op op)
+{
+	return op_names[op];
+}
+
+static int parse_duration(const char *str, uint64_t *ns)
+{
+	char *end;
+	double val;
+
+	errno = 0;
+	val = strtod(str, &end);
+	if (errno || end == str || val < 0)
+		return -1;
+	if (!strcmp(end, "ns"))
+		*ns = val;
+	else if (!strcmp(end, "us"))
+		*ns = val * 1e3;
+	else if (!strcmp(end, "ms"))
+		*ns = val * 1e6;
+	else if (!strcmp(end, "s") || !*end)
+		*ns = val * 1e9;
+	else
+		return -1;
+	return 0;
+}
+
+/* NAME=N, with NAME one of names[] */
+static int parse_assignment(char *tok, const char **names, unsigned int nr,
+			    unsigned int *idx, unsigned int *val)
+{
+	char *eq = strchr(tok, '='), *end;
+	unsigned long v;
+
+	if (!eq)
+		return -1;
+	*eq = '\0';
+	for (*idx = 0; *idx < nr; (*idx)++)
+		if (!strcmp(tok, names[*idx]))
+			break;
+	if (*idx == nr)
+		return -1;
+	errno = 0;
+	v = strtoul(eq + 1, &end, 0);
+	if (errno || end == eq + 1 || *end || v > UINT32_MAX)
+		return -1;
+	*val = v;
+	return 0;
+}
+
+/* "modify,attrib", "all" or a number, names as in inotify.h without the IN_ */
+static int parse_mask(char *str, uint32_t *mask)
+{
+	char *tok, *save, *end;
+	unsigned int bit;
+
+	*mask = strtoul(str, &end, 0);
+	if (end != str && !*end)
+		return 0;
+
+	*mask = 0;
+	for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (!strcasecmp(tok, "all")) {
+			*mask |= IN_ALL_EVENTS;
+			continue;
+		}
+		for (bit = 0; bit < 32; bit++) {
+			const char *name = ev_mask_bit_name(bit);
+
+			if (name && !strcasecmp(tok, name + strlen("IN_")))
+				break;
+		}
+		if (bit == 32)
+			return -1;
+		*mask |= 1u << bit;
+	}
+	return 0;
+}
+
+static int parse_line(struct scenario *s, struct scenario_phase *cur, char *line)
+{
+	char *save, *cmd, *tok;
+	unsigned int idx, val;
+
+	cmd = strtok_r(line, " \t", &save);
+	if (!cmd)
+		return 0;
+
+	if (!strcmp(cmd, "phase")) {
+		struct scenario_phase *phases;
+
+		tok = strtok_r(NULL, " \t", &save);
+		if (!tok)
+			return -1;
+		phases = realloc(s->phases, (s->nr + 1) * sizeof(*phases));
+		if (!phases)
+			return -1;
+		s->phases = phases;
+		/* cur still holds the previous phase (or the defaults), which carry over */
+		snprintf(cur->name, sizeof(cur->name), "%s", tok);
+		tok = strtok_r(NULL, " \t", &save);
+		if (!tok || parse_duration(tok, &cur->duration_ns) || !cur->duration_ns)
+			return -1;
+		s->phases[s->nr++] = *cur;
+		return strtok_r(NULL, " \t", &save) ? -1 : 0;
+	}
+
+	/* a mix replaces the one carried over rather than adding to it */
+	if (!strcmp(cmd, "mix"))
+		memset(cur->mix, 0, sizeof(cur->mix));
+	while ((tok = strtok_r(NULL, " \t", &save))) {
+		if (!strcmp(cmd, "threads") || !strcmp(cmd, "rate")) {
+			if (parse_assignment(tok, role_names, NR_SCENARIO_ROLES, &idx, &val))
+				return -1;
+			if (cmd[0] == 't')
+				cur->threads[idx] = val;
+			else
+				cur->rate[idx] = val;
+		} else if (!strcmp(cmd, "mix")) {
+			if (parse_assignment(tok, op_names, NR_SCENARIO_OPS, &idx, &val))
+				return -1;
+			cur->mix[idx] = val;
+		} else if (!strcmp(cmd, "mask")) {
+			if (parse_mask(tok, &cur->mask))
+				return -1;
+		} else if (!strcmp(cmd, "mount")) {
+			if (parse_duration(tok, &cur->mount_ns))
+				return -1;
+		} else if (!strcmp(cmd, "lowwd")) {
+			if (parse_duration(tok, &cur->lowwd_ns))
+				return -1;
+		} else {
+			return -1;
+		}
+	}
+
+	/* settings after a phase line belong to that phase */
+	if (s->nr)
+		s->phases[s->nr - 1] = *cur;
+	return 0;
+}
+
+int scenario_load(struct scenario *s, const char *path, const struct scenario_phase *defaults)
+{
+	struct scenario_phase cur = *defaults;
+	unsigned int i, r, lineno = 0;
+	char *line = NULL, *hash;
+	size_t len = 0;
+	FILE *f;
+
+	memset(s, 0, sizeof(*s));
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (getline(&line, &len, f) > 0) {
+		lineno++;
+		if ((hash = strchr(line, '#')))
+			*hash = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+		if (parse_line(s, &cur, line)) {
+			fprintf(stderr, "%s:%u: can't parse this line\n", path, lineno);
+			goto err;
+		}
+	}
+	if (!s->nr) {
+		fprintf(stderr, "%s: no phases\n", path);
+		goto err;
+	}
+
+	for (i = 0; i < s->nr; i++) {
+		struct scenario_phase *p = &s->phases[i];
+
+		p->mix_total = 0;
+		for (r = 0; r < NR_SCENARIO_OPS; r++)
+			p->mix_total += p->mix[r];
+		if (!p->mix_total && p->threads[SCENARIO_CREATER]) {
+			fprintf(stderr, "%s: phase %s has creaters but an empty mix\n", path, p->name);
+			goto err;
+		}
+		for (r = 0; r < NR_SCENARIO_ROLES; r++)
+			if (p->threads[r] > s->max_threads[r])
+				s->max_threads[r] = p->threads[r];
+		s->total_ns += p->duration_ns;
+	}
+
+	free(line);
+	fclose(f);
+	return 0;
+err:
+	free(line);
+	fclose(f);
+	scenario_free(s);
+	return -1;
+}
+
+void scenario_free(struct scenario *s)
+{
+	free(s->phases);
+	memset(s, 0, sizeof(*s));
+}
+
+unsigned int scenario_phase_at(const struct scenario *s, uint64_t ns)
+{
+	unsigned int i;
+
+	ns %= s->total_ns;
+	for (i = 0; ns >= s->phases[i].duration_ns; i++)
+		ns -= s->phases[i].duration_ns;
+	return i;
+}
+
+enum scenario_op scenario_pick_op(const struct scenario_phase *p, uint64_t *rng)
+{
+	unsigned int r = bench_rand(rng) % p->mix_total;
+	unsigned int i;
+
+	for (i = 0; r >= p->mix[i]; i++)
+		r -= p->mix[i];
+	return i;
+}
+
+int scenario_pace(struct scenario_pacer *p, unsigned int phase, uint64_t interval_ns)
+{
+	uint64_t now = now_ns(), wait;
+	struct timespec ts;
+
+	if (!interval_ns)
+		return 1;
+	/* a new phase, or too far behind to catch up */
+	if (p->phase != phase || now > p->next_ns + 1000000000ull) {
+		p->phase = phase;
+		p->next_ns = now;
+	}
+	if (p->next_ns > now) {
+		wait = p->next_ns - now;
+		if (wait > 10000000ull)
+			wait = 10000000ull;
+		ts.tv_sec = 0;
+		ts.tv_nsec = wait;
+		nanosleep(&ts, NULL);
+		return 0;
+	}
+	p->next_ns += interval_ns;
+	return 1;
+}
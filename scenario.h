@@ -0,0 +1,93 @@
+#ifndef __SCENARIO_H
+#define __SCENARIO_H
+
+#include <stdint.h>
+
+/*
+ * a workload described as a list of timed phases, so a run can replay the
+ * shape of something real (a deploy storm, log rotation) instead of one
+ * fixed stress pattern.  The file is line based, '#' starts a comment:
+ *
+ *	# anything before the first phase sets defaults
+ *	mount 0
+ *	phase quiet 5s
+ *		threads adder=1 remover=1 creater=1
+ *		rate creater=50
+ *		mix write=1
+ *	phase deploy 2s
+ *		threads adder=4 remover=4 creater=4
+ *		rate creater=20000
+ *		mix create=4 write=4 rename=1 unlink=1
+ *		mask create,delete,moved_to,close_write
+ *
+ * A phase starts as a copy of the one before it, so it only lists what
+ * changes.  Durations take an ns, us, ms or s suffix (seconds without).
+ *
+ *	threads ROLE=N ...	threads of each role running in the phase
+ *	rate ROLE=N ...		ops/sec summed over the role's running threads, 0 is flat out
+ *	mix OP=WEIGHT ...	weighted file operations for the creaters
+ *	mask NAME,...		watch mask for the adders (inotify names, or all)
+ *	mount INTERVAL		mount/unmount cadence, 0 for none
+ *	lowwd INTERVAL		low_wd reset cadence, 0 for never
+ */
+enum scenario_role {
+	SCENARIO_ADDER,
+	SCENARIO_REMOVER,
+	SCENARIO_LOWNUM,
+	SCENARIO_CREATER,
+	NR_SCENARIO_ROLES,
+};
+
+enum scenario_op {
+	SCENARIO_CREATE,
+	SCENARIO_UNLINK,
+	SCENARIO_WRITE,
+	SCENARIO_ATTRIB,
+	SCENARIO_RENAME,
+	SCENARIO_OPEN,
+	NR_SCENARIO_OPS,
+};
+
+struct scenario_phase {
+	char name[32];
+	uint64_t duration_ns;
+	unsigned int threads[NR_SCENARIO_ROLES];
+	unsigned int rate[NR_SCENARIO_ROLES];
+	unsigned int mix[NR_SCENARIO_OPS];
+	unsigned int mix_total;
+	uint32_t mask;
+	uint64_t mount_ns;
+	uint64_t lowwd_ns;
+};
+
+struct scenario {
+	struct scenario_phase *phases;
+	unsigned int nr;
+	uint64_t total_ns;
+	/* the most threads of each role any phase wants */
+	unsigned int max_threads[NR_SCENARIO_ROLES];
+};
+
+/* parse path, starting from defaults.  Complains on stderr and returns -1 on bad input */
+int scenario_load(struct scenario *s, const char *path, const struct scenario_phase *defaults);
+void scenario_free(struct scenario *s);
+/* which phase runs at ns in to the scenario, wrapping round at the end */
+unsigned int scenario_phase_at(const struct scenario *s, uint64_t ns);
+enum scenario_op scenario_pick_op(const struct scenario_phase *p, uint64_t *rng);
+const char *scenario_role_name(enum scenario_role role);
+const char *scenario_op_name(enum scenario_op op);
+
+/*
+ * per thread pacing for a role's rate.  Call before every op: returns 1 if
+ * the op is due, otherwise sleeps for a while (10ms at most, so the caller
+ * notices phase changes and stopping) and returns 0.  A thread which falls
+ * more than a second behind gives up on catching up rather than bursting.
+ */
+struct scenario_pacer {
+	uint64_t next_ns;
+	unsigned int phase;
+};
+
+int scenario_pace(struct scenario_pacer *p, unsigned int phase, uint64_t interval_ns);
+
+#endif /* __SCENARIO_H */
@@ -0,0 +1,375 @@
+/*
+ * does spreading one set of watches over several inotify instances help?
+ * For each shard count the same files are watched through a shardwatch:
+ * --threads adders add all of the watches, then as many writers touch
+ * random files (utimensat, so IN_ATTRIB) for --duration while this thread
+ * takes the events back out of shardwatch_next(), then the watches are
+ * removed again.  One shard is the plain single fd setup.  With one group
+ * every add, remove and queued event takes the same locks, so on a big box
+ * the adds and events per second should go up with the shards.
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "shardwatch.h"
+
+#define MAX_RUNS	16
+/* each worker carries a latency histogram, and more just contend harder */
+#define MAX_THREADS	256
+#define WATCH_MASK	(IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE)
+
+static struct bench_opts bench;
+static unsigned int num_files = 4096;
+static unsigned int num_threads = 4;
+static enum shardwatch_key key = SHARDWATCH_KEY_INODE;
+static char dir[] = "/tmp/shard_bench.XXXXXX";
+
+struct run {
+	unsigned int shards;
+	/* add phase */
+	double add_secs;
+	unsigned long add_failed;
+	struct hist add_lat;
+	/* event phase */
+	double event_secs;
+	unsigned long touches;
+	unsigned long events;
+	unsigned long overflows;
+	unsigned long ring_full;
+	/* remove phase */
+	double rm_secs;
+	/* fewest and most watches on one shard */
+	unsigned long min_adds, max_adds;
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int idx;
+	struct shardwatch *sw;
+	int64_t *ids;
+	uint64_t seed;
+	unsigned long count;
+	unsigned long failed;
+	struct hist lat;
+};
+
+/* when the writers stop touching files */
+static uint64_t writers_until;
+
+static void file_path(char *buf, size_t len, unsigned int i)
+{
+	snprintf(buf, len, "%s/f%05u", dir, i);
+}
+
+static void *__adder(void *arg)
+{
+	struct worker *w = arg;
+	char path[PATH_MAX];
+	uint64_t start;
+	unsigned int i;
+
+	for (i = w->idx; i < num_files; i += num_threads) {
+		file_path(path, sizeof(path), i);
+		start = now_ns();
+		w->ids[i] = shardwatch_add(w->sw, path, WATCH_MASK);
+		hist_record(&w->lat, now_ns() - start);
+		if (w->ids[i] < 0)
+			w->failed++;
+	}
+	return NULL;
+}
+
+static void *__writer(void *arg)
+{
+	struct worker *w = arg;
+	char path[PATH_MAX];
+
+	while (now_ns() < writers_until) {
+		file_path(path, sizeof(path), bench_rand(&w->seed) % num_files);
+		if (utimensat(AT_FDCWD, path, NULL, 0) == 0)
+			w->count++;
+	}
+	return NULL;
+}
+
+/* run fn on every worker and wait for them, returns the seconds it took */
+static double run_workers(struct worker *workers, void *(*fn)(void *))
+{
+	uint64_t start = now_ns();
+	unsigned int i;
+
+	for (i = 0; i < num_threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, fn, &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	for (i = 0; i < num_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	return (now_ns() - start) / 1e9;
+}
+
+/* take events out until there have been none for 100ms */
+static unsigned long consume(struct shardwatch *sw, uint64_t until)
+{
+	const struct inotify_event *event;
+	unsigned long events = 0;
+	uint64_t idle = 0, now;
+	int64_t id;
+
+	for (;;) {
+		if (shardwatch_next(sw, &id, &event)) {
+			events++;
+			idle = 0;
+			continue;
+		}
+		now = now_ns();
+		if (now >= until) {
+			if (!idle)
+				idle = now;
+			else if (now - idle > 100000000ull)
+				break;
+		}
+		usleep(50);
+	}
+	return events;
+}
+
+static void run_shards(struct run *r, int64_t *ids)
+{
+	struct worker *workers;
+	struct shardwatch_stats st;
+	struct shardwatch *sw;
+	uint64_t start;
+	unsigned int i;
+
+	sw = shardwatch_start(r->shards, key);
+	if (!sw) {
+		perror("shardwatch_start");
+		exit(1);
+	}
+
+	workers = calloc(num_threads, sizeof(*workers));
+	if (!workers) {
+		perror("allocating workers");
+		exit(1);
+	}
+	for (i = 0; i < num_threads; i++) {
+		workers[i].idx = i;
+		workers[i].sw = sw;
+		workers[i].ids = ids;
+		workers[i].seed = bench.seed + i;
+	}
+	r->add_secs = run_workers(workers, __adder);
+	hist_reset(&r->add_lat);
+	for (i = 0; i < num_threads; i++) {
+		hist_merge(&r->add_lat, &workers[i].lat);
+		r->add_failed += workers[i].failed;
+	}
+
+	/* the writers run in the background while we consume */
+	start = now_ns();
+	writers_until = start + bench.duration * 1e9;
+	for (i = 0; i < num_threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, __writer, &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	r->events = consume(sw, writers_until);
+	r->event_secs = (now_ns() - start) / 1e9;
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		r->touches += workers[i].count;
+	}
+
+	r->min_adds = ULONG_MAX;
+	for (i = 0; i < r->shards; i++) {
+		shardwatch_stats(sw, i, &st);
+		r->overflows += st.overflows;
+		r->ring_full += st.ring_full;
+		if (st.adds < r->min_adds)
+			r->min_adds = st.adds;
+		if (st.adds > r->max_adds)
+			r->max_adds = st.adds;
+	}
+
+	start = now_ns();
+	for (i = 0; i < num_files; i++)
+		if (ids[i] >= 0)
+			shardwatch_rm(sw, ids[i]);
+	r->rm_secs = (now_ns() - start) / 1e9;
+
+	shardwatch_stop(sw);
+	free(workers);
+}
+
+static void print_run(const struct run *r)
+{
+	unsigned long added = num_files - r->add_failed;
+
+	printf("%6u %10.0f %9.2f %9.2f %10.0f %10.0f %9lu %6lu/%-6lu %10.0f\n", r->shards,
+	       added / r->add_secs, hist_percentile(&r->add_lat, 50) / 1000.0,
+	       hist_percentile(&r->add_lat, 99) / 1000.0, r->touches / r->event_secs,
+	       r->events / r->event_secs, r->overflows, r->min_adds, r->max_adds,
+	       added / r->rm_secs);
+}
+
+static void json_run(struct json *j, const struct run *r)
+{
+	unsigned long added = num_files - r->add_failed;
+
+	json_object_begin(j, NULL);
+	json_uint(j, "shards", r->shards);
+	json_uint(j, "watches", added);
+	json_uint(j, "add_failed", r->add_failed);
+	json_double(j, "adds_per_sec", added / r->add_secs);
+	json_hist(j, "add_latency", &r->add_lat);
+	json_uint(j, "touches", r->touches);
+	json_uint(j, "events", r->events);
+	json_double(j, "touches_per_sec", r->touches / r->event_secs);
+	json_double(j, "events_per_sec", r->events / r->event_secs);
+	json_uint(j, "overflows", r->overflows);
+	json_uint(j, "ring_full", r->ring_full);
+	json_uint(j, "min_shard_watches", r->min_adds);
+	json_uint(j, "max_shard_watches", r->max_adds);
+	json_double(j, "rms_per_sec", added / r->rm_secs);
+	json_object_end(j);
+}
+
+static int parse_shards(const char *arg, unsigned int *shards)
+{
+	char *end;
+	int n = 0;
+
+	while (*arg && n < MAX_RUNS) {
+		shards[n] = strtoul(arg, &end, 0);
+		if (end == arg || !shards[n] || shards[n] > SHARDWATCH_MAX_SHARDS)
+			return -1;
+		n++;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"shards",	required_argument,	0, 'n'},
+		{"files",	required_argument,	0, 'f'},
+		{"threads",	required_argument,	0, 't'},
+		{"key",		required_argument,	0, 'k'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	unsigned int shards[MAX_RUNS] = { 1, 2, 4, 8 };
+	struct run runs[MAX_RUNS];
+	int num_runs = 4, c, fd;
+	char path[PATH_MAX];
+	unsigned int i;
+	int64_t *ids;
+	struct json j;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "n:f:t:k:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			num_runs = parse_shards(optarg, shards);
+			if (num_runs <= 0) {
+				fprintf(stderr, "--shards is a list of 1 to %d\n", SHARDWATCH_MAX_SHARDS);
+				return 1;
+			}
+			break;
+		case 'f':
+			num_files = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			num_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			if (!strcmp(optarg, "inode"))
+				key = SHARDWATCH_KEY_INODE;
+			else if (!strcmp(optarg, "path"))
+				key = SHARDWATCH_KEY_PATH;
+			else {
+				fprintf(stderr, "unknown key %s (inode, path)\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+				fprintf(stderr, "usage: %s [--shards N,N,...] [--files N] [--threads N] "
+					"[--key inode|path] [--duration SECS] [--seed N] [--json PATH]\n",
+					argv[0]);
+				return 1;
+			}
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_DURATION | BENCH_SEED))
+		return 1;
+	if (!bench.duration)
+		bench.duration = 2;
+	if (!num_files || num_files > 100000 || !num_threads || num_threads > MAX_THREADS) {
+		fprintf(stderr, "need 1 to 100000 files and 1 to %d threads\n", MAX_THREADS);
+		return 1;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (i = 0; i < num_files; i++) {
+		file_path(path, sizeof(path), i);
+		fd = open(path, O_WRONLY | O_CREAT, 0644);
+		if (fd < 0) {
+			perror(path);
+			return 1;
+		}
+		close(fd);
+	}
+	ids = calloc(num_files, sizeof(*ids));
+	if (!ids) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("%u files, %u threads, %s key, %.1fs of events per run\n", num_files, num_threads,
+	       key == SHARDWATCH_KEY_INODE ? "inode" : "path", bench.duration);
+	printf("%6s %10s %9s %9s %10s %10s %9s %13s %10s\n", "shards", "adds/s", "add p50",
+	       "add p99", "touches/s", "events/s", "overflows", "watches/shard", "rms/s");
+	for (i = 0; i < (unsigned int)num_runs; i++) {
+		memset(&runs[i], 0, sizeof(runs[i]));
+		runs[i].shards = shards[i];
+		run_shards(&runs[i], ids);
+		print_run(&runs[i]);
+	}
+
+	for (i = 0; i < num_files; i++) {
+		file_path(path, sizeof(path), i);
+		unlink(path);
+	}
+	rmdir(dir);
+	free(ids);
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "shard_bench", &bench);
+	json_uint(&j, "files", num_files);
+	json_uint(&j, "threads", num_threads);
+	json_string(&j, "key", key == SHARDWATCH_KEY_INODE ? "inode" : "path");
+	json_array_begin(&j, "runs");
+	for (i = 0; i < (unsigned int)num_runs; i++)
+		json_run(&j, &runs[i]);
+	json_array_end(&j);
+	json_close(&j);
+
+	return 0;
+}
@@ -0,0 +1,308 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shardwatch.h"
+#include "spsc.h"
+
+#define SHARDWATCH_BUF_SIZE	16384
+/* per shard, a power of 2 */
+#define SHARDWATCH_SLOTS	16
+
+struct shardwatch_slot {
+	size_t len;
+	char data[SHARDWATCH_BUF_SIZE] __attribute__ ((aligned (8)));
+};
+
+struct shard {
+	struct spsc_ring ring;
+	struct shardwatch_slot *slots;
+	int fd;
+	pthread_t reader;
+	int started;
+	struct shardwatch *sw;
+	struct shardwatch_stats stats;
+} __attribute__ ((aligned (SPSC_CACHELINE)));
+
+struct ring_point {
+	uint64_t hash;
+	unsigned int shard;
+};
+
+struct shardwatch {
+	struct shard *shards;
+	unsigned int nr_shards;
+	enum shardwatch_key key;
+	int stopping;
+	/* SHARDWATCH_VNODES points per shard, sorted by hash */
+	struct ring_point *points;
+	unsigned int nr_points;
+	/* consumer side: the slot being handed out and how far in to it we are */
+	unsigned int cur;
+	int held;
+	size_t off;
+};
+
+/* splitmix64's finalizer, spreads the keys over the whole ring */
+static uint64_t mix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static int point_cmp(const void *a, const void *b)
+{
+	const struct ring_point *pa = a, *pb = b;
+
+	return pa->hash < pb->hash ? -1 : pa->hash > pb->hash;
+}
+
+static int build_ring(struct shardwatch *sw)
+{
+	unsigned int s, v;
+
+	sw->nr_points = sw->nr_shards * SHARDWATCH_VNODES;
+	sw->points = calloc(sw->nr_points, sizeof(*sw->points));
+	if (!sw->points)
+		return -1;
+	/* a shard's points only depend on its number, so they stay put as shards come and go */
+	for (s = 0; s < sw->nr_shards; s++) {
+		for (v = 0; v < SHARDWATCH_VNODES; v++) {
+			struct ring_point *p = &sw->points[s * SHARDWATCH_VNODES + v];
+
+			p->hash = mix64(((uint64_t)s << 32 | v) + 0x9e3779b97f4a7c15ull);
+			p->shard = s;
+		}
+	}
+	qsort(sw->points, sw->nr_points, sizeof(*sw->points), point_cmp);
+	return 0;
+}
+
+/* the first point at or after hash, going round */
+static unsigned int ring_lookup(const struct shardwatch *sw, uint64_t hash)
+{
+	unsigned int lo = 0, hi = sw->nr_points;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (sw->points[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return sw->points[lo == sw->nr_points ? 0 : lo].shard;
+}
+
+int shardwatch_shard_of(const struct shardwatch *sw, const char *path)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	struct stat st;
+
+	if (sw->key == SHARDWATCH_KEY_INODE) {
+		if (stat(path, &st))
+			return -1;
+		hash = mix64((uint64_t)st.st_dev * 0x9e3779b97f4a7c15ull ^ st.st_ino);
+	} else {
+		/* fnv-1a, mixed since its low bits alone are poor */
+		for (; *path; path++)
+			hash = (hash ^ (unsigned char)*path) * 0x100000001b3ull;
+		hash = mix64(hash);
+	}
+	return ring_lookup(sw, hash);
+}
+
+/* count what a read got, the consumer does the real work */
+static void shard_account(struct shard *s, const char *buf, size_t len)
+{
+	const struct inotify_event *event;
+	size_t pos;
+
+	s->stats.reads++;
+	s->stats.bytes += len;
+	for (pos = 0; pos < len; pos += sizeof(*event) + event->len) {
+		event = (const struct inotify_event *)(buf + pos);
+		s->stats.events++;
+		if (event->mask & IN_Q_OVERFLOW)
+			s->stats.overflows++;
+	}
+}
+
+/* read straight in to the next free slot, poll when there is nothing to read */
+static void *shard_reader(void *ptr)
+{
+	struct shard *s = ptr;
+	struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+	struct shardwatch_slot *slot;
+	ssize_t ret;
+	int64_t pos;
+
+	while (!__atomic_load_n(&s->sw->stopping, __ATOMIC_ACQUIRE)) {
+		pos = spsc_reserve(&s->ring);
+		if (pos < 0) {
+			s->stats.ring_full++;
+			usleep(100);
+			continue;
+		}
+		slot = &s->slots[pos & s->ring.mask];
+		ret = read(s->fd, slot->data, SHARDWATCH_BUF_SIZE);
+		if (ret <= 0) {
+			/* time out so we notice stopping */
+			if (ret < 0 && errno == EAGAIN)
+				poll(&pfd, 1, 100);
+			continue;
+		}
+		slot->len = ret;
+		shard_account(s, slot->data, ret);
+		spsc_commit(&s->ring);
+	}
+	return NULL;
+}
+
+struct shardwatch *shardwatch_start(unsigned int nr_shards, enum shardwatch_key key)
+{
+	struct shardwatch *sw;
+	unsigned int i;
+	int err;
+
+	if (!nr_shards || nr_shards > SHARDWATCH_MAX_SHARDS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	sw = calloc(1, sizeof(*sw));
+	if (!sw)
+		return NULL;
+	sw->nr_shards = nr_shards;
+	sw->key = key;
+	if (posix_memalign((void **)&sw->shards, SPSC_CACHELINE, nr_shards * sizeof(*sw->shards)))
+		goto err;
+	memset(sw->shards, 0, nr_shards * sizeof(*sw->shards));
+	for (i = 0; i < nr_shards; i++)
+		sw->shards[i].fd = -1;
+	if (build_ring(sw))
+		goto err;
+
+	for (i = 0; i < nr_shards; i++) {
+		struct shard *s = &sw->shards[i];
+
+		s->sw = sw;
+		spsc_init(&s->ring, SHARDWATCH_SLOTS);
+		s->slots = calloc(SHARDWATCH_SLOTS, sizeof(*s->slots));
+		if (!s->slots)
+			goto err;
+		s->fd = inotify_init1(IN_NONBLOCK);
+		if (s->fd < 0)
+			goto err;
+		err = pthread_create(&s->reader, NULL, shard_reader, s);
+		if (err) {
+			errno = err;
+			goto err;
+		}
+		s->started = 1;
+	}
+	return sw;
+err:
+	err = errno;
+	shardwatch_stop(sw);
+	errno = err;
+	return NULL;
+}
+
+void shardwatch_stop(struct shardwatch *sw)
+{
+	unsigned int i;
+
+	__atomic_store_n(&sw->stopping, 1, __ATOMIC_RELEASE);
+	for (i = 0; sw->shards && i < sw->nr_shards; i++) {
+		struct shard *s = &sw->shards[i];
+
+		if (s->started)
+			pthread_join(s->reader, NULL);
+		if (s->fd >= 0)
+			close(s->fd);
+		free(s->slots);
+	}
+	free(sw->shards);
+	free(sw->points);
+	free(sw);
+}
+
+unsigned int shardwatch_shards(const struct shardwatch *sw)
+{
+	return sw->nr_shards;
+}
+
+int64_t shardwatch_add(struct shardwatch *sw, const char *path, uint32_t mask)
+{
+	int shard, wd;
+
+	shard = shardwatch_shard_of(sw, path);
+	if (shard < 0)
+		return -1;
+	wd = inotify_add_watch(sw->shards[shard].fd, path, mask);
+	if (wd < 0)
+		return -1;
+	__atomic_fetch_add(&sw->shards[shard].stats.adds, 1, __ATOMIC_RELAXED);
+	return SHARDWATCH_ID(shard, wd);
+}
+
+int shardwatch_rm(struct shardwatch *sw, int64_t id)
+{
+	unsigned int shard = SHARDWATCH_SHARD(id);
+
+	if (id < 0 || shard >= sw->nr_shards) {
+		errno = EINVAL;
+		return -1;
+	}
+	return inotify_rm_watch(sw->shards[shard].fd, SHARDWATCH_WD(id));
+}
+
+int shardwatch_next(struct shardwatch *sw, int64_t *id, const struct inotify_event **event)
+{
+	struct shardwatch_slot *slot;
+	struct shard *s;
+	unsigned int i;
+	uint64_t pos;
+
+	for (;;) {
+		if (sw->held) {
+			s = &sw->shards[sw->cur];
+			spsc_peek(&s->ring, &pos);
+			slot = &s->slots[pos & s->ring.mask];
+			if (sw->off < slot->len) {
+				*event = (const struct inotify_event *)(slot->data + sw->off);
+				*id = SHARDWATCH_ID(sw->cur, (*event)->wd);
+				sw->off += sizeof(**event) + (*event)->len;
+				return 1;
+			}
+			/* done with this read, give the next shard a turn */
+			spsc_release(&s->ring, 1);
+			sw->held = 0;
+			sw->cur = (sw->cur + 1) % sw->nr_shards;
+		}
+		for (i = 0; i < sw->nr_shards; i++) {
+			unsigned int shard = (sw->cur + i) % sw->nr_shards;
+
+			if (spsc_peek(&sw->shards[shard].ring, &pos)) {
+				sw->cur = shard;
+				sw->held = 1;
+				sw->off = 0;
+				break;
+			}
+		}
+		if (!sw->held)
+			return 0;
+	}
+}
+
+void shardwatch_stats(const struct shardwatch *sw, unsigned int shard,
+		      struct shardwatch_stats *stats)
+{
+	*stats = sw->shards[shard].stats;
+}
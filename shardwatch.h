@@ -0,0 +1,77 @@
+#ifndef __SHARDWATCH_H
+#define __SHARDWATCH_H
+
+#include <stdint.h>
+#include <sys/inotify.h>
+
+/*
+ * one logical set of watches spread over several inotify instances, so that
+ * adding, removing and queueing events for different watches takes
+ * different groups' locks.  A watch goes to the shard its key lands on in a
+ * consistent hash ring (SHARDWATCH_VNODES points per shard), so a different
+ * number of shards only moves about 1/n of the watches.  The key is the
+ * inode by default: inotify marks inodes, and two paths to one inode have
+ * to share a shard or they would get two marks.  Hashing the path saves the
+ * stat() when the caller knows there are no hard links.
+ *
+ * Every shard has its own reader thread reading its fd straight in to the
+ * slots of an spsc ring, and shardwatch_next() walks the rings in turn, so
+ * events come back through one interface without being copied.  Events of
+ * one watch stay in order; events of different shards are not ordered with
+ * respect to each other.
+ *
+ * A watch is named by its shard and wd packed in an int64_t.  Adding and
+ * removing watches is safe from any number of threads, shardwatch_next()
+ * is for one consumer.
+ */
+#define SHARDWATCH_MAX_SHARDS	64
+#define SHARDWATCH_VNODES	64
+
+#define SHARDWATCH_ID(shard, wd)	(((int64_t)(shard) << 32) | (uint32_t)(wd))
+#define SHARDWATCH_SHARD(id)		((unsigned int)((id) >> 32))
+#define SHARDWATCH_WD(id)		((int)(uint32_t)(id))
+
+enum shardwatch_key {
+	SHARDWATCH_KEY_INODE,
+	SHARDWATCH_KEY_PATH,
+};
+
+struct shardwatch_stats {
+	unsigned long reads;
+	unsigned long events;
+	unsigned long bytes;
+	/* IN_Q_OVERFLOW seen */
+	unsigned long overflows;
+	/* times the reader found the ring full and had to wait for the consumer */
+	unsigned long ring_full;
+	/* successful adds on the shard, for seeing how even the hash is */
+	unsigned long adds;
+};
+
+struct shardwatch;
+
+/* nr_shards inotify instances and their readers, NULL with errno set on failure */
+struct shardwatch *shardwatch_start(unsigned int nr_shards, enum shardwatch_key key);
+/* stop the readers, close the fds and free everything */
+void shardwatch_stop(struct shardwatch *sw);
+
+unsigned int shardwatch_shards(const struct shardwatch *sw);
+/* the shard path would go to, -1 if it can't be stat()ed with the inode key */
+int shardwatch_shard_of(const struct shardwatch *sw, const char *path);
+
+/* inotify_add_watch() on the right shard, the watch's id or -1 with errno set */
+int64_t shardwatch_add(struct shardwatch *sw, const char *path, uint32_t mask);
+int shardwatch_rm(struct shardwatch *sw, int64_t id);
+
+/*
+ * the next event from any shard: 1 with *id set to the watch it is for
+ * (the wd is still in event->wd) and *event pointing at it, 0 if nothing is
+ * queued.  The event stays valid until the next call.
+ */
+int shardwatch_next(struct shardwatch *sw, int64_t *id, const struct inotify_event **event);
+
+/* a copy of one shard's counters, safe to call while it runs */
+void shardwatch_stats(const struct shardwatch *sw, unsigned int shard,
+		      struct shardwatch_stats *stats);
+
+#endif /* __SHARDWATCH_H */
@@ -0,0 +1,74 @@
+#ifndef __SPSC_H
+#define __SPSC_H
+
+#include <stdint.h>
+
+/*
+ * single producer single consumer ring indices.  The ring only hands out
+ * positions, the caller owns the slot array (of whatever it likes) and
+ * indexes it with pos & mask.  Each side caches the other side's index so
+ * the shared cache lines are only touched when the cached view runs out.
+ */
+#define SPSC_CACHELINE 64
+
+struct spsc_ring {
+	uint64_t mask;
+	/* written by the producer */
+	uint64_t head __attribute__ ((aligned (SPSC_CACHELINE)));
+	uint64_t tail_cache;
+	/* written by the consumer */
+	uint64_t tail __attribute__ ((aligned (SPSC_CACHELINE)));
+	uint64_t head_cache;
+} __attribute__ ((aligned (SPSC_CACHELINE)));
+
+/* size must be a power of 2 */
+static inline int spsc_init(struct spsc_ring *r, uint64_t size)
+{
+	if (!size || (size & (size - 1)))
+		return -1;
+	r->mask = size - 1;
+	r->head = r->tail_cache = 0;
+	r->tail = r->head_cache = 0;
+	return 0;
+}
+
+/* producer: the position to fill, or -1 if the ring is full */
+static inline int64_t spsc_reserve(struct spsc_ring *r)
+{
+	if (r->head - r->tail_cache > r->mask) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head - r->tail_cache > r->mask)
+			return -1;
+	}
+	return r->head;
+}
+
+/* producer: publish the slot from spsc_reserve() */
+static inline void spsc_commit(struct spsc_ring *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/* consumer: how many slots starting at *pos are ready */
+static inline uint64_t spsc_peek(struct spsc_ring *r, uint64_t *pos)
+{
+	*pos = r->tail;
+	if (r->head_cache == r->tail)
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	return r->head_cache - r->tail;
+}
+
+/* consumer: hand n slots back to the producer */
+static inline void spsc_release(struct spsc_ring *r, uint64_t n)
+{
+	__atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+}
+
+/* either side: roughly how many slots are in use */
+static inline uint64_t spsc_depth(struct spsc_ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_RELAXED) -
+	       __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+}
+
+#endif /* __SPSC_H */
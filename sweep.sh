@@ -0,0 +1,126 @@
+#!/bin/bash
+# run syscall_thrash over a grid of thread counts and write a scaling curve
+# as CSV, then point out the knee where more threads stop adding throughput.
+# usage: sweep.sh [-c "cores..."] [-a "adders..."] [-m "multipliers..."]
+#	[-d "data dumpers..."] [-l "lownum removers..."] [-t secs] [-w warmup]
+#	[-k knee_pct] [-o out.csv] [extra syscall_thrash args...]
+cores="1 2 4 8"
+adders=3
+multipliers=2
+data=1
+low=1
+secs=5
+warmup=1
+knee_pct=5
+out=sweep.csv
+while getopts "c:a:m:d:l:t:w:k:o:" opt; do
+	case $opt in
+	c) cores=$OPTARG ;;
+	a) adders=$OPTARG ;;
+	m) multipliers=$OPTARG ;;
+	d) data=$OPTARG ;;
+	l) low=$OPTARG ;;
+	t) secs=$OPTARG ;;
+	w) warmup=$OPTARG ;;
+	k) knee_pct=$OPTARG ;;
+	o) out=$OPTARG ;;
+	*) sed -n '2,7p' "$0" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+# the value at a dotted path (totals.add_watch.ok) in the one member per
+# line JSON the tools write
+json_get() {
+	awk -v want="$2" '
+	function path(key,	p, i) {
+		p = ""
+		for (i = 1; i <= depth; i++)
+			if (stack[i] != "")
+				p = p stack[i] "."
+		return p key
+	}
+	{
+		line = $0
+		sub(/^[ \t]+/, "", line)
+		key = ""
+		if (match(line, /^"[^"]*": /)) {
+			key = substr(line, 2, RLENGTH - 4)
+			line = substr(line, RLENGTH + 1)
+		}
+	}
+	line ~ /^[{[]/ { stack[++depth] = key; next }
+	line ~ /^[}\]]/ { depth--; next }
+	key != "" && path(key) == want { sub(/,$/, "", line); gsub(/"/, "", line); print line; exit }
+	' "$1"
+}
+
+json=$(mktemp)
+trap 'rm -f "$json"' EXIT
+
+echo "cores,adders,multiplier,data,low,instances,threads,add_ok_per_sec,rm_ok_per_sec,ops_per_sec,events_per_sec,add_p50_ns,add_p99_ns,rm_p50_ns,rm_p99_ns" > "$out"
+for c in $cores; do
+for a in $adders; do
+for m in $multipliers; do
+for d in $data; do
+for l in $low; do
+	if ! ./syscall_thrash --interval 0 --cores "$c" --adders "$a" --multiplier "$m" \
+			--data "$d" --low "$l" --duration "$secs" --warmup "$warmup" \
+			--json "$json" "$@" > /dev/null 2>&1; then
+		echo "cores=$c adders=$a multiplier=$m data=$d low=$l failed" >&2
+		continue
+	fi
+	inst=$(json_get "$json" config.instances)
+	add=$(json_get "$json" config.adders)
+	rem=$(json_get "$json" config.removers)
+	mult=$(json_get "$json" config.multiplier)
+	lr=$(json_get "$json" config.low_removers)
+	dd=$(json_get "$json" config.data_dumpers)
+	fc=$(json_get "$json" config.file_creaters)
+	# every thread hammering inotify, the reporter and friends don't count
+	threads=$((inst * ((add + rem) * mult + lr + dd) + fc))
+	add_ok=$(json_get "$json" totals.add_watch.ok_per_sec)
+	rm_ok=$(json_get "$json" totals.rm_watch.ok_per_sec)
+	line="$c,$a,$m,$d,$l,$inst,$threads,$add_ok,$rm_ok"
+	line="$line,$(awk "BEGIN { printf \"%.0f\", $add_ok + $rm_ok }")"
+	line="$line,$(json_get "$json" totals.events_per_sec)"
+	line="$line,$(json_get "$json" totals.add_watch_latency.p50_ns)"
+	line="$line,$(json_get "$json" totals.add_watch_latency.p99_ns)"
+	line="$line,$(json_get "$json" totals.rm_watch_latency.p50_ns)"
+	line="$line,$(json_get "$json" totals.rm_watch_latency.p99_ns)"
+	echo "$line" >> "$out"
+	echo "$line"
+done
+done
+done
+done
+done
+
+# best ops/sec at each thread count, in thread order.  The knee is the first
+# point after which another step up in threads gains less than knee_pct.
+tail -n +2 "$out" | sort -t, -k7,7n | awk -F, -v pct="$knee_pct" '
+	{
+		if (!($7 in best)) order[n++] = $7
+		if ($10 > best[$7]) best[$7] = $10
+	}
+	END {
+		# a single thread count has nothing to compare against
+		if (n == 1) {
+			printf "no knee: every run had %d threads, vary -a, -m, -d or -l to get a curve\n",
+				order[0]
+			exit
+		}
+		for (i = 1; i < n; i++) {
+			prev = best[order[i - 1]]
+			gain = prev ? 100 * (best[order[i]] - prev) / prev : 100
+			if (gain < pct) {
+				printf "knee: %d threads, %.0f ops/s (next step %d threads %+.1f%%)\n",
+					order[i - 1], prev, order[i], gain
+				exit
+			}
+		}
+		if (n)
+			printf "no knee: still scaling at %d threads, %.0f ops/s\n",
+				order[n - 1], best[order[n - 1]]
+	}'
+echo "curve written to $out"
@@ -4,18 +4,32 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "cputopo.h"
+#include "evbatch.h"
+#include "hist.h"
+#include "mpmc.h"
+#include "perfctr.h"
+#include "scenario.h"
+#include "spsc.h"
+#include "uring.h"
+
 /* huerristic on how hard to load a box */
 static unsigned int num_cores;
 /* number of threads which just read from inotify_fd and ignore the results */
@@ -32,6 +46,123 @@ static unsigned int num_low_remover_threads;
 static unsigned int num_file_creaters;
 /* how many inotify_fd's we have total (so another multiplier for adders and removers) */
 static unsigned int num_inotify_instances;
+/* how often (in seconds) the reporter prints throughput, 0 means never */
+static unsigned int report_interval = 1;
+
+/*
+ * how events get pulled off the inotify fds.  DRAIN_SPIN runs num_data_dumpers
+ * threads per instance spinning on read().  The epoll modes instead run
+ * num_drainers event loop threads which each service a share of all of the
+ * inotify fds, level or edge triggered.  DRAIN_URING runs the same share
+ * of fds per drainer through an io_uring, with a read always posted on each
+ * fd, so one io_uring_enter() per wakeup both re-posts and waits.
+ * DRAIN_DISPATCH runs one reader per instance which hands what it reads to
+ * num_data_dumpers workers, sharded by wd (see struct dispatch).
+ */
+enum drain_mode {
+	DRAIN_SPIN,
+	DRAIN_EPOLL_LT,
+	DRAIN_EPOLL_ET,
+	DRAIN_URING,
+	DRAIN_DISPATCH,
+};
+static const char *drain_mode_names[] = {
+	[DRAIN_SPIN]		= "spin",
+	[DRAIN_EPOLL_LT]	= "epoll",
+	[DRAIN_EPOLL_ET]	= "epoll-et",
+	[DRAIN_URING]		= "uring",
+	[DRAIN_DISPATCH]	= "dispatch",
+};
+static enum drain_mode drain_mode = DRAIN_SPIN;
+/* number of epoll or io_uring event loop threads */
+static unsigned int num_drainers;
+/* read() buffer for the spin and epoll drains, 0 sizes it from FIONREAD */
+static size_t read_size = 8096;
+
+/*
+ * how the removers pick wds.  REMOVE_SCAN walks every integer between low_wd
+ * and high_wd.  REMOVE_TARGETED only removes wds the adders published in the
+ * instance's live wd registry.
+ */
+enum remove_mode {
+	REMOVE_SCAN,
+	REMOVE_TARGETED,
+};
+static const char *remove_mode_names[] = {
+	[REMOVE_SCAN]		= "scan",
+	[REMOVE_TARGETED]	= "targeted",
+};
+static enum remove_mode remove_mode = REMOVE_SCAN;
+
+/*
+ * --perf opens perf counters in every worker thread, reported by what the
+ * thread does, so e.g. adders spending their time context switching (lock
+ * contention) can be told apart from adders doing real work.
+ */
+enum thread_role {
+	ROLE_ADDER,
+	ROLE_REMOVER,
+	ROLE_LOWNUM,
+	ROLE_DUMPER,
+	ROLE_DRAINER,
+	ROLE_WORKER,
+	ROLE_CREATER,
+	ROLE_MOUNTER,
+	NR_ROLES,
+};
+static const char *role_names[] = {
+	[ROLE_ADDER]	= "adder",
+	[ROLE_REMOVER]	= "remover",
+	[ROLE_LOWNUM]	= "lownum",
+	[ROLE_DUMPER]	= "dumper",
+	[ROLE_DRAINER]	= "drainer",
+	[ROLE_WORKER]	= "worker",
+	[ROLE_CREATER]	= "creater",
+	[ROLE_MOUNTER]	= "mounter",
+};
+static int perf_enabled;
+
+/*
+ * --affinity pins each worker as it is created.  compact packs threads on to
+ * the hyperthreads and cores of one package before moving on, scatter spreads
+ * them as far apart as possible, instance gives each inotify instance and all
+ * of its threads their own slice of the box, and siblings/distant put each
+ * adder and the remover paired with it next to or far away from each other.
+ */
+enum affinity_policy {
+	AFFINITY_NONE,
+	AFFINITY_COMPACT,
+	AFFINITY_SCATTER,
+	AFFINITY_INSTANCE,
+	AFFINITY_SIBLINGS,
+	AFFINITY_DISTANT,
+	NR_AFFINITY,
+};
+static const char *affinity_names[] = {
+	[AFFINITY_NONE]		= "none",
+	[AFFINITY_COMPACT]	= "compact",
+	[AFFINITY_SCATTER]	= "scatter",
+	[AFFINITY_INSTANCE]	= "instance",
+	[AFFINITY_SIBLINGS]	= "siblings",
+	[AFFINITY_DISTANT]	= "distant",
+};
+static enum affinity_policy affinity = AFFINITY_NONE;
+
+/*
+ * --scenario replaces the fixed workload with timed phases (see scenario.h).
+ * Every role gets as many threads as the busiest phase wants and the ones a
+ * phase doesn't want sit parked.  Adders, removers and lownum removers are
+ * counted and paced per instance, creaters over the whole run.  Each thread's
+ * sequence of operations comes from --seed; only the timing is left to the
+ * scheduler.
+ */
+static const char *scenario_path;
+static struct scenario scenario;
+/* the phase running now, only main() changes it */
+static volatile unsigned int cur_phase;
+
+/* --duration, --ops, --warmup, --seed and --json */
+static struct bench_opts bench;
 
 static char *working_dir = "/tmp/inotify_syscall_thrash";
 /* if mounting a real filesystem, where is the source?  (doesn't matter for tmpfs) */
@@ -58,26 +189,187 @@ static int wait;
 		pthread_mutex_unlock(&wait_mutex); \
 	} while (0);
 
+/*
+ * per thread counters.  Each thread only ever writes its own struct and the
+ * reporter only reads them, so no locking.  They are cache line aligned so
+ * the counters of threads hammering the same inotify instance don't bounce.
+ */
+#define CACHELINE_SIZE 64
+struct op_stats {
+	unsigned long calls;
+	unsigned long success;
+	unsigned long enoent;
+	unsigned long einval;
+	unsigned long eagain;
+	/* any other errno */
+	unsigned long errors;
+	unsigned long bytes;
+	unsigned long events;
+	/* events drained, by mask bit */
+	unsigned long mask_bits[32];
+	/*
+	 * IN_Q_OVERFLOW seen, the events read ahead of it and the bytes
+	 * still queued right after, summed over every overflow
+	 */
+	unsigned long overflows;
+	unsigned long overflow_ahead;
+	unsigned long overflow_queued;
+};
+
+struct thread_stats {
+	struct op_stats ops;
+	/* latency of the syscall this thread hammers */
+	struct hist lat;
+} __attribute__ ((aligned (CACHELINE_SIZE)));
+
+/*
+ * live wds of one inotify instance.  Adders push a wd when they first see it,
+ * removers pop and remove it.  claimed[] (indexed by wd & WD_CLAIM_MASK)
+ * remembers which wd is already queued so multiple adders of the same file
+ * don't flood the queue with duplicates; a collision only costs a duplicate.
+ */
+#define WD_REGISTRY_SIZE	4096
+#define WD_CLAIM_MASK		(WD_REGISTRY_SIZE - 1)
+struct wd_registry {
+	struct mpmc_queue queue;
+	int claimed[WD_REGISTRY_SIZE];
+	unsigned long overflows;
+};
+
 struct adder_struct {
 	int inotify_fd;
 	int file_num;
+	/* which of the instance's adders this is */
+	unsigned int idx;
+	struct thread_stats *stats;
+	struct wd_registry *registry;
 };
 
+/* per draining thread (spin dumper, epoll loop, dispatch reader or worker) cost accounting */
+struct drain_info {
+	unsigned long wakeups;
+	/* every syscall spent draining: reads, epoll_waits or io_uring_enters */
+	unsigned long syscalls;
+	uint64_t cpu_ns;
+	/* from the start of the read() which got an event to the event being handled */
+	struct hist event_lat;
+	/* where we were when the warmup ended */
+	int measuring;
+	unsigned long wakeup_base;
+	unsigned long syscall_base;
+	uint64_t cpu_base;
+} __attribute__ ((aligned (CACHELINE_SIZE)));
+
 struct operator_struct {
 	int inotify_fd;
+	/* which of the instance's threads of this role it is */
+	unsigned int idx;
+	struct thread_stats *stats;
+	struct drain_info *drain;
+	struct wd_registry *registry;
+};
+
+struct drainer_struct {
+	unsigned int id;
+	struct drain_info *drain;
+};
+
+/*
+ * --drain dispatch.  The reader of an instance reads in to a buffer from the
+ * pool, sorts the offsets of its records by worker (wd % workers, so all of a
+ * watch's events go to one worker, in the order they were read) and queues a
+ * (buffer, first, count) message on each worker's spsc ring.  The events are
+ * never copied; the buffer counts the workers still using it and the last
+ * one puts it back on the free queue, an mpmc since any worker can.  Nobody
+ * spins: the reader waits for events in poll(), and a worker with nothing
+ * queued, or the reader waiting for a buffer or ring slot, sleeps on its
+ * eventfd until the other side wakes it.
+ */
+#define DISPATCH_BUF_SIZE	16384
+#define DISPATCH_MAX_RECORDS	(DISPATCH_BUF_SIZE / sizeof(struct inotify_event))
+#define DISPATCH_BUFS		64
+#define DISPATCH_RING_SIZE	256
+
+struct dispatch_buf {
+	int refs;
+	/* when the read which filled it started */
+	uint64_t read_start;
+	/* record offsets in data, grouped by worker */
+	uint16_t off[DISPATCH_MAX_RECORDS];
+	char data[DISPATCH_BUF_SIZE] __attribute__ ((aligned (8)));
+};
+
+struct dispatch_msg {
+	struct dispatch_buf *buf;
+	unsigned int first;
+	unsigned int count;
+};
+
+struct dispatch_worker {
+	struct spsc_ring ring;
+	struct dispatch_msg msgs[DISPATCH_RING_SIZE];
+	struct thread_stats *stats;
+	struct drain_info *drain;
+	struct dispatch *dispatch;
+	/*
+	 * the worker sleeps on efd while sleeping is set.  Both sides write
+	 * sleeping, so it gets a line to itself.
+	 */
+	int efd;
+	int sleeping __attribute__ ((aligned (CACHELINE_SIZE)));
+} __attribute__ ((aligned (CACHELINE_SIZE)));
+
+/* the reader's scratch for one worker: records going to it, and the next one's slot */
+struct dispatch_count {
+	unsigned int count, fill;
 };
 
+struct dispatch {
+	int inotify_fd;
+	struct mpmc_queue free_bufs;
+	struct dispatch_buf *bufs;
+	unsigned int nr_workers;
+	struct dispatch_worker *workers;
+	struct dispatch_count *counts;
+	struct thread_stats *stats;
+	struct drain_info *drain;
+	/* the reader sleeps on efd while it waits for a buffer or a ring slot */
+	int efd;
+	/* reads held up by an empty pool or a full worker ring */
+	unsigned long pool_empty;
+	unsigned long ring_full;
+	/* written by the workers too, kept off the reader's counters */
+	int sleeping __attribute__ ((aligned (CACHELINE_SIZE)));
+} __attribute__ ((aligned (CACHELINE_SIZE)));
+
 struct thread_data {
 	int inotify_fd;
 	pthread_t *adders;
 	pthread_t *removers;
 	pthread_t *lownum_removers;
 	pthread_t *data_dumpers;
+	struct thread_stats *adder_stats;
+	struct thread_stats *remover_stats;
+	struct thread_stats *lownum_stats;
+	struct thread_stats *dumper_stats;
+	unsigned int num_dumper_stats;
+	struct wd_registry *registry;
+	struct dispatch *dispatch;
 };
 
 pthread_t *file_creaters;
+/* only calls are counted, and only with --scenario */
+static struct thread_stats *creater_stats;
 pthread_t low_wd_reseter;
 pthread_t mounter;
+pthread_t reporter;
+pthread_t *drainers;
+/* one per spin dumper (instance major) or one per epoll drainer */
+static struct drain_info *drain_infos;
+static unsigned int num_drain_infos;
+/* every drain thread's event_lat, merged once they are done */
+static struct hist drain_event_lat;
+static struct thread_data *all_td;
 
 static int stopped = 0;
 
@@ -90,6 +382,224 @@ static int handle_error(const char *arg)
 	exit(EXIT_FAILURE);
 }
 
+/* calloc, but cache line aligned so per thread structs really don't share lines */
+static void *calloc_aligned(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, CACHELINE_SIZE, nmemb * size))
+		return NULL;
+	memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+static void registry_publish(struct wd_registry *reg, int wd)
+{
+	if (__atomic_exchange_n(&reg->claimed[wd & WD_CLAIM_MASK], wd, __ATOMIC_RELAXED) == wd)
+		return;
+	if (mpmc_push(&reg->queue, wd))
+		__atomic_fetch_add(&reg->overflows, 1, __ATOMIC_RELAXED);
+}
+
+/* returns the next live wd or -1 if there are none */
+static int registry_take(struct wd_registry *reg)
+{
+	uintptr_t val;
+	int wd;
+
+	if (mpmc_pop(&reg->queue, &val))
+		return -1;
+	wd = val;
+	/* let an adder publish this wd again once it is gone */
+	__atomic_compare_exchange_n(&reg->claimed[wd & WD_CLAIM_MASK], &wd, 0, 0,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	return val;
+}
+
+/* count the result of a single syscall, which started at start, in the threads stats */
+static inline void account_errno(struct op_stats *ops, int err)
+{
+	switch (err) {
+	case ENOENT:
+		ops->enoent++;
+		break;
+	case EINVAL:
+		ops->einval++;
+		break;
+	case EAGAIN:
+		ops->eagain++;
+		break;
+	default:
+		ops->errors++;
+		break;
+	}
+}
+
+static inline void account_call(struct thread_stats *stats, int ret, uint64_t start)
+{
+	struct op_stats *ops = &stats->ops;
+
+	hist_record(&stats->lat, now_ns() - start);
+	ops->calls++;
+	if (ret >= 0) {
+		ops->success++;
+		return;
+	}
+	account_errno(ops, errno);
+}
+
+/* one per thread with counters, the values are read by the main thread */
+struct perf_slot {
+	struct perf_slot *next;
+	enum thread_role role;
+	struct perf_counters counters;
+	/* at the end of the warmup, and when we stopped */
+	struct perf_values base;
+	struct perf_values end;
+};
+
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct perf_slot *perf_slots;
+/* counters every thread managed to open */
+static unsigned int perf_valid = ~0u;
+/* counters some thread could only open for user space */
+static unsigned int perf_user_only;
+
+/* called by each worker before it wakes its parent */
+static void perf_thread_start(enum thread_role role)
+{
+	struct perf_slot *slot;
+	unsigned int valid;
+
+	if (!perf_enabled)
+		return;
+
+	slot = calloc(1, sizeof(*slot));
+	if (!slot)
+		handle_error("allocating perf counters");
+	slot->role = role;
+	valid = perf_counters_open(&slot->counters);
+
+	pthread_mutex_lock(&perf_lock);
+	slot->next = perf_slots;
+	perf_slots = slot;
+	perf_valid &= valid;
+	perf_user_only |= slot->counters.user_only;
+	pthread_mutex_unlock(&perf_lock);
+}
+
+/* read every thread's counters in to base (start) or end */
+static void perf_snapshot(int end)
+{
+	struct perf_slot *slot;
+
+	for (slot = perf_slots; slot; slot = slot->next)
+		perf_counters_read(&slot->counters, end ? &slot->end : &slot->base);
+}
+
+/* where each pinned thread went, in creation order, for the report */
+struct placement {
+	struct placement *next;
+	enum thread_role role;
+	/* -1 for threads which aren't tied to one instance */
+	int instance;
+	unsigned int index;
+	char cpus[64];
+};
+
+static struct cpu_topo topo;
+static struct placement *placements;
+static struct placement **placements_tail = &placements;
+/* next cpu for compact and scatter, threads are only created by main() */
+static unsigned int next_slot;
+
+/* a contiguous (in compact order) share of the cpus for each instance */
+static void instance_cpus(unsigned int inst, cpu_set_t *set)
+{
+	unsigned int i, first, n;
+
+	if (num_inotify_instances >= topo.nr) {
+		CPU_SET(topo.cpus[inst % topo.nr].cpu, set);
+		return;
+	}
+	n = topo.nr / num_inotify_instances;
+	first = inst * n;
+	/* the last instance gets whatever doesn't divide evenly */
+	if (inst == num_inotify_instances - 1)
+		n = topo.nr - first;
+	for (i = first; i < first + n; i++)
+		CPU_SET(topo.cpus[i].cpu, set);
+}
+
+/*
+ * adder n and remover n of an instance are a pair.  Pairs are spread out
+ * like scatter for siblings so each gets its own core, and packed in to the
+ * first half of compact order for distant so the mirror cpu is free.
+ */
+static unsigned int pair_cpu(enum thread_role role, unsigned int inst, unsigned int idx)
+{
+	unsigned int pair = inst * num_adder_threads * watcher_multiplier + idx;
+	unsigned int i;
+
+	if (affinity == AFFINITY_SIBLINGS) {
+		i = cpu_topo_scatter(&topo, pair);
+		return role == ROLE_ADDER ? i : cpu_topo_sibling(&topo, i);
+	}
+	i = pair % topo.nr;
+	return role == ROLE_ADDER ? i : cpu_topo_distant(&topo, i);
+}
+
+/* pin a freshly created worker according to --affinity and remember where it went */
+static void place_thread(pthread_t thread, enum thread_role role, int inst, unsigned int idx)
+{
+	struct placement *p;
+	cpu_set_t set;
+	int rc;
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	CPU_ZERO(&set);
+	switch (affinity) {
+	case AFFINITY_COMPACT:
+		CPU_SET(topo.cpus[next_slot++ % topo.nr].cpu, &set);
+		break;
+	case AFFINITY_SCATTER:
+		CPU_SET(topo.cpus[cpu_topo_scatter(&topo, next_slot++)].cpu, &set);
+		break;
+	case AFFINITY_INSTANCE:
+		/* shared threads (creaters, epoll drainers, the mounter) float */
+		if (inst < 0)
+			return;
+		instance_cpus(inst, &set);
+		break;
+	default:
+		/* only the adder/remover pairs are placed, everything else floats */
+		if (role != ROLE_ADDER && role != ROLE_REMOVER)
+			return;
+		CPU_SET(topo.cpus[pair_cpu(role, inst, idx)].cpu, &set);
+		break;
+	}
+
+	rc = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (rc) {
+		errno = rc;
+		handle_error("pthread_setaffinity_np");
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		handle_error("allocating thread placement");
+	p->role = role;
+	p->instance = inst;
+	p->index = idx;
+	cpu_set_format(&set, p->cpus, sizeof(p->cpus));
+	*placements_tail = p;
+	placements_tail = &p->next;
+
+	fprintf(stdout, "affinity: %s inst %d #%u -> cpu %s\n", role_names[role], inst, idx, p->cpus);
+}
+
 static void sigfunc(int sig_num)
 {
 	if (sig_num == SIGINT)
@@ -98,16 +608,120 @@ static void sigfunc(int sig_num)
 		printf("Got an unknown signal!\n");
 }
 
+/*
+ * with --scenario workers call this before every operation.  Threads the
+ * current phase doesn't want are parked, the rest are paced to their role's
+ * rate.  Returns the phase to run the operation under, NULL once stopped.
+ */
+static const struct scenario_phase *scenario_gate(enum scenario_role role, unsigned int idx,
+						 struct scenario_pacer *pacer)
+{
+	const struct scenario_phase *p;
+	unsigned int phase;
+
+	while (!stopped) {
+		phase = cur_phase;
+		p = &scenario.phases[phase];
+		if (idx >= p->threads[role]) {
+			usleep(1000);
+			continue;
+		}
+		if (!p->rate[role] ||
+		    scenario_pace(pacer, phase, 1000000000ull * p->threads[role] / p->rate[role]))
+			return p;
+	}
+	return NULL;
+}
+
+/* the same for workers which don't care about the phase, 0 once stopped */
+static inline int scenario_wait(enum scenario_role role, unsigned int idx,
+				struct scenario_pacer *pacer)
+{
+	return !scenario.nr || scenario_gate(role, idx, pacer);
+}
+
+static int scenario_file_op(enum scenario_op op, const char *filename)
+{
+	char rotated[64];
+	int fd = -1, ret = 0;
+
+	switch (op) {
+	case SCENARIO_CREATE:
+		unlink(filename);
+		ret = fd = open(filename, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+		break;
+	case SCENARIO_UNLINK:
+		ret = unlink(filename);
+		break;
+	case SCENARIO_WRITE:
+		ret = fd = open(filename, O_WRONLY|O_APPEND);
+		if (fd >= 0)
+			ret = write(fd, "x", 1);
+		break;
+	case SCENARIO_ATTRIB:
+		ret = chmod(filename, S_IRUSR|S_IWUSR);
+		break;
+	case SCENARIO_RENAME:
+		/* log rotation, the watched name is gone until something creates it */
+		snprintf(rotated, sizeof(rotated), "%s.1", filename);
+		ret = rename(filename, rotated);
+		break;
+	case SCENARIO_OPEN:
+		ret = fd = open(filename, O_RDONLY);
+		break;
+	default:
+		break;
+	}
+	if (fd >= 0)
+		close(fd);
+	return ret < 0 ? -1 : 0;
+}
+
+/* the phase's weighted mix of file operations on randomly picked watched files */
+static void scenario_create_files(unsigned int idx)
+{
+	struct thread_stats *stats = &creater_stats[idx];
+	struct scenario_pacer pacer = { 0, 0 };
+	const struct scenario_phase *p;
+	uint64_t rng = bench.seed + idx;
+	enum scenario_op op;
+	char filename[50];
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	/* start with all of the files there, as without a scenario */
+	for (i = idx; i < num_adder_threads; i += num_file_creaters) {
+		snprintf(filename, 50, "%s/%u", working_dir, i);
+		scenario_file_op(SCENARIO_CREATE, filename);
+	}
+
+	while ((p = scenario_gate(SCENARIO_CREATER, idx, &pacer))) {
+		op = scenario_pick_op(p, &rng);
+		snprintf(filename, 50, "%s/%u", working_dir,
+			 (unsigned int)(bench_rand(&rng) % num_adder_threads));
+		start = now_ns();
+		ret = scenario_file_op(op, filename);
+		account_call(stats, ret, start);
+	}
+}
+
 /* constantly create and delete all of the files that are bieng watched */
-static void *__create_files(__attribute__ ((unused)) void *ptr)
+static void *__create_files(void *ptr)
 {
+	unsigned int idx = *(unsigned int *)ptr;
 	char filename[50];
 	unsigned int i;
 
 	fprintf(stdout, "Starting creater thread\n");
 
+	perf_thread_start(ROLE_CREATER);
+
 	WAKE_PARENT;
 
+	if (scenario.nr)
+		scenario_create_files(idx);
+
 	while (!stopped) {
 		for (i = 0; i < num_adder_threads; i++) {
 			int fd;
@@ -125,6 +739,8 @@ static void *__create_files(__attribute__ ((unused)) void *ptr)
 	for (i = 0; i < num_adder_threads; i++) {
 		snprintf(filename, 50, "%s/%d", working_dir, i);
 		unlink(filename);
+		snprintf(filename, 50, "%s/%d.1", working_dir, i);
+		unlink(filename);
 	}
 
 	return NULL;
@@ -139,11 +755,16 @@ static int start_file_creater_threads(void)
 	if (!file_creaters)
 		handle_error("allocating file creater pthreads");
 
+	creater_stats = calloc_aligned(num_file_creaters, sizeof(*creater_stats));
+	if (!creater_stats)
+		handle_error("allocating file creater stats");
+
 	/* create threads which unlink and then recreate all of the files in question */
 	for (i = 0; i < num_file_creaters; i++) {
-		rc = pthread_create(&file_creaters[i], &attr, __create_files, NULL);
+		rc = pthread_create(&file_creaters[i], &attr, __create_files, &i);
 		if (rc)
 			handle_error("creating the file creater threads");
+		place_thread(file_creaters[i], ROLE_CREATER, -1, i);
 		WAIT_CHILD;
 	}
 	return 0;
@@ -157,8 +778,14 @@ static void *__reset_low_wd(__attribute__ ((unused)) void *ptr)
 	WAKE_PARENT;
 
 	while (!stopped) {
-		low_wd = INT_MAX;
-		sleep(1);
+		uint64_t interval = scenario.nr ? scenario.phases[cur_phase].lowwd_ns : 1000000000ull;
+
+		/* 0 means never, look again in a bit in case the phase changes */
+		if (interval)
+			low_wd = INT_MAX;
+		else
+			interval = 10000000ull;
+		usleep(interval / 1000);
 	}
 
 	return NULL;
@@ -178,24 +805,111 @@ static int start_reset_low_wd_thread(void)
 	return 0;
 }
 
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* set once the warmup is over, drain threads note their cpu usage then */
+static int measuring;
+
+/* drain threads call this every loop so their cost excludes the warmup */
+static inline void drain_note_start(struct drain_info *drain)
+{
+	if (!measuring || drain->measuring)
+		return;
+	drain->cpu_base = thread_cpu_ns();
+	drain->wakeup_base = drain->wakeups;
+	drain->syscall_base = drain->syscalls;
+	hist_reset(&drain->event_lat);
+	drain->measuring = 1;
+}
+
+
+/* classify what one read got and throw it away, in the one pass that walks it */
+static void drain_classify(int inotify_fd, struct thread_stats *stats, const char *buf, int ret)
+{
+	unsigned long events;
+	long overflow;
+
+	stats->ops.bytes += ret;
+	events = ev_walk_classify(buf, ret, stats->ops.mask_bits, &overflow);
+	stats->ops.events += events;
+	/* the kernel only queues one, always last, so this is rare */
+	if (overflow >= 0) {
+		int queued = ev_queued_bytes(inotify_fd);
+
+		stats->ops.overflows++;
+		stats->ops.overflow_ahead += overflow;
+		if (queued > 0)
+			stats->ops.overflow_queued += queued;
+	}
+}
+
+static void drain_reader_init(struct ev_reader *rd)
+{
+	/* read_size 0 is adaptive, anything else the old fixed buffer */
+	if (ev_reader_init(rd, read_size, read_size))
+		handle_error("allocating read buffer");
+}
+
+/*
+ * read once from an inotify fd, classify what we got and throw it away.
+ * An adaptive reader may answer from FIONREAD alone, which is a syscall but
+ * not a read call.
+ */
+static int drain_once(int inotify_fd, struct thread_stats *stats, struct ev_reader *rd,
+		      struct drain_info *drain)
+{
+	unsigned long reads = rd->reads, queries = rd->queries;
+	unsigned long events = stats->ops.events;
+	uint64_t start;
+	int ret;
+
+	start = now_ns();
+	ret = ev_reader_read(rd, inotify_fd);
+	if (rd->reads != reads)
+		account_call(stats, ret, start);
+	drain->syscalls += (rd->reads - reads) + (rd->queries - queries);
+	if (ret > 0) {
+		drain_classify(inotify_fd, stats, rd->buf, ret);
+		hist_record_n(&drain->event_lat, now_ns() - start, stats->ops.events - events);
+	}
+	return ret;
+}
+
 /* Pull events off the buffer and ignore them */
 static void *__dump_data(void *ptr)
 {
-	char buf[8096];
+	struct ev_reader rd;
 	struct operator_struct *operator_arg = ptr;
 	int inotify_fd = operator_arg->inotify_fd;
+	struct thread_stats *stats = operator_arg->stats;
+	struct drain_info *drain = operator_arg->drain;
 	int ret;
 
+	drain_reader_init(&rd);
 	fprintf(stdout, "Starting inotify data dumper thread\n");
 
+	perf_thread_start(ROLE_DUMPER);
+
 	WAKE_PARENT;
 
 	while (!stopped) {
-		ret = read(inotify_fd, buf, 8096);
-		if (ret <= 0)
+		drain_note_start(drain);
+		ret = drain_once(inotify_fd, stats, &rd, drain);
+		if (ret > 0)
+			drain->wakeups++;
+		/* an adaptive read that emptied the queue saves the read that gets EAGAIN */
+		if (ret <= 0 || !rd.more)
 			pthread_yield();
 	}
 
+	drain->cpu_ns = thread_cpu_ns();
+	ev_reader_free(&rd);
 	return NULL;
 }
 
@@ -215,23 +929,496 @@ static int start_data_dumping_threads(struct thread_data *td)
 		handle_error("allocating data_dumpers");
 	td->data_dumpers = data_dumpers;
 
+	td->dumper_stats = calloc_aligned(num_data_dumpers, sizeof(*td->dumper_stats));
+	if (!td->dumper_stats)
+		handle_error("allocating data_dumper stats");
+
+	td->num_dumper_stats = num_data_dumpers;
+
 	/* use default ATTR for larger stack */
 	for (i = 0; i < num_data_dumpers; i++) {
+		os.stats = &td->dumper_stats[i];
+		os.drain = &drain_infos[(td - all_td) * num_data_dumpers + i];
 		rc = pthread_create(&data_dumpers[i], NULL, __dump_data, &os);
 		if (rc)
 			handle_error("creating threads to dump inotify data");
+		place_thread(data_dumpers[i], ROLE_DUMPER, td - all_td, i);
+		WAIT_CHILD;
+	}
+	return 0;
+}
+
+/*
+ * service every inotify fd with id == instance % num_drainers through one epoll
+ * instance.  Each instance is only ever read by one drainer so its read stats
+ * are single writer just like the spin dumpers.
+ */
+static void *__epoll_drain(void *ptr)
+{
+	struct ev_reader rd;
+	struct drainer_struct *drainer_arg = ptr;
+	struct drain_info *drain = drainer_arg->drain;
+	unsigned int id = drainer_arg->id;
+	struct epoll_event evs[64];
+	unsigned int i;
+	int epfd, n, j, ret;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		handle_error("epoll_create1");
+
+	drain_reader_init(&rd);
+	for (i = id; i < num_inotify_instances; i += num_drainers) {
+		struct epoll_event ev;
+
+		ev.events = EPOLLIN;
+		if (drain_mode == DRAIN_EPOLL_ET)
+			ev.events |= EPOLLET;
+		ev.data.ptr = &all_td[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, all_td[i].inotify_fd, &ev))
+			handle_error("epoll_ctl");
+	}
+
+	fprintf(stdout, "Starting %s drainer thread %u\n", drain_mode_names[drain_mode], id);
+
+	perf_thread_start(ROLE_DRAINER);
+
+	WAKE_PARENT;
+
+	while (!stopped) {
+		drain_note_start(drain);
+		/* time out so we notice stopped */
+		n = epoll_wait(epfd, evs, sizeof(evs) / sizeof(evs[0]), 100);
+		drain->syscalls++;
+		if (n <= 0)
+			continue;
+		drain->wakeups++;
+		for (j = 0; j < n; j++) {
+			struct thread_data *td = evs[j].data.ptr;
+
+			/* what more said was about the last fd */
+			rd.more = 0;
+			/* edge triggered only tells us once, so empty the queue */
+			do {
+				ret = drain_once(td->inotify_fd, td->dumper_stats, &rd, drain);
+			} while (ret > 0 && rd.more && drain_mode == DRAIN_EPOLL_ET);
+		}
+	}
+
+	drain->cpu_ns = thread_cpu_ns();
+	ev_reader_free(&rd);
+	close(epfd);
+	return NULL;
+}
+
+/*
+ * the io_uring version of the above.  A completion is one read's worth of
+ * events in a provided buffer; it counts as a read call but there is no
+ * per read syscall to time, so the read latency histogram stays empty.
+ */
+static void *__uring_drain(void *ptr)
+{
+	struct drainer_struct *drainer_arg = ptr;
+	struct drain_info *drain = drainer_arg->drain;
+	unsigned int id = drainer_arg->id;
+	unsigned int i, nr = 0;
+	struct uring ring;
+	uint64_t *instances;
+	int *fds;
+
+	fds = calloc(num_inotify_instances, sizeof(*fds));
+	instances = calloc(num_inotify_instances, sizeof(*instances));
+	if (!fds || !instances)
+		handle_error("allocating uring fds");
+	for (i = id; i < num_inotify_instances; i += num_drainers) {
+		fds[nr] = all_td[i].inotify_fd;
+		instances[nr++] = i;
+	}
+	/* the ring belongs to the thread which submits to it */
+	if (uring_init(&ring, 256, 8192))
+		handle_error("uring_init");
+	if (nr && uring_add_reads(&ring, fds, instances, nr))
+		handle_error("uring_add_reads");
+
+	fprintf(stdout, "Starting %s drainer thread %u\n", drain_mode_names[drain_mode], id);
+
+	perf_thread_start(ROLE_DRAINER);
+
+	WAKE_PARENT;
+
+	while (!stopped) {
+		const char *buf;
+		uint64_t instance;
+		int len;
+
+		drain_note_start(drain);
+		/* time out so we notice stopped */
+		if (uring_wait(&ring, 100) < 0)
+			handle_error("io_uring_enter");
+		drain->syscalls = ring.stats.enters;
+		if (!uring_next(&ring, &instance, &buf, &len))
+			continue;
+		drain->wakeups++;
+		do {
+			struct thread_data *td = &all_td[instance];
+			struct op_stats *ops = &td->dumper_stats->ops;
+
+			ops->calls++;
+			if (len < 0) {
+				account_errno(ops, -len);
+				continue;
+			}
+			ops->success++;
+			if (len > 0)
+				drain_classify(td->inotify_fd, td->dumper_stats, buf, len);
+		} while (uring_next(&ring, &instance, &buf, &len));
+	}
+
+	drain->cpu_ns = thread_cpu_ns();
+	fprintf(stdout, "uring drainer %u: %s reads, %lu reposted, %lu out of buffers, %lu failed\n",
+		id, ring.multishot ? "multishot" : "single shot", ring.stats.reposts, ring.stats.nobufs,
+		ring.stats.errors);
+	uring_destroy(&ring);
+	free(instances);
+	free(fds);
+	return NULL;
+}
+
+static int start_drain_threads(void)
+{
+	struct drainer_struct ds;
+	unsigned int i;
+	int rc;
+
+	drainers = calloc(num_drainers, sizeof(*drainers));
+	if (!drainers)
+		handle_error("allocating drainer pthreads");
+
+	for (i = 0; i < num_inotify_instances; i++) {
+		all_td[i].dumper_stats = calloc_aligned(1, sizeof(*all_td[i].dumper_stats));
+		if (!all_td[i].dumper_stats)
+			handle_error("allocating drain stats");
+		all_td[i].num_dumper_stats = 1;
+	}
+
+	/* use default ATTR for larger stack */
+	for (i = 0; i < num_drainers; i++) {
+		ds.id = i;
+		ds.drain = &drain_infos[i];
+		rc = pthread_create(&drainers[i], NULL,
+				    drain_mode == DRAIN_URING ? __uring_drain : __epoll_drain, &ds);
+		if (rc)
+			handle_error("creating the drain threads");
+		place_thread(drainers[i], ROLE_DRAINER, -1, i);
+		WAIT_CHILD;
+	}
+	return 0;
+}
+
+/*
+ * a dispatch thread about to sleep sets its flag and then looks for work
+ * once more, whoever gives it work publishes it and then looks at the flag,
+ * so one of them always sees the other and no wakeup is lost
+ */
+static void dispatch_sleep_begin(int *sleeping)
+{
+	__atomic_store_n(sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void dispatch_sleep(int efd, int *sleeping)
+{
+	struct pollfd pfd = { .fd = efd, .events = POLLIN };
+	uint64_t val;
+
+	/* time out so we notice stopped */
+	if (poll(&pfd, 1, 100) > 0 && read(efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		handle_error("reading a dispatch eventfd");
+	__atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static void dispatch_wake(int efd, int *sleeping)
+{
+	uint64_t one = 1;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(sleeping, __ATOMIC_RELAXED) ||
+	    !__atomic_exchange_n(sleeping, 0, __ATOMIC_RELAXED))
+		return;
+	if (write(efd, &one, sizeof(one)) < 0)
+		handle_error("waking a dispatch thread");
+}
+
+/* sort the records of a read by worker and queue them, 0 if we stopped first */
+static int dispatch_buf(struct dispatch *d, struct dispatch_buf *buf, int len)
+{
+	struct thread_stats *stats = d->stats;
+	struct inotify_event *event;
+	struct dispatch_count *c;
+	struct dispatch_worker *w;
+	unsigned int i, first, nr = 0, users = 0;
+	int pos, queued;
+
+	memset(d->counts, 0, d->nr_workers * sizeof(*d->counts));
+	for (pos = 0; pos < len; pos += sizeof(*event) + event->len) {
+		event = (struct inotify_event *)(buf->data + pos);
+		d->counts[(unsigned int)event->wd % d->nr_workers].count++;
+		/* overflows are counted here, where the queue is known */
+		if (event->mask & IN_Q_OVERFLOW) {
+			queued = ev_queued_bytes(d->inotify_fd);
+			stats->ops.overflows++;
+			stats->ops.overflow_ahead += nr;
+			if (queued > 0)
+				stats->ops.overflow_queued += queued;
+		}
+		nr++;
+	}
+	for (i = 0, first = 0; i < d->nr_workers; i++) {
+		c = &d->counts[i];
+		c->fill = first;
+		first += c->count;
+		users += !!c->count;
+	}
+	for (pos = 0; pos < len; pos += sizeof(*event) + event->len) {
+		event = (struct inotify_event *)(buf->data + pos);
+		c = &d->counts[(unsigned int)event->wd % d->nr_workers];
+		buf->off[c->fill++] = pos;
+	}
+
+	__atomic_store_n(&buf->refs, users, __ATOMIC_RELAXED);
+	for (i = 0; i < d->nr_workers; i++) {
+		struct dispatch_msg *msg;
+		int64_t slot;
+
+		w = &d->workers[i];
+		c = &d->counts[i];
+		if (!c->count)
+			continue;
+		while ((slot = spsc_reserve(&w->ring)) < 0) {
+			if (stopped)
+				return 0;
+			d->ring_full++;
+			dispatch_sleep_begin(&d->sleeping);
+			if ((slot = spsc_reserve(&w->ring)) >= 0) {
+				__atomic_store_n(&d->sleeping, 0, __ATOMIC_RELAXED);
+				break;
+			}
+			dispatch_sleep(d->efd, &d->sleeping);
+		}
+		msg = &w->msgs[slot & w->ring.mask];
+		msg->buf = buf;
+		msg->first = c->fill - c->count;
+		msg->count = c->count;
+		spsc_commit(&w->ring);
+		dispatch_wake(w->efd, &w->sleeping);
+	}
+	return 1;
+}
+
+/* the one thread reading an instance's inotify fd */
+static void *__dispatch_read(void *ptr)
+{
+	struct dispatch *d = ptr;
+	struct drain_info *drain = d->drain;
+	struct dispatch_buf *buf = NULL;
+	struct pollfd pfd = { .fd = d->inotify_fd, .events = POLLIN };
+	int counting = 0, more = 0;
+	uintptr_t val;
+	uint64_t start;
+	int ret;
+
+	fprintf(stdout, "Starting inotify dispatch reader for %u workers\n", d->nr_workers);
+
+	perf_thread_start(ROLE_DUMPER);
+
+	WAKE_PARENT;
+
+	while (!stopped) {
+		drain_note_start(drain);
+		/* the stalls only count while measuring, like everything else */
+		if (drain->measuring && !counting) {
+			d->pool_empty = d->ring_full = 0;
+			counting = 1;
+		}
+		if (!buf) {
+			if (mpmc_pop(&d->free_bufs, &val)) {
+				d->pool_empty++;
+				dispatch_sleep_begin(&d->sleeping);
+				if (mpmc_pop(&d->free_bufs, &val)) {
+					dispatch_sleep(d->efd, &d->sleeping);
+					continue;
+				}
+				__atomic_store_n(&d->sleeping, 0, __ATOMIC_RELAXED);
+			}
+			buf = (struct dispatch_buf *)val;
+		}
+		if (!more) {
+			/* the queue is empty, wait for more (timing out so we notice stopped) */
+			drain->syscalls++;
+			if (poll(&pfd, 1, 100) <= 0)
+				continue;
+		}
+		start = now_ns();
+		ret = read(d->inotify_fd, buf->data, DISPATCH_BUF_SIZE);
+		account_call(d->stats, ret, start);
+		drain->syscalls++;
+		/* room to spare for the largest event means the read emptied the queue */
+		more = ret > (int)(DISPATCH_BUF_SIZE - EV_RECORD_MAX);
+		if (ret <= 0)
+			continue;
+		drain->wakeups++;
+		d->stats->ops.bytes += ret;
+		buf->read_start = start;
+		if (dispatch_buf(d, buf, ret))
+			buf = NULL;
+	}
+
+	drain->cpu_ns = thread_cpu_ns();
+	return NULL;
+}
+
+/* handle one worker's share of the buffers, in the order they were read */
+static void *__dispatch_work(void *ptr)
+{
+	struct dispatch_worker *w = ptr;
+	struct op_stats *ops = &w->stats->ops;
+	struct drain_info *drain = w->drain;
+	struct dispatch *d = w->dispatch;
+	uint64_t pos, n, i;
+
+	fprintf(stdout, "Starting inotify dispatch worker thread\n");
+
+	perf_thread_start(ROLE_WORKER);
+
+	WAKE_PARENT;
+
+	while (!stopped) {
+		drain_note_start(drain);
+		n = spsc_peek(&w->ring, &pos);
+		if (!n) {
+			dispatch_sleep_begin(&w->sleeping);
+			if (!spsc_peek(&w->ring, &pos))
+				dispatch_sleep(w->efd, &w->sleeping);
+			else
+				__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			struct dispatch_msg *msg = &w->msgs[(pos + i) & w->ring.mask];
+			struct dispatch_buf *buf = msg->buf;
+			unsigned int j;
+
+			for (j = msg->first; j < msg->first + msg->count; j++) {
+				const struct inotify_event *event;
+
+				event = (const struct inotify_event *)(buf->data + buf->off[j]);
+				ev_classify_mask(event->mask, ops->mask_bits);
+			}
+			ops->events += msg->count;
+			hist_record_n(&drain->event_lat, now_ns() - buf->read_start, msg->count);
+			if (!__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL))
+				mpmc_push(&d->free_bufs, (uintptr_t)buf);
+		}
+		spsc_release(&w->ring, n);
+		/* the reader may be waiting for the buffers or the ring slots */
+		dispatch_wake(d->efd, &d->sleeping);
+	}
+
+	drain->cpu_ns = thread_cpu_ns();
+	return NULL;
+}
+
+/* a dispatch reader and num_data_dumpers workers for one instance */
+static int start_dispatch_threads(struct thread_data *td)
+{
+	unsigned int i, nr = num_data_dumpers + 1;
+	struct drain_info *drain = &drain_infos[(td - all_td) * nr];
+	struct dispatch *d;
+	int rc;
+
+	d = calloc_aligned(1, sizeof(*d));
+	if (!d)
+		handle_error("allocating dispatch");
+	td->dispatch = d;
+	d->inotify_fd = td->inotify_fd;
+	d->nr_workers = num_data_dumpers;
+	d->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (d->efd < 0)
+		handle_error("eventfd");
+
+	d->bufs = calloc_aligned(DISPATCH_BUFS, sizeof(*d->bufs));
+	if (!d->bufs || mpmc_init(&d->free_bufs, DISPATCH_BUFS))
+		handle_error("allocating dispatch buffers");
+	for (i = 0; i < DISPATCH_BUFS; i++)
+		mpmc_push(&d->free_bufs, (uintptr_t)&d->bufs[i]);
+
+	d->workers = calloc_aligned(num_data_dumpers, sizeof(*d->workers));
+	d->counts = calloc(num_data_dumpers, sizeof(*d->counts));
+	td->data_dumpers = calloc(nr, sizeof(*td->data_dumpers));
+	td->dumper_stats = calloc_aligned(nr, sizeof(*td->dumper_stats));
+	if (!d->workers || !d->counts || !td->data_dumpers || !td->dumper_stats)
+		handle_error("allocating dispatch workers");
+	td->num_dumper_stats = nr;
+
+	/* the reader's stats are the reads, the workers' the events */
+	d->stats = &td->dumper_stats[0];
+	d->drain = &drain[0];
+	rc = pthread_create(&td->data_dumpers[0], NULL, __dispatch_read, d);
+	if (rc)
+		handle_error("creating the dispatch reader");
+	place_thread(td->data_dumpers[0], ROLE_DUMPER, td - all_td, 0);
+	WAIT_CHILD;
+
+	for (i = 0; i < num_data_dumpers; i++) {
+		struct dispatch_worker *w = &d->workers[i];
+
+		spsc_init(&w->ring, DISPATCH_RING_SIZE);
+		w->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (w->efd < 0)
+			handle_error("eventfd");
+		w->stats = &td->dumper_stats[i + 1];
+		w->drain = &drain[i + 1];
+		w->dispatch = d;
+		rc = pthread_create(&td->data_dumpers[i + 1], NULL, __dispatch_work, w);
+		if (rc)
+			handle_error("creating dispatch workers");
+		place_thread(td->data_dumpers[i + 1], ROLE_WORKER, td - all_td, i + 1);
 		WAIT_CHILD;
 	}
 	return 0;
 }
 
+static void free_dispatch(struct dispatch *d)
+{
+	unsigned int i;
+
+	if (!d)
+		return;
+	for (i = 0; i < d->nr_workers; i++)
+		if (d->workers[i].efd > 0)
+			close(d->workers[i].efd);
+	close(d->efd);
+	mpmc_destroy(&d->free_bufs);
+	free(d->bufs);
+	free(d->counts);
+	free(d->workers);
+	free(d);
+}
+
 /* add a watch to a specific file as fast as we can */
 static void *__add_watches(void *ptr)
 {
 	struct adder_struct *adder_arg = ptr;
 	int file_num = adder_arg->file_num;
 	int notify_fd = adder_arg->inotify_fd;
-	int ret;
+	struct thread_stats *stats = adder_arg->stats;
+	struct wd_registry *registry = adder_arg->registry;
+	unsigned int idx = adder_arg->idx;
+	struct scenario_pacer pacer = { 0, 0 };
+	const struct scenario_phase *p;
+	uint32_t mask = IN_ALL_EVENTS;
+	uint64_t start;
+	int ret, last_wd = -1;
 	char filename[50];
 
 	fprintf(stdout, "Creating a watch creater thread, notify_fd=%d filenum=%d\n",
@@ -239,16 +1426,29 @@ static void *__add_watches(void *ptr)
 
 	snprintf(filename, 50, "%s/%d", working_dir, file_num);
 
+	perf_thread_start(ROLE_ADDER);
+
 	WAKE_PARENT;
 
 	while (!stopped) {
-		ret = inotify_add_watch(notify_fd, filename, IN_ALL_EVENTS);
+		if (scenario.nr) {
+			if (!(p = scenario_gate(SCENARIO_ADDER, idx, &pacer)))
+				break;
+			mask = p->mask;
+		}
+		start = now_ns();
+		ret = inotify_add_watch(notify_fd, filename, mask);
+		account_call(stats, ret, start);
 		if (ret < 0 && errno != ENOENT)
 			perror("inotify_add_watch");
 		if (ret > high_wd)
 			high_wd = ret;
 		if (ret < low_wd)
 			low_wd = ret;
+		/* only touch the shared registry when the wd changed */
+		if (remove_mode == REMOVE_TARGETED && ret >= 0 && ret != last_wd)
+			registry_publish(registry, ret);
+		last_wd = ret;
 		pthread_yield();
 	}
 
@@ -263,6 +1463,7 @@ static int start_watch_creation_threads(struct thread_data *td)
 	pthread_t *adders;
 
 	ws.inotify_fd = td->inotify_fd;
+	ws.registry = td->registry;
 
 	/* allocate the pthread_t's for all of the threads */
 	adders = calloc(num_adder_threads * watcher_multiplier, sizeof(*adders));
@@ -270,12 +1471,20 @@ static int start_watch_creation_threads(struct thread_data *td)
 		handle_error("allocating adders");
 	td->adders = adders;
 
+	td->adder_stats = calloc_aligned(num_adder_threads * watcher_multiplier, sizeof(*td->adder_stats));
+	if (!td->adder_stats)
+		handle_error("allocating adder stats");
+
 	for (i = 0; i < num_adder_threads; i++) {
 		ws.file_num = i;
 		for (j = 0; j < watcher_multiplier; j++) {
+			ws.idx = i * watcher_multiplier + j;
+			ws.stats = &td->adder_stats[ws.idx];
 			rc = pthread_create(&adders[i * watcher_multiplier + j], &attr, __add_watches, &ws);
 			if (rc)
 				handle_error("creating water threads");
+			place_thread(adders[i * watcher_multiplier + j], ROLE_ADDER, td - all_td,
+				     i * watcher_multiplier + j);
 			WAIT_CHILD;
 		}
 	}
@@ -288,15 +1497,37 @@ static void *__remove_watches(void *ptr)
 {
 	struct operator_struct *operator_arg = ptr;
 	int inotify_fd = operator_arg->inotify_fd;
-	int i;
+	struct thread_stats *stats = operator_arg->stats;
+	struct wd_registry *registry = operator_arg->registry;
+	unsigned int idx = operator_arg->idx;
+	struct scenario_pacer pacer = { 0, 0 };
+	uint64_t start;
+	int i, ret;
 
 	fprintf(stdout, "Starting a thread to remove watches\n");
 
+	perf_thread_start(ROLE_REMOVER);
+
 	WAKE_PARENT;
 
 	while (!stopped) {
-		for (i = low_wd; i < high_wd; i++)
-			inotify_rm_watch(inotify_fd, i);
+		if (remove_mode == REMOVE_TARGETED) {
+			/* remove everything which is live right now */
+			while (scenario_wait(SCENARIO_REMOVER, idx, &pacer) && !stopped &&
+			       (i = registry_take(registry)) >= 0) {
+				start = now_ns();
+				ret = inotify_rm_watch(inotify_fd, i);
+				account_call(stats, ret, start);
+			}
+		} else {
+			for (i = low_wd; i < high_wd; i++) {
+				if (!scenario_wait(SCENARIO_REMOVER, idx, &pacer))
+					break;
+				start = now_ns();
+				ret = inotify_rm_watch(inotify_fd, i);
+				account_call(stats, ret, start);
+			}
+		}
 		pthread_yield();
 	}
 	return NULL;
@@ -310,6 +1541,7 @@ static int start_watch_removal_threads(struct thread_data *td)
 	pthread_t *removers;
 
 	os.inotify_fd = td->inotify_fd;
+	os.registry = td->registry;
 
 	/* allocate the pthread_t's for all of the threads */
 	removers = calloc(num_remover_threads * watcher_multiplier, sizeof(*removers));
@@ -318,12 +1550,20 @@ static int start_watch_removal_threads(struct thread_data *td)
 
 	td->removers = removers;
 
+	td->remover_stats = calloc_aligned(num_remover_threads * watcher_multiplier, sizeof(*td->remover_stats));
+	if (!td->remover_stats)
+		handle_error("allocating remover stats");
+
 	/* create threads which walk from low_wd to high_wd closing all of the wd's in between */
 	for (i = 0; i < num_remover_threads; i++) {
 		for (j = 0; j < watcher_multiplier; j++) {
+			os.idx = i * watcher_multiplier + j;
+			os.stats = &td->remover_stats[os.idx];
 			rc = pthread_create(&removers[i * watcher_multiplier + j], &attr, __remove_watches, &os);
 			if (rc)
 				handle_error("creating the removal threads");
+			place_thread(removers[i * watcher_multiplier + j], ROLE_REMOVER, td - all_td,
+				     i * watcher_multiplier + j);
 			WAIT_CHILD;
 		}
 	}
@@ -335,15 +1575,26 @@ static void *__remove_lownum_watches(void *ptr)
 {
 	struct operator_struct *operator_arg = ptr;
 	int inotify_fd = operator_arg->inotify_fd;
-	int i;
+	struct thread_stats *stats = operator_arg->stats;
+	unsigned int idx = operator_arg->idx;
+	struct scenario_pacer pacer = { 0, 0 };
+	uint64_t start;
+	int i, ret;
 
 	fprintf(stdout, "Starting thread to remove low watches\n");
 
+	perf_thread_start(ROLE_LOWNUM);
+
 	WAKE_PARENT;
 
 	while (!stopped) {
-		for (i = low_wd; i <= low_wd+3; i++)
-			inotify_rm_watch(inotify_fd, i);
+		for (i = low_wd; i <= low_wd+3; i++) {
+			if (!scenario_wait(SCENARIO_LOWNUM, idx, &pacer))
+				break;
+			start = now_ns();
+			ret = inotify_rm_watch(inotify_fd, i);
+			account_call(stats, ret, start);
+		}
 		pthread_yield();
 	}
 	return NULL;
@@ -364,11 +1615,18 @@ static int start_lownum_watch_removal_threads(struct thread_data *td)
 
 	td->lownum_removers = lownum_removers;
 
+	td->lownum_stats = calloc_aligned(num_low_remover_threads, sizeof(*td->lownum_stats));
+	if (!td->lownum_stats)
+		handle_error("allocating lownum removal stats");
+
 	/* create threads which walk from low_wd to high_wd closing all of the wd's in between */
 	for (i = 0; i < num_low_remover_threads; i++) {
+		od.idx = i;
+		od.stats = &td->lownum_stats[i];
 		rc = pthread_create (&lownum_removers[i], &attr, __remove_lownum_watches, &od);
 		if (rc)
 			handle_error("creating the lownum removal threads");
+		place_thread(lownum_removers[i], ROLE_LOWNUM, td - all_td, i);
 		WAIT_CHILD;
 	}
 	return 0;
@@ -380,20 +1638,778 @@ static void *__mount_fs(__attribute__ ((unused)) void *ptr)
  
 	fprintf(stdout, "Starting mount and unmount fs on top of working dir\n");
 
+	perf_thread_start(ROLE_MOUNTER);
+
 	WAKE_PARENT;
 
 	while (!stopped) {
+		uint64_t interval = scenario.nr ? scenario.phases[cur_phase].mount_ns : 100000000ull;
+
+		if (!interval) {
+			usleep(10000);
+			continue;
+		}
 		rc = mount(mnt_src, working_dir, fstype, MS_MGC_VAL, "rootcontext=\"unconfined_u:object_r:tmp_t:s0\"");
-		usleep(100000);
+		usleep(interval / 1000);
 		if (!rc)
 			umount2(working_dir, MNT_DETACH);
 		else
 			fprintf(stderr, "Failed to mount %s: %s\n", mnt_src, strerror(errno));
-		usleep(100000);
+		usleep(interval / 1000);
+	}
+	return NULL;
+}
+
+static void sum_op_stats(struct op_stats *total, const struct op_stats *ops)
+{
+	unsigned int i;
+
+	total->calls += ops->calls;
+	total->success += ops->success;
+	total->enoent += ops->enoent;
+	total->einval += ops->einval;
+	total->eagain += ops->eagain;
+	total->errors += ops->errors;
+	total->bytes += ops->bytes;
+	total->events += ops->events;
+	for (i = 0; i < 32; i++)
+		total->mask_bits[i] += ops->mask_bits[i];
+	total->overflows += ops->overflows;
+	total->overflow_ahead += ops->overflow_ahead;
+	total->overflow_queued += ops->overflow_queued;
+}
+
+/* add up the counters of n threads */
+static void sum_stats(struct op_stats *total, struct thread_stats *stats, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum_op_stats(total, &stats[i].ops);
+}
+
+/* per inotify instance totals, by thread role */
+struct instance_stats {
+	struct op_stats add;
+	struct op_stats rm;
+	struct op_stats read;
+};
+
+static void collect_instance_stats(struct thread_data *td, struct instance_stats *is)
+{
+	memset(is, 0, sizeof(*is));
+	sum_stats(&is->add, td->adder_stats, num_adder_threads * watcher_multiplier);
+	sum_stats(&is->rm, td->remover_stats, num_remover_threads * watcher_multiplier);
+	sum_stats(&is->rm, td->lownum_stats, num_low_remover_threads);
+	sum_stats(&is->read, td->dumper_stats, td->num_dumper_stats);
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_instance_rates(const char *label, unsigned int inst,
+				 const struct instance_stats *cur,
+				 const struct instance_stats *prev, double secs)
+{
+	fprintf(stdout, "%s inst %u: add %.0f/s (ok %.0f enoent %.0f) "
+		"rm %.0f/s (ok %.0f einval %.0f) "
+		"read %.0f/s %.0f ev/s %.0f KB/s\n",
+		label, inst,
+		(cur->add.calls - prev->add.calls) / secs,
+		(cur->add.success - prev->add.success) / secs,
+		(cur->add.enoent - prev->add.enoent) / secs,
+		(cur->rm.calls - prev->rm.calls) / secs,
+		(cur->rm.success - prev->rm.success) / secs,
+		(cur->rm.einval - prev->rm.einval) / secs,
+		(cur->read.calls - prev->read.calls) / secs,
+		(cur->read.events - prev->read.events) / secs,
+		(cur->read.bytes - prev->read.bytes) / secs / 1024);
+}
+
+static struct timespec start_time;
+
+/* print the per interval and cumulative rates for every inotify instance */
+static void *__report_stats(__attribute__ ((unused)) void *ptr)
+{
+	struct instance_stats *prev, cur, zero;
+	double last = 0, now;
+	unsigned int i;
+
+	prev = calloc(num_inotify_instances, sizeof(*prev));
+	if (!prev)
+		handle_error("allocating reporter stats");
+	memset(&zero, 0, sizeof(zero));
+
+	fprintf(stdout, "Starting stats reporter thread\n");
+
+	WAKE_PARENT;
+
+	while (!stopped) {
+		sleep(report_interval);
+		if (stopped)
+			break;
+		now = elapsed_since(&start_time);
+		for (i = 0; i < num_inotify_instances; i++) {
+			char label[32];
+
+			collect_instance_stats(&all_td[i], &cur);
+			snprintf(label, sizeof(label), "[%7.1fs]", now);
+			print_instance_rates(label, i, &cur, &prev[i], now - last);
+			print_instance_rates("    total", i, &cur, &zero, now);
+			prev[i] = cur;
+		}
+		last = now;
 	}
+
+	free(prev);
 	return NULL;
 }
 
+static int start_reporter_thread(void)
+{
+	int rc;
+
+	rc = pthread_create(&reporter, &attr, __report_stats, NULL);
+	if (rc)
+		handle_error("creating the stats reporter thread");
+	WAIT_CHILD;
+
+	return 0;
+}
+
+/* merge the latency histograms of n threads */
+static void merge_latency(struct hist *total, struct thread_stats *stats, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		hist_merge(total, &stats[i].lat);
+}
+
+/* everything the final report needs to know about one instance */
+struct instance_snapshot {
+	struct instance_stats ops;
+	/* just the low_wd..high_wd (or targeted) removers, not lownum */
+	struct op_stats removers;
+	struct hist add_lat;
+	struct hist rm_lat;
+	struct hist read_lat;
+};
+
+/* taken when the warmup ends, NULL if there was no warmup */
+static struct instance_snapshot *baseline;
+static struct timespec measure_time;
+/* how long we measured for, fixed when we decide to stop */
+static double measured_secs;
+
+static void take_snapshot(struct thread_data *td, struct instance_snapshot *snap)
+{
+	collect_instance_stats(td, &snap->ops);
+	memset(&snap->removers, 0, sizeof(snap->removers));
+	sum_stats(&snap->removers, td->remover_stats, num_remover_threads * watcher_multiplier);
+
+	hist_reset(&snap->add_lat);
+	merge_latency(&snap->add_lat, td->adder_stats, num_adder_threads * watcher_multiplier);
+	hist_reset(&snap->rm_lat);
+	merge_latency(&snap->rm_lat, td->remover_stats, num_remover_threads * watcher_multiplier);
+	merge_latency(&snap->rm_lat, td->lownum_stats, num_low_remover_threads);
+	hist_reset(&snap->read_lat);
+	merge_latency(&snap->read_lat, td->dumper_stats, td->num_dumper_stats);
+}
+
+static void op_stats_subtract(struct op_stats *dst, const struct op_stats *src)
+{
+	unsigned int i;
+
+	dst->calls -= src->calls;
+	dst->success -= src->success;
+	dst->enoent -= src->enoent;
+	dst->einval -= src->einval;
+	dst->eagain -= src->eagain;
+	dst->errors -= src->errors;
+	dst->bytes -= src->bytes;
+	dst->events -= src->events;
+	for (i = 0; i < 32; i++)
+		dst->mask_bits[i] -= src->mask_bits[i];
+	dst->overflows -= src->overflows;
+	dst->overflow_ahead -= src->overflow_ahead;
+	dst->overflow_queued -= src->overflow_queued;
+}
+
+/* what happened in instance inst since the warmup ended */
+static void measured_snapshot(unsigned int inst, struct instance_snapshot *snap)
+{
+	struct instance_snapshot *base;
+
+	take_snapshot(&all_td[inst], snap);
+	if (!baseline)
+		return;
+	base = &baseline[inst];
+	op_stats_subtract(&snap->ops.add, &base->ops.add);
+	op_stats_subtract(&snap->ops.rm, &base->ops.rm);
+	op_stats_subtract(&snap->ops.read, &base->ops.read);
+	op_stats_subtract(&snap->removers, &base->removers);
+	hist_subtract(&snap->add_lat, &base->add_lat);
+	hist_subtract(&snap->rm_lat, &base->rm_lat);
+	hist_subtract(&snap->read_lat, &base->read_lat);
+}
+
+static void print_latency(unsigned int inst, struct instance_snapshot *snap)
+{
+	char label[64];
+
+	snprintf(label, sizeof(label), "          inst %u inotify_add_watch", inst);
+	hist_print(stdout, label, &snap->add_lat);
+	snprintf(label, sizeof(label), "          inst %u inotify_rm_watch", inst);
+	hist_print(stdout, label, &snap->rm_lat);
+	snprintf(label, sizeof(label), "          inst %u read", inst);
+	hist_print(stdout, label, &snap->read_lat);
+}
+
+static void json_op_stats(struct json *j, const char *key, const struct op_stats *ops, double secs)
+{
+	json_object_begin(j, key);
+	json_uint(j, "calls", ops->calls);
+	json_uint(j, "ok", ops->success);
+	json_uint(j, "enoent", ops->enoent);
+	json_uint(j, "einval", ops->einval);
+	json_uint(j, "eagain", ops->eagain);
+	json_uint(j, "errors", ops->errors);
+	json_uint(j, "events", ops->events);
+	json_uint(j, "bytes", ops->bytes);
+	json_double(j, "calls_per_sec", ops->calls / secs);
+	json_double(j, "ok_per_sec", ops->success / secs);
+	if (ops->events) {
+		unsigned int bit;
+
+		json_object_begin(j, "events_by_type");
+		for (bit = 0; bit < 32; bit++)
+			if (ops->mask_bits[bit] && ev_mask_bit_name(bit))
+				json_uint(j, ev_mask_bit_name(bit), ops->mask_bits[bit]);
+		json_object_end(j);
+	}
+	if (ops->overflows) {
+		json_object_begin(j, "overflow");
+		json_uint(j, "count", ops->overflows);
+		json_double(j, "events_ahead", (double)ops->overflow_ahead / ops->overflows);
+		json_double(j, "queued_bytes", (double)ops->overflow_queued / ops->overflows);
+		json_object_end(j);
+	}
+	json_object_end(j);
+}
+
+#define PERF_HW_MASK ((1u << PERF_CYCLES) | (1u << PERF_INSTRUCTIONS) | (1u << PERF_CACHE_MISSES))
+
+/* what each role's threads counted between the end of the warmup and stopping */
+static void perf_by_role(struct perf_values *roles, unsigned int *threads)
+{
+	struct perf_slot *slot;
+	unsigned int i;
+
+	memset(roles, 0, NR_ROLES * sizeof(*roles));
+	memset(threads, 0, NR_ROLES * sizeof(*threads));
+	for (slot = perf_slots; slot; slot = slot->next) {
+		struct perf_values v = slot->end;
+
+		perf_values_subtract(&v, &slot->base);
+		perf_values_add(&roles[slot->role], &v);
+		threads[slot->role]++;
+	}
+	for (i = 0; i < NR_ROLES; i++)
+		roles[i].valid &= perf_valid;
+}
+
+/* syscalls the role made while measuring, 0 for roles we don't count */
+static unsigned long role_calls(enum thread_role role, const struct instance_snapshot *total)
+{
+	switch (role) {
+	case ROLE_ADDER:
+		return total->ops.add.calls;
+	case ROLE_REMOVER:
+		return total->removers.calls;
+	case ROLE_LOWNUM:
+		return total->ops.rm.calls - total->removers.calls;
+	case ROLE_DUMPER:
+	case ROLE_DRAINER:
+		return total->ops.read.calls;
+	default:
+		return 0;
+	}
+}
+
+static void print_perf(const struct instance_snapshot *total)
+{
+	struct perf_values roles[NR_ROLES];
+	unsigned int threads[NR_ROLES];
+	unsigned int i;
+
+	if (!perf_enabled)
+		return;
+	if (!perf_slots || !perf_valid) {
+		fprintf(stdout, "perf: no counters could be opened (check perf_event_paranoid)\n");
+		return;
+	}
+	if (!(perf_valid & PERF_HW_MASK))
+		fprintf(stdout, "perf: hardware counters unavailable, software events only\n");
+	if (perf_valid & perf_user_only) {
+		fprintf(stdout, "perf: user space only (perf_event_paranoid):");
+		for (i = 0; i < PERF_NR_COUNTERS; i++)
+			if (perf_valid & perf_user_only & (1u << i))
+				fprintf(stdout, " %s", perf_counter_name(i));
+		fprintf(stdout, "\n");
+	}
+
+	perf_by_role(roles, threads);
+	for (i = 0; i < NR_ROLES; i++) {
+		const struct perf_values *v = &roles[i];
+		unsigned long calls = role_calls(i, total);
+
+		if (!threads[i])
+			continue;
+		fprintf(stdout, "perf %-8s threads=%u cpu=%.1fms ctxsw=%lu migrations=%lu",
+			role_names[i], threads[i], v->val[PERF_TASK_CLOCK] / 1e6,
+			(unsigned long)v->val[PERF_CONTEXT_SWITCHES],
+			(unsigned long)v->val[PERF_CPU_MIGRATIONS]);
+		if (v->valid & PERF_HW_MASK)
+			fprintf(stdout, " cycles=%lu instructions=%lu ipc=%.2f cache_misses=%lu",
+				(unsigned long)v->val[PERF_CYCLES],
+				(unsigned long)v->val[PERF_INSTRUCTIONS],
+				v->val[PERF_CYCLES] ? (double)v->val[PERF_INSTRUCTIONS] / v->val[PERF_CYCLES] : 0.0,
+				(unsigned long)v->val[PERF_CACHE_MISSES]);
+		/* lots of switches per call and little cpu per call means we're waiting on locks */
+		if (calls) {
+			fprintf(stdout, " | per call: cpu=%.0fns ctxsw=%.4f",
+				(double)v->val[PERF_TASK_CLOCK] / calls,
+				(double)v->val[PERF_CONTEXT_SWITCHES] / calls);
+			if (v->valid & PERF_HW_MASK)
+				fprintf(stdout, " cycles=%.0f", (double)v->val[PERF_CYCLES] / calls);
+		}
+		fprintf(stdout, "\n");
+	}
+}
+
+static void json_perf(struct json *j, const struct instance_snapshot *total)
+{
+	struct perf_values roles[NR_ROLES];
+	unsigned int threads[NR_ROLES];
+	unsigned int i, c;
+
+	if (!perf_enabled || !perf_slots)
+		return;
+
+	perf_by_role(roles, threads);
+	json_object_begin(j, "perf");
+	json_int(j, "hardware", (perf_valid & PERF_HW_MASK) != 0);
+	json_array_begin(j, "user_only");
+	for (c = 0; c < PERF_NR_COUNTERS; c++)
+		if (perf_valid & perf_user_only & (1u << c))
+			json_string(j, NULL, perf_counter_name(c));
+	json_array_end(j);
+	for (i = 0; i < NR_ROLES; i++) {
+		unsigned long calls = role_calls(i, total);
+
+		if (!threads[i])
+			continue;
+		json_object_begin(j, role_names[i]);
+		json_uint(j, "threads", threads[i]);
+		json_uint(j, "calls", calls);
+		for (c = 0; c < PERF_NR_COUNTERS; c++) {
+			if (!(roles[i].valid & (1u << c)))
+				continue;
+			json_uint(j, perf_counter_name(c), roles[i].val[c]);
+			if (calls) {
+				char key[64];
+
+				snprintf(key, sizeof(key), "%s_per_call", perf_counter_name(c));
+				json_double(j, key, (double)roles[i].val[c] / calls);
+			}
+		}
+		json_object_end(j);
+	}
+	json_object_end(j);
+}
+
+static void json_affinity(struct json *j)
+{
+	struct placement *p;
+
+	if (affinity == AFFINITY_NONE)
+		return;
+
+	json_object_begin(j, "affinity");
+	json_string(j, "policy", affinity_names[affinity]);
+	json_uint(j, "cpus", topo.nr);
+	json_uint(j, "cores", topo.cores);
+	json_uint(j, "packages", topo.packages);
+	json_array_begin(j, "threads");
+	for (p = placements; p; p = p->next) {
+		json_object_begin(j, NULL);
+		json_string(j, "role", role_names[p->role]);
+		json_int(j, "instance", p->instance);
+		json_uint(j, "index", p->index);
+		json_string(j, "cpus", p->cpus);
+		json_object_end(j);
+	}
+	json_array_end(j);
+	json_object_end(j);
+}
+
+/* what the run did while each scenario phase was running, summed over repeats */
+struct phase_stats {
+	double secs;
+	unsigned long adds;
+	unsigned long rms;
+	unsigned long events;
+	unsigned long file_ops;
+};
+static struct phase_stats *phase_stats;
+/* totals when the running phase started */
+static struct phase_stats phase_base;
+
+static void phase_totals(struct phase_stats *ps)
+{
+	struct instance_stats cur;
+	struct op_stats files;
+	unsigned int i;
+
+	memset(ps, 0, sizeof(*ps));
+	ps->secs = elapsed_since(&measure_time);
+	for (i = 0; i < num_inotify_instances; i++) {
+		collect_instance_stats(&all_td[i], &cur);
+		ps->adds += cur.add.calls;
+		ps->rms += cur.rm.calls;
+		ps->events += cur.read.events;
+	}
+	memset(&files, 0, sizeof(files));
+	sum_stats(&files, creater_stats, num_file_creaters);
+	ps->file_ops = files.calls;
+}
+
+/* charge everything since phase_base to the running phase and switch to next */
+static void scenario_switch(unsigned int next)
+{
+	struct phase_stats now, *ps = &phase_stats[cur_phase];
+
+	phase_totals(&now);
+	ps->secs += now.secs - phase_base.secs;
+	ps->adds += now.adds - phase_base.adds;
+	ps->rms += now.rms - phase_base.rms;
+	ps->events += now.events - phase_base.events;
+	ps->file_ops += now.file_ops - phase_base.file_ops;
+	phase_base = now;
+	cur_phase = next;
+}
+
+static void print_scenario(void)
+{
+	unsigned int i;
+
+	if (!scenario.nr)
+		return;
+	for (i = 0; i < scenario.nr; i++) {
+		const struct phase_stats *ps = &phase_stats[i];
+
+		if (ps->secs <= 0)
+			continue;
+		fprintf(stdout, "phase %-12s %.1fs add/s=%.0f rm/s=%.0f events/s=%.0f file_ops/s=%.0f\n",
+			scenario.phases[i].name, ps->secs, ps->adds / ps->secs, ps->rms / ps->secs,
+			ps->events / ps->secs, ps->file_ops / ps->secs);
+	}
+}
+
+static void json_scenario(struct json *j)
+{
+	unsigned int i, r;
+
+	if (!scenario.nr)
+		return;
+
+	json_object_begin(j, "scenario");
+	json_string(j, "file", scenario_path);
+	json_array_begin(j, "phases");
+	for (i = 0; i < scenario.nr; i++) {
+		const struct scenario_phase *p = &scenario.phases[i];
+		const struct phase_stats *ps = &phase_stats[i];
+
+		json_object_begin(j, NULL);
+		json_string(j, "name", p->name);
+		json_double(j, "duration", p->duration_ns / 1e9);
+		json_object_begin(j, "threads");
+		for (r = 0; r < NR_SCENARIO_ROLES; r++)
+			json_uint(j, scenario_role_name(r), p->threads[r]);
+		json_object_end(j);
+		json_object_begin(j, "rate");
+		for (r = 0; r < NR_SCENARIO_ROLES; r++)
+			json_uint(j, scenario_role_name(r), p->rate[r]);
+		json_object_end(j);
+		json_object_begin(j, "mix");
+		for (r = 0; r < NR_SCENARIO_OPS; r++)
+			json_uint(j, scenario_op_name(r), p->mix[r]);
+		json_object_end(j);
+		json_uint(j, "mask", p->mask);
+		json_double(j, "secs", ps->secs);
+		json_double(j, "add_per_sec", ps->secs > 0 ? ps->adds / ps->secs : 0.0);
+		json_double(j, "rm_per_sec", ps->secs > 0 ? ps->rms / ps->secs : 0.0);
+		json_double(j, "events_per_sec", ps->secs > 0 ? ps->events / ps->secs : 0.0);
+		json_double(j, "file_ops_per_sec", ps->secs > 0 ? ps->file_ops / ps->secs : 0.0);
+		json_object_end(j);
+	}
+	json_array_end(j);
+	json_object_end(j);
+}
+
+/* everything in the final report, for scripts to compare across runs */
+static void write_json_summary(struct instance_snapshot *snaps, struct instance_snapshot *total,
+			       double secs, unsigned long wakeups, unsigned long syscalls,
+			       uint64_t cpu_ns, unsigned long overflows)
+{
+	struct json j;
+	unsigned int i;
+
+	if (json_open(&j, bench.json))
+		return;
+
+	json_bench_header(&j, "syscall_thrash", &bench);
+	json_object_begin(&j, "config");
+	json_uint(&j, "cores", num_cores);
+	json_uint(&j, "instances", num_inotify_instances);
+	json_uint(&j, "adders", num_adder_threads);
+	json_uint(&j, "removers", num_remover_threads);
+	json_uint(&j, "multiplier", watcher_multiplier);
+	json_uint(&j, "low_removers", num_low_remover_threads);
+	json_uint(&j, "data_dumpers", num_data_dumpers);
+	json_uint(&j, "file_creaters", num_file_creaters);
+	json_string(&j, "drain", drain_mode_names[drain_mode]);
+	json_uint(&j, "drainers", num_drainers);
+	json_uint(&j, "read_size", read_size);
+	json_string(&j, "remove", remove_mode_names[remove_mode]);
+	json_string(&j, "fstype", fstype);
+	json_string(&j, "affinity", affinity_names[affinity]);
+	json_string(&j, "scenario", scenario_path ? scenario_path : "");
+	json_object_end(&j);
+
+	json_double(&j, "elapsed", secs);
+	json_object_begin(&j, "totals");
+	json_op_stats(&j, "add_watch", &total->ops.add, secs);
+	json_op_stats(&j, "rm_watch", &total->ops.rm, secs);
+	json_op_stats(&j, "read", &total->ops.read, secs);
+	json_double(&j, "events_per_sec", total->ops.read.events / secs);
+	json_hist(&j, "add_watch_latency", &total->add_lat);
+	json_hist(&j, "rm_watch_latency", &total->rm_lat);
+	json_hist(&j, "read_latency", &total->read_lat);
+	json_object_end(&j);
+
+	json_object_begin(&j, "drain");
+	json_string(&j, "mode", drain_mode_names[drain_mode]);
+	json_uint(&j, "threads", num_drain_infos);
+	json_uint(&j, "wakeups", wakeups);
+	json_double(&j, "events_per_wakeup", wakeups ? (double)total->ops.read.events / wakeups : 0.0);
+	json_uint(&j, "syscalls", syscalls);
+	json_double(&j, "syscalls_per_event", total->ops.read.events ? (double)syscalls / total->ops.read.events : 0.0);
+	json_uint(&j, "cpu_ns", cpu_ns);
+	json_double(&j, "cpu_ns_per_event", total->ops.read.events ? (double)cpu_ns / total->ops.read.events : 0.0);
+	json_hist(&j, "event_latency", &drain_event_lat);
+	json_object_end(&j);
+
+	json_object_begin(&j, "removal");
+	json_string(&j, "mode", remove_mode_names[remove_mode]);
+	json_uint(&j, "calls", total->removers.calls);
+	json_uint(&j, "removed", total->removers.success);
+	json_double(&j, "hit_rate", total->removers.calls ? (double)total->removers.success / total->removers.calls : 0.0);
+	json_double(&j, "removed_per_sec", total->removers.success / secs);
+	json_uint(&j, "registry_overflows", overflows);
+	json_object_end(&j);
+
+	json_array_begin(&j, "instances");
+	for (i = 0; i < num_inotify_instances; i++) {
+		json_object_begin(&j, NULL);
+		json_uint(&j, "instance", i);
+		json_op_stats(&j, "add_watch", &snaps[i].ops.add, secs);
+		json_op_stats(&j, "rm_watch", &snaps[i].ops.rm, secs);
+		json_op_stats(&j, "read", &snaps[i].ops.read, secs);
+		json_hist(&j, "add_watch_latency", &snaps[i].add_lat);
+		json_hist(&j, "rm_watch_latency", &snaps[i].rm_lat);
+		json_hist(&j, "read_latency", &snaps[i].read_lat);
+		json_object_end(&j);
+	}
+	json_array_end(&j);
+	json_perf(&j, total);
+	json_affinity(&j);
+	json_scenario(&j);
+
+	json_close(&j);
+}
+
+/* final numbers for each instance (excluding the warmup) once everything has stopped */
+static void print_final_stats(void)
+{
+	struct instance_snapshot *snaps, *total;
+	struct instance_stats zero;
+	double secs = measured_secs;
+	unsigned long wakeups = 0, syscalls = 0, overflows = 0;
+	uint64_t cpu_ns = 0;
+	unsigned int i;
+
+	/* histograms are much too large for the stack */
+	snaps = calloc(num_inotify_instances, sizeof(*snaps));
+	total = calloc(1, sizeof(*total));
+	if (!snaps || !total)
+		handle_error("allocating final stats");
+
+	memset(&zero, 0, sizeof(zero));
+	fprintf(stdout, "Measured for %.1f seconds\n", secs);
+	for (i = 0; i < num_inotify_instances; i++) {
+		struct instance_snapshot *cur = &snaps[i];
+
+		measured_snapshot(i, cur);
+		print_instance_rates("    total", i, &cur->ops, &zero, secs);
+		fprintf(stdout, "          add_watch calls=%lu ok=%lu enoent=%lu "
+			"rm_watch calls=%lu ok=%lu einval=%lu "
+			"read calls=%lu eagain=%lu errors=%lu events=%lu bytes=%lu\n",
+			cur->ops.add.calls, cur->ops.add.success, cur->ops.add.enoent,
+			cur->ops.rm.calls, cur->ops.rm.success, cur->ops.rm.einval,
+			cur->ops.read.calls, cur->ops.read.eagain, cur->ops.read.errors,
+			cur->ops.read.events, cur->ops.read.bytes);
+		print_latency(i, cur);
+
+		/* the instance numbers are deltas, adding them up is safe */
+		sum_op_stats(&total->ops.add, &cur->ops.add);
+		sum_op_stats(&total->ops.rm, &cur->ops.rm);
+		sum_op_stats(&total->ops.read, &cur->ops.read);
+		sum_op_stats(&total->removers, &cur->removers);
+		hist_merge(&total->add_lat, &cur->add_lat);
+		hist_merge(&total->rm_lat, &cur->rm_lat);
+		hist_merge(&total->read_lat, &cur->read_lat);
+		overflows += all_td[i].registry->overflows;
+	}
+
+	/* what did it cost to consume the events, so the drain modes can be compared */
+	for (i = 0; i < num_drain_infos; i++) {
+		wakeups += drain_infos[i].wakeups - drain_infos[i].wakeup_base;
+		syscalls += drain_infos[i].syscalls - drain_infos[i].syscall_base;
+		cpu_ns += drain_infos[i].cpu_ns - drain_infos[i].cpu_base;
+		hist_merge(&drain_event_lat, &drain_infos[i].event_lat);
+	}
+	fprintf(stdout, "events:");
+	for (i = 0; i < 32; i++)
+		if (total->ops.read.mask_bits[i] && ev_mask_bit_name(i))
+			fprintf(stdout, " %s=%lu", ev_mask_bit_name(i), total->ops.read.mask_bits[i]);
+	fprintf(stdout, "\n");
+	if (total->ops.read.overflows)
+		fprintf(stdout, "overflow: count=%lu events_ahead=%.0f queued_bytes=%.0f\n",
+			total->ops.read.overflows,
+			(double)total->ops.read.overflow_ahead / total->ops.read.overflows,
+			(double)total->ops.read.overflow_queued / total->ops.read.overflows);
+	fprintf(stdout, "drain: mode=%s threads=%u events=%lu reads=%lu wakeups=%lu "
+		"events/wakeup=%.2f syscalls=%lu syscalls/event=%.3f cpu=%.1fms cpu/event=%.0fns\n",
+		drain_mode_names[drain_mode], num_drain_infos,
+		total->ops.read.events, total->ops.read.calls, wakeups,
+		wakeups ? (double)total->ops.read.events / wakeups : 0.0,
+		syscalls, total->ops.read.events ? (double)syscalls / total->ops.read.events : 0.0,
+		cpu_ns / 1e6, total->ops.read.events ? (double)cpu_ns / total->ops.read.events : 0.0);
+	/* the uring drain has no read() to time from */
+	if (drain_event_lat.count)
+		hist_print(stdout, "drain event latency", &drain_event_lat);
+	if (drain_mode == DRAIN_DISPATCH) {
+		unsigned long pool_empty = 0, ring_full = 0;
+
+		for (i = 0; i < num_inotify_instances; i++) {
+			pool_empty += all_td[i].dispatch->pool_empty;
+			ring_full += all_td[i].dispatch->ring_full;
+		}
+		fprintf(stdout, "dispatch: workers=%u per instance, reader stalls pool_empty=%lu ring_full=%lu\n",
+			num_data_dumpers, pool_empty, ring_full);
+	}
+
+	/* how much of the removers' syscall budget went on watches which really existed */
+	fprintf(stdout, "removal: mode=%s calls=%lu removed=%lu hit=%.2f%% "
+		"removed/s=%.0f registry_overflows=%lu\n",
+		remove_mode_names[remove_mode], total->removers.calls, total->removers.success,
+		total->removers.calls ? 100.0 * total->removers.success / total->removers.calls : 0.0,
+		total->removers.success / secs, overflows);
+
+	print_perf(total);
+	print_scenario();
+
+	write_json_summary(snaps, total, secs, wakeups, syscalls, cpu_ns, overflows);
+
+	free(snaps);
+	free(total);
+}
+
+/* add_watch plus rm_watch calls made so far by every instance */
+static unsigned long total_ops(void)
+{
+	struct instance_stats cur;
+	unsigned long ops = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_inotify_instances; i++) {
+		collect_instance_stats(&all_td[i], &cur);
+		ops += cur.add.calls + cur.rm.calls;
+	}
+	return ops;
+}
+
+/*
+ * sit out the warmup, snapshot, then stop everything once the requested
+ * duration or number of add/rm_watch calls is done (or on SIGINT).
+ */
+static void run_until_done(void)
+{
+	unsigned long base_ops;
+	unsigned int i, next;
+
+	while (!stopped && elapsed_since(&start_time) < bench.warmup)
+		usleep(10000);
+
+	if (bench.warmup > 0) {
+		baseline = calloc(num_inotify_instances, sizeof(*baseline));
+		if (!baseline)
+			handle_error("allocating warmup baseline");
+		for (i = 0; i < num_inotify_instances; i++)
+			take_snapshot(&all_td[i], &baseline[i]);
+	}
+	perf_snapshot(0);
+	clock_gettime(CLOCK_MONOTONIC, &measure_time);
+	measuring = 1;
+	base_ops = total_ops();
+	/* the warmup ran the first phase, the measured run starts the scenario over */
+	if (scenario.nr) {
+		cur_phase = 0;
+		phase_totals(&phase_base);
+		fprintf(stdout, "scenario: phase %s\n", scenario.phases[0].name);
+	}
+
+	while (!stopped) {
+		usleep(10000);
+		if (bench.duration > 0 && elapsed_since(&measure_time) >= bench.duration)
+			stopped = 1;
+		if (bench.ops && total_ops() - base_ops >= bench.ops)
+			stopped = 1;
+		if (scenario.nr && !stopped) {
+			uint64_t ns = elapsed_since(&measure_time) * 1e9;
+
+			/* without --duration or --ops one pass through the scenario is the run */
+			if (!bench.duration && !bench.ops && ns >= scenario.total_ns) {
+				stopped = 1;
+			} else if ((next = scenario_phase_at(&scenario, ns)) != cur_phase) {
+				scenario_switch(next);
+				fprintf(stdout, "scenario: phase %s\n", scenario.phases[next].name);
+			}
+		}
+	}
+	measured_secs = elapsed_since(&measure_time);
+	perf_snapshot(1);
+	if (scenario.nr)
+		scenario_switch(cur_phase);
+}
+
 static int start_mount_fs_thread(void)
 {
 	int rc;
@@ -401,6 +2417,7 @@ static int start_mount_fs_thread(void)
 	rc = pthread_create(&mounter, &attr, __mount_fs, NULL);
 	if (rc)
 		handle_error("creating the thread to mount and unmount an fs");
+	place_thread(mounter, ROLE_MOUNTER, -1, 0);
 	WAIT_CHILD;
 
 	return 0;
@@ -427,7 +2444,7 @@ static int join_threads(struct thread_data *td)
 		pthread_join(to_join[i], &ret);
 
 	to_join = td->data_dumpers;
-	for (i = 0; i < num_data_dumpers; i++)
+	for (i = 0; to_join && i < td->num_dumper_stats; i++)
 		pthread_join(to_join[i], &ret);
 
 	return 0;
@@ -462,6 +2479,51 @@ static int str_to_uint(unsigned int *out, char *in)
 	return 0;
 }
 
+/*
+ * anything the scenario doesn't set is the hard-wired workload, then every
+ * role is sized for the busiest phase with one watched file per adder
+ */
+static int load_scenario(void)
+{
+	struct scenario_phase def;
+	unsigned int i;
+
+	memset(&def, 0, sizeof(def));
+	def.threads[SCENARIO_ADDER] = num_adder_threads * watcher_multiplier;
+	def.threads[SCENARIO_REMOVER] = num_remover_threads * watcher_multiplier;
+	def.threads[SCENARIO_LOWNUM] = num_low_remover_threads;
+	def.threads[SCENARIO_CREATER] = num_file_creaters;
+	/* each creater recreating every file every 2 seconds */
+	def.rate[SCENARIO_CREATER] = num_file_creaters * num_adder_threads / 2;
+	if (!def.rate[SCENARIO_CREATER])
+		def.rate[SCENARIO_CREATER] = 1;
+	def.mix[SCENARIO_CREATE] = 1;
+	def.mask = IN_ALL_EVENTS;
+	def.mount_ns = 100000000ull;
+	def.lowwd_ns = 1000000000ull;
+
+	if (scenario_load(&scenario, scenario_path, &def))
+		return -1;
+
+	/* a role no phase uses still gets a (parked) thread */
+	for (i = 0; i < NR_SCENARIO_ROLES; i++)
+		if (!scenario.max_threads[i])
+			scenario.max_threads[i] = 1;
+	watcher_multiplier = 1;
+	num_adder_threads = scenario.max_threads[SCENARIO_ADDER];
+	num_remover_threads = scenario.max_threads[SCENARIO_REMOVER];
+	num_low_remover_threads = scenario.max_threads[SCENARIO_LOWNUM];
+	num_file_creaters = scenario.max_threads[SCENARIO_CREATER];
+
+	phase_stats = calloc(scenario.nr, sizeof(*phase_stats));
+	if (!phase_stats)
+		return -1;
+
+	fprintf(stdout, "scenario: %s, %u phases, %.1fs per pass\n",
+		scenario_path, scenario.nr, scenario.total_ns / 1e9);
+	return 0;
+}
+
 static int process_args(int argc, char *argv[])
 {
 	int c;
@@ -478,10 +2540,19 @@ static int process_args(int argc, char *argv[])
 		    {"dir", required_argument,		0, 't'},
 		    {"source_mnt", required_argument,	0, 's'},
 		    {"fstype", required_argument,	0, 'f'},
+		    {"interval", required_argument,	0, 'I'},
+		    {"drain", required_argument,	0, 'D'},
+		    {"drainers", required_argument,	0, 'n'},
+		    {"remove", required_argument,	0, 'R'},
+		    {"perf", no_argument,		0, 'P'},
+		    {"affinity", required_argument,	0, 'A'},
+		    {"scenario", required_argument,	0, 'S'},
+		    {"read-size", required_argument,	0, 'b'},
+		    BENCH_LONG_OPTIONS,
 		    {0,		0,			0,  0 }
 		};
 
-		c = getopt_long(argc, argv, "c:d:m:z:r:i:t:s:f:", long_options, &option_index);
+		c = getopt_long(argc, argv, "c:d:m:z:r:i:t:s:f:I:D:n:R:PA:S:b:", long_options, &option_index);
 		if (c == -1)
 			break;
 
@@ -513,11 +2584,80 @@ static int process_args(int argc, char *argv[])
 		case 'f':
 			fstype = optarg;
 			break;
+		case 'I':
+			str_to_uint(&report_interval, optarg);
+			break;
+		case 'D':
+			if (!strcmp(optarg, "spin"))
+				drain_mode = DRAIN_SPIN;
+			else if (!strcmp(optarg, "epoll"))
+				drain_mode = DRAIN_EPOLL_LT;
+			else if (!strcmp(optarg, "epoll-et"))
+				drain_mode = DRAIN_EPOLL_ET;
+			else if (!strcmp(optarg, "uring"))
+				drain_mode = DRAIN_URING;
+			else if (!strcmp(optarg, "dispatch"))
+				drain_mode = DRAIN_DISPATCH;
+			else {
+				fprintf(stderr, "unknown drain mode %s (spin, epoll, epoll-et, uring, dispatch)\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'n':
+			str_to_uint(&num_drainers, optarg);
+			break;
+		case 'b':
+			if (!strcmp(optarg, "adaptive")) {
+				read_size = 0;
+			} else {
+				unsigned int size;
+
+				if (str_to_uint(&size, optarg) || !size || *optarg == '-') {
+					fprintf(stderr, "--read-size takes a byte count or adaptive\n");
+					return -1;
+				}
+				read_size = size;
+			}
+			break;
+		case 'R':
+			if (!strcmp(optarg, "scan"))
+				remove_mode = REMOVE_SCAN;
+			else if (!strcmp(optarg, "targeted"))
+				remove_mode = REMOVE_TARGETED;
+			else {
+				fprintf(stderr, "unknown remove mode %s (scan, targeted)\n", optarg);
+				return -1;
+			}
+			break;
+		case 'P':
+			perf_enabled = 1;
+			break;
+		case 'S':
+			scenario_path = optarg;
+			break;
+		case 'A':
+			for (affinity = 0; affinity < NR_AFFINITY; affinity++)
+				if (!strcmp(optarg, affinity_names[affinity]))
+					break;
+			if (affinity == NR_AFFINITY) {
+				fprintf(stderr, "unknown affinity %s (none, compact, scatter, instance, "
+					"siblings, distant)\n", optarg);
+				return -1;
+			}
+			break;
 		default:
+			if (c >= BENCH_OPT_BASE) {
+				if (bench_parse_opt(&bench, c, optarg))
+					return -1;
+				break;
+			}
 			printf("?? unknown option 0%o ??\n", c);
 			return -1;
 		}
 	}
+	if (bench_opts_done(&bench, BENCH_ALL))
+		return 1;
 
 	if (optind < argc) {
 		printf("non-option ARGV-elements: ");
@@ -535,6 +2675,9 @@ static int process_args(int argc, char *argv[])
 	if (num_data_dumpers == 0)
 		num_data_dumpers = 1;
 
+	if (num_drainers == 0)
+		num_drainers = 1;
+
 	if (watcher_multiplier == 0)
 		watcher_multiplier = 2;
 
@@ -553,9 +2696,23 @@ static int process_args(int argc, char *argv[])
 	if (num_adder_threads == 0)
 		num_adder_threads = 3;
 
+	/* the reader won't go below one whole record, report the size it really uses */
+	if (read_size) {
+		struct ev_reader rd;
+
+		drain_reader_init(&rd);
+		if (rd.min != read_size)
+			fprintf(stdout, "read size raised from %zu to %zu bytes\n", read_size, rd.min);
+		read_size = rd.min;
+		ev_reader_free(&rd);
+	}
+
 	if (num_remover_threads == 0)
 		num_remover_threads = num_adder_threads;
 
+	if (scenario_path)
+		return load_scenario();
+
 	return 0;
 }
 
@@ -567,6 +2724,7 @@ int main(int argc, char *argv[])
 	unsigned int i;
 	struct sigaction setmask;
 
+	bench_opts_init(&bench);
 	rc = process_args(argc, argv);
 	if (rc)
 		handle_error("processing arguments");
@@ -580,6 +2738,13 @@ int main(int argc, char *argv[])
 	/* make sure the directory exists */
 	mkdir(working_dir, S_IRWXU);
 
+	if (affinity != AFFINITY_NONE) {
+		if (cpu_topo_init(&topo))
+			handle_error("reading cpu topology");
+		fprintf(stdout, "affinity: %s over %u cpus, %u cores, %u packages\n",
+			affinity_names[affinity], topo.nr, topo.cores, topo.packages);
+	}
+
 	/* set up a pthread attr with a tiny stack */
 	rc = pthread_attr_init(&attr);
 	if (rc)
@@ -591,6 +2756,19 @@ int main(int argc, char *argv[])
 	td = calloc(num_inotify_instances, sizeof(*td));
 	if (!td)
 		handle_error("allocating inotify td array");
+	all_td = td;
+
+	if (drain_mode == DRAIN_SPIN)
+		num_drain_infos = num_inotify_instances * num_data_dumpers;
+	else if (drain_mode == DRAIN_DISPATCH)
+		num_drain_infos = num_inotify_instances * (num_data_dumpers + 1);
+	else
+		num_drain_infos = num_drainers;
+	drain_infos = calloc_aligned(num_drain_infos, sizeof(*drain_infos));
+	if (!drain_infos)
+		handle_error("allocating drain accounting");
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
 
 	/* create an inotify instance and make it O_NONBLOCK */
 	for (i = 0; i < num_inotify_instances; i++) {
@@ -604,6 +2782,12 @@ int main(int argc, char *argv[])
 		t = &td[i];
 		t->inotify_fd = fd;
 
+		t->registry = calloc_aligned(1, sizeof(*t->registry));
+		if (!t->registry)
+			handle_error("allocating live wd registry");
+		if (mpmc_init(&t->registry->queue, WD_REGISTRY_SIZE))
+			handle_error("allocating live wd registry queue");
+
 		rc = start_watch_creation_threads(t);
 		if (rc)
 			handle_error("creating watch adding threads");
@@ -616,11 +2800,20 @@ int main(int argc, char *argv[])
 		if (rc)
 			handle_error("creating lownum watch remover threads");
 
-		rc = start_data_dumping_threads(t);
+		if (drain_mode == DRAIN_DISPATCH)
+			rc = start_dispatch_threads(t);
+		else if (drain_mode == DRAIN_SPIN)
+			rc = start_data_dumping_threads(t);
 		if (rc)
 			handle_error("creating data dumping threads");
 	}
 
+	if (drain_mode != DRAIN_SPIN && drain_mode != DRAIN_DISPATCH) {
+		rc = start_drain_threads();
+		if (rc)
+			handle_error("creating drain threads");
+	}
+
 	rc = start_file_creater_threads();
 	if (rc)
 		handle_error("creating file creation/rm threads");
@@ -633,6 +2826,14 @@ int main(int argc, char *argv[])
 	if (rc)
 		handle_error("starting mounting thread");
 
+	if (report_interval) {
+		rc = start_reporter_thread();
+		if (rc)
+			handle_error("starting stats reporter thread");
+	}
+
+	run_until_done();
+
 	/* join the per inotify instance threads */
 	for (i = 0; i < num_inotify_instances; i++)
 		join_threads(&td[i]);
@@ -640,8 +2841,15 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num_file_creaters; i++)
 		pthread_join(file_creaters[i], &ret);
 
+	for (i = 0; drainers && i < num_drainers; i++)
+		pthread_join(drainers[i], &ret);
+
 	pthread_join(low_wd_reseter, &ret);
 	pthread_join(mounter, &ret);
+	if (report_interval)
+		pthread_join(reporter, &ret);
+
+	print_final_stats();
 
 	/* clean up the tmp dir which should be empty */
 	rmdir(working_dir);
@@ -651,8 +2859,27 @@ int main(int argc, char *argv[])
 		free(td[i].removers);
 		free(td[i].lownum_removers);
 		free(td[i].data_dumpers);
+		free(td[i].adder_stats);
+		free(td[i].remover_stats);
+		free(td[i].lownum_stats);
+		free(td[i].dumper_stats);
+		free_dispatch(td[i].dispatch);
+		mpmc_destroy(&td[i].registry->queue);
+		free(td[i].registry);
 	}
 	free(td);
 	free(file_creaters);
+	free(drainers);
+	free(drain_infos);
+	while (placements) {
+		struct placement *p = placements;
+
+		placements = p->next;
+		free(p);
+	}
+	cpu_topo_destroy(&topo);
+	free(creater_stats);
+	free(phase_stats);
+	scenario_free(&scenario);
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,15 @@
+#!/bin/bash
+# time registering trees of growing size with 1 and N walker threads
+# usage: tree_scale.sh [scratch dir] [sizes...]
+dir=${1:-/tmp/inotify_tree_scale}
+shift
+sizes=${@:-1000 10000 40000}
+for size in $sizes; do
+	rm -rf "$dir"
+	./inotify_tree --populate "$size" --watch-only --json /dev/null "$dir" > /dev/null
+	for threads in 1 $(nproc); do
+		echo -n "$size dirs: "
+		./inotify_tree --threads "$threads" --watch-only --json /dev/null "$dir" | grep "^watched"
+	done
+done
+rm -rf "$dir"
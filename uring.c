@@ -0,0 +1,337 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER	(1U << 12)
+#endif
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN	(1U << 13)
+#endif
+
+/* an enum in newer headers, so it can't be tested for; old kernels fail it with EINVAL */
+#define URING_OP_READ_MULTISHOT	49
+
+#define URING_SQ_ENTRIES	64
+
+static int sys_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		     unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned int opcode, void *arg, unsigned int nr)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+static void buf_recycle(struct uring *r, unsigned int bid)
+{
+	struct io_uring_buf *buf = &r->br->bufs[r->br_tail & (r->nr_bufs - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * r->buf_size);
+	buf->len = r->buf_size;
+	buf->bid = bid;
+	r->br_tail++;
+	__atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+static int rings_map(struct uring *r, const struct io_uring_params *p)
+{
+	r->ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	r->cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->ring_size)
+			r->ring_size = r->cq_size;
+		r->cq_size = 0;
+	}
+	r->ring_mem = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			   r->fd, IORING_OFF_SQ_RING);
+	if (r->ring_mem == MAP_FAILED)
+		return -1;
+	r->cq_mem = r->ring_mem;
+	if (r->cq_size) {
+		r->cq_mem = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				 r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_mem == MAP_FAILED)
+			return -1;
+	}
+	r->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		return -1;
+
+	r->sq_head = (unsigned int *)((char *)r->ring_mem + p->sq_off.head);
+	r->sq_tail = (unsigned int *)((char *)r->ring_mem + p->sq_off.tail);
+	r->sq_array = (unsigned int *)((char *)r->ring_mem + p->sq_off.array);
+	r->sq_mask = *(unsigned int *)((char *)r->ring_mem + p->sq_off.ring_mask);
+	r->sq_entries = p->sq_entries;
+	r->cq_head = (unsigned int *)((char *)r->cq_mem + p->cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_mem + p->cq_off.tail);
+	r->cq_mask = *(unsigned int *)((char *)r->cq_mem + p->cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_mem + p->cq_off.cqes);
+	return 0;
+}
+
+static int bufs_register(struct uring *r)
+{
+	struct io_uring_buf_reg reg;
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned int i;
+
+	r->br_size = (r->nr_bufs * sizeof(struct io_uring_buf) + page - 1) & ~(page - 1);
+	r->br = mmap(NULL, r->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r->br == MAP_FAILED) {
+		r->br = NULL;
+		return -1;
+	}
+	if (posix_memalign((void **)&r->bufs, 64, (size_t)r->nr_bufs * r->buf_size)) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)r->br;
+	reg.ring_entries = r->nr_bufs;
+	reg.bgid = 0;
+	if (sys_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+		return -1;
+	for (i = 0; i < r->nr_bufs; i++)
+		buf_recycle(r, i);
+	return 0;
+}
+
+int uring_init(struct uring *r, unsigned int nr_bufs, unsigned int buf_size)
+{
+	struct io_uring_params p;
+	unsigned int cq_entries;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	r->held_bid = -1;
+	if (!nr_bufs || (nr_bufs & (nr_bufs - 1)) || nr_bufs > 32768) {
+		errno = EINVAL;
+		return -1;
+	}
+	r->nr_bufs = nr_bufs;
+	r->buf_size = buf_size;
+
+	/* every completion holds a buffer, so that bounds what can be outstanding */
+	cq_entries = nr_bufs * 2 > URING_SQ_ENTRIES * 2 ? nr_bufs * 2 : URING_SQ_ENTRIES * 2;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	p.cq_entries = cq_entries;
+	r->fd = sys_setup(URING_SQ_ENTRIES, &p);
+	if (r->fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+		r->fd = sys_setup(URING_SQ_ENTRIES, &p);
+	}
+	if (r->fd < 0)
+		return -1;
+	/* waiting with a timeout needs the extended enter argument */
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		uring_destroy(r);
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	r->flags = p.flags;
+	if (rings_map(r, &p) || bufs_register(r)) {
+		int err = errno;
+
+		uring_destroy(r);
+		errno = err;
+		return -1;
+	}
+	r->multishot = 1;
+	return 0;
+}
+
+void uring_destroy(struct uring *r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_size && r->cq_mem && r->cq_mem != MAP_FAILED)
+		munmap(r->cq_mem, r->cq_size);
+	if (r->ring_mem && r->ring_mem != MAP_FAILED)
+		munmap(r->ring_mem, r->ring_size);
+	if (r->br)
+		munmap(r->br, r->br_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->bufs);
+	free(r->reads);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+static int flush(struct uring *r)
+{
+	int ret;
+
+	r->stats.enters++;
+	ret = sys_enter(r->fd, r->sq_pending, 0, 0, NULL, 0);
+	if (ret < 0)
+		return -1;
+	r->sq_pending -= ret;
+	return 0;
+}
+
+/* queue a read on reads[idx], it goes in with the next enter */
+static int post(struct uring *r, unsigned int idx)
+{
+	unsigned int tail = *r->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries && flush(r))
+		return -1;
+	sqe = &r->sqes[tail & r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = r->multishot ? URING_OP_READ_MULTISHOT : IORING_OP_READ;
+	/* the index in to the registered files */
+	sqe->fd = idx;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	/* a multishot read takes its length from each buffer */
+	sqe->len = r->multishot ? 0 : r->buf_size;
+	sqe->user_data = idx;
+	r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->sq_pending++;
+	r->reads[idx].armed = 1;
+	return 0;
+}
+
+int uring_add_reads(struct uring *r, const int *fds, const uint64_t *user_data, unsigned int nr)
+{
+	unsigned int i;
+
+	/* the files are registered in one go, so this is once per ring */
+	if (r->reads) {
+		errno = EBUSY;
+		return -1;
+	}
+	r->reads = calloc(nr, sizeof(*r->reads));
+	if (!r->reads)
+		return -1;
+	r->nr_reads = nr;
+	if (sys_register(r->fd, IORING_REGISTER_FILES, (void *)fds, nr))
+		return -1;
+	for (i = 0; i < nr; i++) {
+		r->reads[i].fd = fds[i];
+		r->reads[i].user_data = user_data[i];
+		if (post(r, i))
+			return -1;
+	}
+	return 0;
+}
+
+static unsigned int cq_ready(struct uring *r)
+{
+	return __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+}
+
+static void release_held(struct uring *r)
+{
+	if (r->held_bid < 0)
+		return;
+	buf_recycle(r, r->held_bid);
+	r->held_bid = -1;
+}
+
+int uring_wait(struct uring *r, int timeout_ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int ready;
+	int ret;
+
+	release_held(r);
+	if (r->unarmed) {
+		unsigned int i;
+
+		for (i = 0; i < r->nr_reads; i++)
+			if (!r->reads[i].armed && post(r, i))
+				return -1;
+		r->unarmed = 0;
+	}
+	ready = cq_ready(r);
+	if (ready && !r->sq_pending)
+		return ready;
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+	r->stats.enters++;
+	ret = sys_enter(r->fd, r->sq_pending, ready || !timeout_ms ? 0 : 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+		return -1;
+	if (ret > 0)
+		r->sq_pending -= ret;
+	return cq_ready(r);
+}
+
+int uring_next(struct uring *r, uint64_t *user_data, const char **buf, int *len)
+{
+	struct io_uring_cqe cqe;
+	unsigned int head;
+
+	release_held(r);
+	for (;;) {
+		struct uring_read *rd;
+
+		head = *r->cq_head;
+		if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+			return 0;
+		cqe = r->cqes[head & r->cq_mask];
+		__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+		r->stats.completions++;
+		if (cqe.user_data >= r->nr_reads)
+			continue;
+		rd = &r->reads[cqe.user_data];
+
+		if (!(cqe.flags & IORING_CQE_F_MORE)) {
+			rd->armed = 0;
+			/* no multishot read for this kernel or this file, fall back for good */
+			if (r->multishot && (cqe.res == -EINVAL || cqe.res == -EBADFD)) {
+				r->multishot = 0;
+				if (post(r, cqe.user_data))
+					r->unarmed = 1;
+				continue;
+			}
+			/* an fd nobody reads is worse than a read which fails again */
+			r->stats.reposts++;
+			if (post(r, cqe.user_data))
+				r->unarmed = 1;
+		}
+		if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -EAGAIN)
+			r->stats.errors++;
+		if (cqe.res == -ENOBUFS) {
+			r->stats.nobufs++;
+			continue;
+		}
+		if (cqe.flags & IORING_CQE_F_BUFFER) {
+			r->held_bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+			*buf = r->bufs + (size_t)r->held_bid * r->buf_size;
+		} else {
+			*buf = NULL;
+		}
+		*user_data = rd->user_data;
+		*len = cqe.res;
+		return 1;
+	}
+}
@@ -0,0 +1,92 @@
+#ifndef __URING_H
+#define __URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+ * just enough io_uring, on the raw syscalls, to keep reads posted on a set
+ * of fds and have one io_uring_enter() both re-submit and wait.  The reads
+ * pick their buffers from a provided buffer ring, so nothing is tied up per
+ * fd while it is idle, and the fds are registered so no fget per read.
+ *
+ * Each fd gets a multishot read (IORING_OP_READ_MULTISHOT) which keeps
+ * completing until it runs out of buffers or fails; it is then posted
+ * again, whatever the error, which still comes back from uring_next().  Kernels without multishot read get a plain read, re-posted after
+ * every completion.  An fd with nothing queued just arms a poll, but the
+ * fds have to be O_NONBLOCK: inotify ignores IOCB_NOWAIT, so io_uring
+ * would otherwise hand the read to a worker to block in.
+ *
+ * One thread per ring, it is created with SINGLE_ISSUER and DEFER_TASKRUN
+ * where the kernel has them, so create it in the thread that uses it.
+ */
+struct uring_read {
+	int fd;
+	uint64_t user_data;
+	/* a read is posted (or about to be) for the fd */
+	int armed;
+};
+
+struct uring_stats {
+	/* io_uring_enter() calls, the only syscalls a reader makes */
+	unsigned long enters;
+	unsigned long completions;
+	/* reads posted again after they stopped */
+	unsigned long reposts;
+	/* completions which found the buffer ring empty */
+	unsigned long nobufs;
+	/* completions failing with anything but ENOBUFS or EAGAIN */
+	unsigned long errors;
+};
+
+struct uring {
+	int fd;
+	unsigned int flags;
+	/* submission ring */
+	unsigned int *sq_head, *sq_tail, *sq_array;
+	unsigned int sq_mask, sq_entries, sq_pending;
+	struct io_uring_sqe *sqes;
+	/* completion ring */
+	unsigned int *cq_head, *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring_mem, *cq_mem;
+	size_t ring_size, cq_size, sqes_size;
+	/* provided buffers, group 0 */
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	char *bufs;
+	unsigned int nr_bufs, buf_size;
+	uint16_t br_tail;
+	/* the buffer handed out by the last uring_next(), recycled by the next call */
+	int held_bid;
+	int multishot;
+	/* a read couldn't be posted again from uring_next(), uring_wait() retries */
+	int unarmed;
+	struct uring_read *reads;
+	unsigned int nr_reads;
+	struct uring_stats stats;
+};
+
+/* nr_bufs must be a power of 2.  Returns -1 with errno set on failure */
+int uring_init(struct uring *r, unsigned int nr_bufs, unsigned int buf_size);
+void uring_destroy(struct uring *r);
+/* keep a read posted on each of fds, user_data[i] comes back with fds[i]'s data */
+int uring_add_reads(struct uring *r, const int *fds, const uint64_t *user_data, unsigned int nr);
+
+/*
+ * submit anything pending and wait up to timeout_ms for a completion, 0 to
+ * only reap.  Returns how many completions are ready, -1 on error, which
+ * includes a read that stopped and can't be posted again.
+ */
+int uring_wait(struct uring *r, int timeout_ms);
+
+/*
+ * the next read completion: 1 with *user_data, *buf and *len (the bytes
+ * read, or -errno) filled in, 0 if there are none.  buf stays valid until
+ * the next call.
+ */
+int uring_next(struct uring *r, uint64_t *user_data, const char **buf, int *len);
+
+#endif /* __URING_H */
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wdtable.h"
+
+/* deeper than this is either a loop or not worth printing */
+#define WDTABLE_MAX_DEPTH	256
+
+int wdtable_init(struct wd_table *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->arena_size = 64 * 1024;
+	t->arena = malloc(t->arena_size);
+	t->intern_mask = 1023;
+	t->intern = calloc(t->intern_mask + 1, sizeof(*t->intern));
+	if (!t->arena || !t->intern) {
+		free(t->arena);
+		free(t->intern);
+		return -1;
+	}
+	/* offset 0 is never a real name so it can mark unused entries */
+	t->arena[0] = '\0';
+	t->arena_used = 1;
+	return 0;
+}
+
+void wdtable_destroy(struct wd_table *t)
+{
+	free(t->entries);
+	free(t->arena);
+	free(t->intern);
+	memset(t, 0, sizeof(*t));
+}
+
+/* names are preceded by their length, 2 bytes as roots are whole paths */
+static size_t name_len(const char *name)
+{
+	return (unsigned char)name[-2] | (unsigned char)name[-1] << 8;
+}
+
+/* fnv-1a, names are short so nothing fancier pays for itself */
+static uint32_t name_hash(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int intern_grow(struct wd_table *t)
+{
+	unsigned int mask = t->intern_mask * 2 + 1;
+	uint32_t *intern;
+	unsigned int i, slot;
+
+	intern = calloc(mask + 1, sizeof(*intern));
+	if (!intern)
+		return -1;
+	for (i = 0; i <= t->intern_mask; i++) {
+		const char *name;
+
+		if (!t->intern[i])
+			continue;
+		name = t->arena + t->intern[i];
+		slot = name_hash(name, name_len(name)) & mask;
+		while (intern[slot])
+			slot = (slot + 1) & mask;
+		intern[slot] = t->intern[i];
+	}
+	free(t->intern);
+	t->intern = intern;
+	t->intern_mask = mask;
+	return 0;
+}
+
+/* arena offset of name, adding it if we haven't seen it.  0 on failure */
+static uint32_t intern_name(struct wd_table *t, const char *name)
+{
+	size_t len = strlen(name);
+	unsigned int slot;
+	uint32_t off;
+
+	/* keep the set at most half full */
+	if ((t->intern_count + 1) * 2 > t->intern_mask + 1 && intern_grow(t))
+		return 0;
+
+	slot = name_hash(name, len) & t->intern_mask;
+	if (len > UINT16_MAX)
+		return 0;
+	while ((off = t->intern[slot])) {
+		if (name_len(t->arena + off) == len && !memcmp(t->arena + off, name, len))
+			return off;
+		slot = (slot + 1) & t->intern_mask;
+	}
+
+	if (t->arena_used + len + 3 > t->arena_size) {
+		size_t size = t->arena_size * 2;
+		char *arena;
+
+		while (t->arena_used + len + 3 > size)
+			size *= 2;
+		if (size > UINT32_MAX)
+			return 0;
+		arena = realloc(t->arena, size);
+		if (!arena)
+			return 0;
+		t->arena = arena;
+		t->arena_size = size;
+	}
+	t->arena[t->arena_used] = len & 0xff;
+	t->arena[t->arena_used + 1] = len >> 8;
+	off = t->arena_used + 2;
+	memcpy(t->arena + off, name, len);
+	t->arena[off + len] = '\0';
+	t->arena_used += len + 3;
+	t->intern[slot] = off;
+	t->intern_count++;
+	return off;
+}
+
+int wdtable_add(struct wd_table *t, int wd, int parent_wd, const char *name)
+{
+	struct wd_entry *e;
+	uint32_t off;
+	int ret;
+
+	if (wd < 0)
+		return -1;
+	if ((unsigned int)wd >= t->size) {
+		unsigned int size = t->size ? t->size : 1024;
+		struct wd_entry *entries;
+
+		while (size <= (unsigned int)wd)
+			size *= 2;
+		entries = realloc(t->entries, size * sizeof(*entries));
+		if (!entries)
+			return -1;
+		memset(entries + t->size, 0, (size - t->size) * sizeof(*entries));
+		t->entries = entries;
+		t->size = size;
+	}
+
+	off = intern_name(t, name);
+	if (!off)
+		return -1;
+
+	e = &t->entries[wd];
+	ret = !e->name;
+	if (ret)
+		t->live++;
+	e->parent_wd = parent_wd;
+	e->name = off;
+	return ret;
+}
+
+void wdtable_remove(struct wd_table *t, int wd)
+{
+	if ((unsigned int)wd >= t->size || !t->entries[wd].name)
+		return;
+	t->entries[wd].name = 0;
+	t->live--;
+}
+
+int wdtable_path(const struct wd_table *t, int wd, char *buf, size_t len)
+{
+	uint32_t chain[WDTABLE_MAX_DEPTH];
+	unsigned int depth = 0;
+	size_t pos = 0;
+
+	/* collect the names leaf first, then copy them out root first */
+	while (wd != WDTABLE_NO_PARENT) {
+		const struct wd_entry *e = wdtable_lookup(t, wd);
+
+		if (!e || depth == WDTABLE_MAX_DEPTH)
+			return -1;
+		chain[depth++] = e->name;
+		wd = e->parent_wd;
+	}
+
+	while (depth--) {
+		const char *name = t->arena + chain[depth];
+		size_t n = name_len(name);
+
+		if (pos + n + 2 > len)
+			return -1;
+		memcpy(buf + pos, name, n);
+		pos += n;
+		if (depth)
+			buf[pos++] = '/';
+	}
+	if (pos >= len)
+		return -1;
+	buf[pos] = '\0';
+	return pos;
+}
+
+size_t wdtable_bytes(const struct wd_table *t)
+{
+	return t->size * sizeof(*t->entries) + t->arena_size +
+	       (t->intern_mask + 1) * sizeof(*t->intern);
+}
@@ -0,0 +1,78 @@
+#ifndef __WDTABLE_H
+#define __WDTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * wd to path table.  Each watch is stored as the wd of its parent directory
+ * plus its own name component, the names are interned in one arena so the
+ * thousands of "src" and "lib" directories in a tree share a single copy.
+ * An entry is 8 bytes and the table is indexed directly by wd, which the
+ * kernel hands out densely, so lookup is one load.  Full paths are only
+ * built when something actually asks for one.
+ *
+ * Names are stored with their length in front so building a path doesn't
+ * have to strlen() every component.
+ *
+ * Renaming a directory is just a new parent and name for its one entry,
+ * everything below it follows automatically.
+ *
+ * Not thread safe, callers sharing a table need their own lock.
+ */
+#define WDTABLE_NO_PARENT	(-1)
+
+struct wd_entry {
+	int32_t parent_wd;
+	/* offset of the name in the arena, 0 for an unused entry */
+	uint32_t name;
+};
+
+struct wd_table {
+	struct wd_entry *entries;
+	unsigned int size;
+	unsigned int live;
+	char *arena;
+	size_t arena_used;
+	size_t arena_size;
+	/* open addressed set of arena offsets, for interning */
+	uint32_t *intern;
+	unsigned int intern_mask;
+	unsigned int intern_count;
+};
+
+int wdtable_init(struct wd_table *t);
+void wdtable_destroy(struct wd_table *t);
+
+/*
+ * wd is parent_wd/name.  Returns 1 for a new wd, 0 if wd was already in the
+ * table (its parent and name are updated, which is how renames are handled)
+ * and -1 if we ran out of memory.  The root of a tree has no parent and its
+ * name is the whole path to it.
+ */
+int wdtable_add(struct wd_table *t, int wd, int parent_wd, const char *name);
+/* on IN_IGNORED, the interned name stays for the next user of it */
+void wdtable_remove(struct wd_table *t, int wd);
+
+static inline const struct wd_entry *wdtable_lookup(const struct wd_table *t, int wd)
+{
+	if ((unsigned int)wd >= t->size || !t->entries[wd].name)
+		return NULL;
+	return &t->entries[wd];
+}
+
+static inline const char *wdtable_name(const struct wd_table *t, const struct wd_entry *e)
+{
+	return t->arena + e->name;
+}
+
+/*
+ * write the full path of wd in to buf.  Returns its length, or -1 if wd (or
+ * one of its parents) isn't in the table or the path doesn't fit.
+ */
+int wdtable_path(const struct wd_table *t, int wd, char *buf, size_t len);
+
+/* heap bytes held by the table, entries + arena + intern set */
+size_t wdtable_bytes(const struct wd_table *t);
+
+#endif /* __WDTABLE_H */
@@ -0,0 +1,299 @@
+/*
+ * compare the wd_table against what most consumers do: a chained hash map
+ * from wd to a malloc'd copy of the full path.  Both are filled from the
+ * same synthetic tree, with directory names drawn from a small vocabulary
+ * of common names plus unique ones, and then hit with the same random wds.
+ * Reports heap bytes per watch for each and lookup throughput, both for the
+ * table's O(1) entry lookup and for building the full path out of it.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "memacct.h"
+#include "wdtable.h"
+
+#define LOOKUPS		65536
+#define ROOT		"/srv/data/tree"
+
+static struct bench_opts bench;
+static unsigned long num_dirs = 100000;
+static unsigned int fanout = 10;
+static int wds[LOOKUPS];
+
+/* names that turn up over and over in real trees */
+static const char *common[] = {
+	"src", "lib", "include", "test", "tests", "build", "docs", "bin",
+	".git", "objects", "refs", "node_modules", "dist", "tmp", "cache", "logs",
+};
+
+/* the hash map side, one malloc'd node and one strdup'd path per watch */
+struct map_node {
+	struct map_node *next;
+	int wd;
+	char *path;
+};
+
+struct map {
+	struct map_node **buckets;
+	unsigned int mask;
+};
+
+static struct map map;
+static struct wd_table table;
+static char **names;
+
+static void map_insert(int wd, const char *path)
+{
+	struct map_node *node = malloc(sizeof(*node));
+	unsigned int b = wd & map.mask;
+
+	if (!node) {
+		perror("allocating map node");
+		exit(1);
+	}
+	node->wd = wd;
+	node->path = strdup(path);
+	node->next = map.buckets[b];
+	map.buckets[b] = node;
+}
+
+static const char *map_lookup(int wd)
+{
+	struct map_node *node;
+
+	for (node = map.buckets[wd & map.mask]; node; node = node->next)
+		if (node->wd == wd)
+			return node->path;
+	return NULL;
+}
+
+/* directory n (1 based) is a child of (n - 1) / fanout, wd n + 1 */
+static void build_names(void)
+{
+	uint64_t rng = bench.seed;
+	unsigned long n;
+
+	names = calloc(num_dirs + 1, sizeof(*names));
+	if (!names) {
+		perror("allocating names");
+		exit(1);
+	}
+	names[0] = strdup(ROOT);
+	for (n = 1; n <= num_dirs; n++) {
+		char name[32];
+
+		/* three in four directories have a common name */
+		if (bench_rand(&rng) % 4)
+			snprintf(name, sizeof(name), "%s",
+				 common[bench_rand(&rng) % (sizeof(common) / sizeof(common[0]))]);
+		else
+			snprintf(name, sizeof(name), "dir-%lu", n);
+		names[n] = strdup(name);
+	}
+}
+
+static double build_table(size_t *bytes)
+{
+	size_t before = memacct_heap_bytes();
+	uint64_t start = now_ns();
+	unsigned long n;
+
+	if (wdtable_init(&table)) {
+		perror("wdtable_init");
+		exit(1);
+	}
+	wdtable_add(&table, 1, WDTABLE_NO_PARENT, names[0]);
+	for (n = 1; n <= num_dirs; n++)
+		if (wdtable_add(&table, n + 1, (n - 1) / fanout + 1, names[n]) < 0) {
+			perror("wdtable_add");
+			exit(1);
+		}
+	*bytes = memacct_heap_bytes() - before;
+	return (now_ns() - start) / 1e9;
+}
+
+static double build_map(size_t *bytes)
+{
+	size_t before = memacct_heap_bytes();
+	uint64_t start = now_ns();
+	char path[4096];
+	unsigned long n;
+
+	map.mask = 1;
+	while (map.mask < num_dirs + 1)
+		map.mask <<= 1;
+	map.buckets = calloc(map.mask, sizeof(*map.buckets));
+	map.mask--;
+	if (!map.buckets) {
+		perror("allocating buckets");
+		exit(1);
+	}
+	/* parents always go in first, so their path is there to extend */
+	map_insert(1, names[0]);
+	for (n = 1; n <= num_dirs; n++) {
+		snprintf(path, sizeof(path), "%s/%s", map_lookup((n - 1) / fanout + 1), names[n]);
+		map_insert(n + 1, path);
+	}
+	*bytes = memacct_heap_bytes() - before;
+	return (now_ns() - start) / 1e9;
+}
+
+enum side {
+	SIDE_ENTRY,
+	SIDE_PATH,
+	SIDE_MAP,
+};
+
+/* one pass over wds, returns something depending on every lookup */
+static unsigned long run_side(enum side side)
+{
+	unsigned long sum = 0;
+	char path[4096];
+	unsigned int i;
+
+	for (i = 0; i < LOOKUPS; i++) {
+		const struct wd_entry *e;
+		const char *p;
+
+		switch (side) {
+		case SIDE_ENTRY:
+			e = wdtable_lookup(&table, wds[i]);
+			sum += e->parent_wd + *wdtable_name(&table, e);
+			break;
+		case SIDE_PATH:
+			sum += wdtable_path(&table, wds[i], path, sizeof(path));
+			break;
+		case SIDE_MAP:
+			/* a consumer copies it out to append the event name */
+			p = map_lookup(wds[i]);
+			sum += strlen(p);
+			memcpy(path, p, strlen(p) + 1);
+			sum += path[0];
+			break;
+		}
+	}
+	return sum;
+}
+
+struct result {
+	unsigned long passes;
+	unsigned long sum;
+	double secs;
+};
+
+/* run one side for --duration (or --ops lookups), after --warmup */
+static void run(const char *name, enum side side, struct result *r)
+{
+	uint64_t start, now;
+	double warmup_ns = bench.warmup * 1e9;
+
+	memset(r, 0, sizeof(*r));
+	start = now_ns();
+	while (now_ns() - start < warmup_ns)
+		run_side(side);
+
+	start = now_ns();
+	do {
+		r->sum += run_side(side);
+		r->passes++;
+		now = now_ns();
+	} while (bench.ops ? r->passes * LOOKUPS < bench.ops :
+			     now - start < bench.duration * 1e9);
+	r->secs = (now - start) / 1e9;
+
+	printf("%-8s %lu lookups in %.3fs: %.1f Mlookups/s (%.1f ns each)\n", name,
+	       r->passes * LOOKUPS, r->secs, r->passes * LOOKUPS / r->secs / 1e6,
+	       r->secs * 1e9 / (r->passes * LOOKUPS));
+}
+
+static void json_result(struct json *j, const char *key, const struct result *r)
+{
+	json_object_begin(j, key);
+	json_uint(j, "lookups", r->passes * LOOKUPS);
+	json_double(j, "elapsed", r->secs);
+	json_double(j, "lookups_per_sec", r->passes * LOOKUPS / r->secs);
+	json_object_end(j);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"dirs",	required_argument,	0, 'n'},
+		{"fanout",	required_argument,	0, 'f'},
+		BENCH_LONG_OPTIONS,
+		{0,	0,	0,	0 }
+	};
+	struct result entry, path, hash;
+	size_t table_heap, map_heap;
+	double table_secs, map_secs;
+	uint64_t rng;
+	struct json j;
+	unsigned int i;
+	int c;
+
+	bench_opts_init(&bench);
+	while ((c = getopt_long(argc, argv, "n:f:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			num_dirs = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fanout = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			if (c < BENCH_OPT_BASE || bench_parse_opt(&bench, c, optarg)) {
+				fprintf(stderr, "usage: %s [--dirs N] [--fanout N] [--duration SECS] "
+					"[--ops LOOKUPS] [--warmup SECS] [--seed N] [--json PATH]\n",
+					argv[0]);
+				return 1;
+			}
+		}
+	}
+	if (bench_opts_done(&bench, BENCH_ALL))
+		return 1;
+	if (!bench.duration && !bench.ops)
+		bench.duration = 1;
+	if (!num_dirs || !fanout) {
+		fprintf(stderr, "--dirs and --fanout must be at least 1\n");
+		return 1;
+	}
+
+	build_names();
+	table_secs = build_table(&table_heap);
+	map_secs = build_map(&map_heap);
+	rng = bench.seed;
+	for (i = 0; i < LOOKUPS; i++)
+		wds[i] = bench_rand(&rng) % (num_dirs + 1) + 1;
+
+	printf("%lu watches, %u unique names\n", num_dirs + 1, table.intern_count);
+	printf("table    %zu bytes (%.1f bytes/watch), built in %.3fs\n", table_heap,
+	       (double)table_heap / (num_dirs + 1), table_secs);
+	printf("hashmap  %zu bytes (%.1f bytes/watch), built in %.3fs\n", map_heap,
+	       (double)map_heap / (num_dirs + 1), map_secs);
+
+	run("entry", SIDE_ENTRY, &entry);
+	run("path", SIDE_PATH, &path);
+	run("hashmap", SIDE_MAP, &hash);
+
+	if (json_open(&j, bench.json))
+		return 1;
+	json_bench_header(&j, "wdtable_bench", &bench);
+	json_uint(&j, "watches", num_dirs + 1);
+	json_uint(&j, "fanout", fanout);
+	json_uint(&j, "unique_names", table.intern_count);
+	json_object_begin(&j, "memory");
+	json_uint(&j, "table_bytes", table_heap);
+	json_double(&j, "table_bytes_per_watch", (double)table_heap / (num_dirs + 1));
+	json_uint(&j, "hashmap_bytes", map_heap);
+	json_double(&j, "hashmap_bytes_per_watch", (double)map_heap / (num_dirs + 1));
+	json_object_end(&j);
+	json_result(&j, "entry_lookup", &entry);
+	json_result(&j, "path_lookup", &path);
+	json_result(&j, "hashmap_lookup", &hash);
+	json_close(&j);
+
+	return 0;
+}